@@ -0,0 +1,630 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    AGPL EXCEPTION:
+    The AGPL license applies only to this file itself.
+
+    As a special exception, the copyright holders of this file give you permission
+    to use it, regardless of the license terms of your work, and to copy and distribute
+    them under terms of your choice.
+    If you do any changes to this file, these changes must be published under AGPL.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <zlib.h>
+
+#include <dracon/http.h>
+#include <dracon/stream.h>
+#include <dracon/utils.h>
+
+namespace Dracon {
+
+/// The response content encodings supported by CompressedStream
+enum class ContentEncoding {
+    Identity,
+    Gzip,
+    Deflate
+};
+
+/// The responses smaller than this size are not worth compressing
+constexpr size_t DefaultCompressionThreshold = 1024;
+
+namespace Internal {
+/// zlib counts the input and the output in uInt, bigger buffers are fed in chunks
+constexpr size_t MaxZlibChunk = std::numeric_limits<uInt>::max();
+
+inline bool iequals(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() &&
+            std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+                return std::tolower(uint8_t(x)) == std::tolower(uint8_t(y));
+            });
+}
+
+inline std::string_view trimmed(std::string_view str)
+{
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+        str.remove_prefix(1);
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+        str.remove_suffix(1);
+    return str;
+}
+
+inline const std::string *findField(const Fields &fields, std::string_view name)
+{
+    for (const auto &kv : fields)
+        if (iequals(kv.first, name))
+            return &kv.second;
+    return nullptr;
+}
+
+/*!
+ * \brief The Deflater struct
+ *
+ * A zlib compressor and its output buffer. The zlib state is expensive to
+ * allocate, therefore the deflaters are reused, see \l acquire and \l release.
+ */
+struct Deflater
+{
+    static constexpr size_t OutputSize = 16 * 1024;
+    static constexpr size_t MaxPooled = 16;
+
+    Deflater(ContentEncoding encoding, int level)
+        : encoding(encoding)
+        , level(level)
+        , output(std::make_unique<uint8_t[]>(OutputSize))
+    {
+        // 15 + 16 selects the gzip wrapper, 15 the zlib ("deflate") wrapper
+        const int windowBits = encoding == ContentEncoding::Gzip ? 15 + 16 : 15;
+        if (deflateInit2(&stream, level, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+            throw std::bad_alloc{};
+    }
+
+    ~Deflater()
+    {
+        deflateEnd(&stream);
+    }
+
+    /// Every thread (event loop) has its own pool, the hot path doesn't need any locking
+    static std::vector<std::unique_ptr<Deflater>> &pool()
+    {
+        static thread_local std::vector<std::unique_ptr<Deflater>> deflaters;
+        return deflaters;
+    }
+
+    static std::unique_ptr<Deflater> acquire(ContentEncoding encoding, int level)
+    {
+        auto &deflaters = pool();
+        for (auto it = deflaters.rbegin(); it != deflaters.rend(); ++it) {
+            if ((*it)->encoding == encoding && (*it)->level == level) {
+                auto res = std::move(*it);
+                deflaters.erase(std::next(it).base());
+                return res;
+            }
+        }
+        return std::make_unique<Deflater>(encoding, level);
+    }
+
+    static void release(std::unique_ptr<Deflater> deflater) noexcept
+    {
+        if (deflateReset(&deflater->stream) != Z_OK)
+            return;
+        auto &deflaters = pool();
+        try {
+            if (deflaters.size() >= MaxPooled)
+                deflaters.erase(deflaters.begin());
+            deflaters.push_back(std::move(deflater));
+        } catch (...) {}
+    }
+
+    ContentEncoding encoding;
+    int level;
+    z_stream stream{};
+    std::unique_ptr<uint8_t[]> output;
+};
+} // namespace Internal
+
+namespace Internal {
+struct AcceptedEncodings
+{
+    double gzip = 0;
+    double deflate = 0;
+};
+
+inline AcceptedEncodings acceptedEncodings(const Request &req)
+{
+    auto acceptEncoding = findField(req, "Accept-Encoding");
+    if (!acceptEncoding)
+        return {};
+    double gzip = -1, deflate = -1, any = -1;
+    for (auto coding : split(*acceptEncoding, ',')) {
+        double q = 1;
+        auto pos = coding.find(';');
+        if (pos != std::string_view::npos) {
+            auto param = trimmed(coding.substr(pos + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=')
+                q = std::strtod(std::string{param.substr(2)}.c_str(), nullptr);
+            coding = coding.substr(0, pos);
+        }
+        coding = trimmed(coding);
+        if (iequals(coding, "gzip") || iequals(coding, "x-gzip"))
+            gzip = std::max(gzip, q);
+        else if (iequals(coding, "deflate"))
+            deflate = std::max(deflate, q);
+        else if (coding == "*")
+            any = q;
+    }
+    return {gzip < 0 ? any : gzip, deflate < 0 ? any : deflate};
+}
+} // namespace Internal
+
+/*!
+ * \brief negotiateEncoding
+ *
+ * Picks the best encoding accepted by the client's Accept-Encoding header.
+ * The q-values are honored, gzip is preferred over deflate.
+ */
+inline ContentEncoding negotiateEncoding(const Request &req)
+{
+    auto accepted = Internal::acceptedEncodings(req);
+    if (accepted.gzip <= 0 && accepted.deflate <= 0)
+        return ContentEncoding::Identity;
+    return accepted.gzip >= accepted.deflate ? ContentEncoding::Gzip : ContentEncoding::Deflate;
+}
+
+/*!
+ * \brief acceptsEncoding
+ *
+ * \return true if the client accepts \a encoding, even if it's not its preferred one
+ */
+inline bool acceptsEncoding(const Request &req, ContentEncoding encoding)
+{
+    auto accepted = Internal::acceptedEncodings(req);
+    switch (encoding) {
+    case ContentEncoding::Gzip:
+        return accepted.gzip > 0;
+    case ContentEncoding::Deflate:
+        return accepted.deflate > 0;
+    default:
+        return true;
+    }
+}
+
+/*!
+ * \brief compress
+ *
+ * Compresses \a data at once, it's meant for the data which is compressed once
+ * and sent many times (e.g. cached static files), not for the responses.
+ */
+inline std::string compress(std::string_view data, ContentEncoding encoding = ContentEncoding::Gzip,
+                            int level = Z_BEST_COMPRESSION)
+{
+    if (encoding == ContentEncoding::Identity)
+        return std::string{data};
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, encoding == ContentEncoding::Gzip ? 15 + 16 : 15,
+                     8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::bad_alloc{};
+    std::string res;
+    res.resize(deflateBound(&stream, uLong(data.size())));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.next_out = reinterpret_cast<Bytef *>(res.data());
+    size_t inputLeft = data.size();
+    size_t outputLeft = res.size();
+    int ret;
+    do {
+        auto input = std::min(inputLeft, Internal::MaxZlibChunk);
+        auto output = std::min(outputLeft, Internal::MaxZlibChunk);
+        stream.avail_in = uInt(input);
+        stream.avail_out = uInt(output);
+        ret = ::deflate(&stream, input == inputLeft ? Z_FINISH : Z_NO_FLUSH);
+        inputLeft -= input - stream.avail_in;
+        outputLeft -= output - stream.avail_out;
+    } while (ret == Z_OK);
+    res.resize(res.size() - outputLeft);
+    deflateEnd(&stream);
+    if (ret != Z_STREAM_END)
+        throw std::runtime_error{"Can't compress the data"};
+    return res;
+}
+
+/*!
+ * \brief isCompressibleType
+ *
+ * \return true if it's worth compressing \a contentType (text, json, xml, javascript, svg ...).
+ * The already compressed formats (images, video, audio, archives, woff fonts) are not.
+ */
+inline bool isCompressibleType(std::string_view contentType)
+{
+    auto pos = contentType.find(';');
+    if (pos != std::string_view::npos)
+        contentType = contentType.substr(0, pos);
+    std::string type{Internal::trimmed(contentType)};
+    std::transform(type.begin(), type.end(), type.begin(), [](char c) { return std::tolower(uint8_t(c)); });
+    if (type.compare(0, 5, "text/") == 0)
+        return true;
+    auto endsWith = [&type](std::string_view suffix) {
+        return type.size() >= suffix.size() && type.compare(type.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    if (endsWith("+json") || endsWith("+xml"))
+        return true;
+    static const std::string_view compressible[] = {
+        "application/json", "application/javascript", "application/x-javascript",
+        "application/ecmascript", "application/xml", "application/wasm",
+        "application/x-font-ttf", "application/vnd.ms-fontobject",
+        "font/ttf", "font/otf", "image/x-icon", "image/vnd.microsoft.icon", "image/bmp"
+    };
+    return std::find(std::begin(compressible), std::end(compressible), type) != std::end(compressible);
+}
+
+/*!
+ * \brief prepareCompression
+ *
+ * Decides if the \a res response to \a req should be compressed.
+ * The responses smaller than \a threshold, the ones with incompressible
+ * content types and the ones which are already encoded are sent as they are.
+ * When compressing, it sets the Content-Encoding header and switches \a res to chunked data.
+ * The Vary header is always set, the caches must not mix the encodings.
+ *
+ * \param size the size of the uncompressed body, ChunkedData if it's unknown
+ * \return the encoding to use with CompressedStream
+ * {code}
+ * Dracon::Response res{200, {}, {{"Content-Type", "application/json"}}};
+ * auto encoding = Dracon::prepareCompression(req, res, json.size());
+ * if (encoding == Dracon::ContentEncoding::Identity) {
+ *     stream << res.setBody(std::move(json));
+ * } else {
+ *     stream << res;
+ *     Dracon::ChunkedStream chunkedStream{stream};
+ *     Dracon::CompressedStream{chunkedStream, encoding}.write(json);
+ * }
+ * {/code}
+ */
+inline ContentEncoding prepareCompression(const Request &req, Response &res, size_t size = ChunkedData,
+                                          size_t threshold = DefaultCompressionThreshold)
+{
+    auto &vary = res["Vary"];
+    if (vary.empty())
+        vary = "Accept-Encoding";
+    else if (vary.find("Accept-Encoding") == std::string::npos)
+        vary += ", Accept-Encoding";
+    if (size < threshold || req.method() == "HEAD" || Internal::findField(res, "Content-Encoding"))
+        return ContentEncoding::Identity;
+    auto contentType = Internal::findField(res, "Content-Type");
+    if (!contentType || !isCompressibleType(*contentType))
+        return ContentEncoding::Identity;
+    auto encoding = negotiateEncoding(req);
+    if (encoding == ContentEncoding::Identity)
+        return encoding;
+    res["Content-Encoding"] = encoding == ContentEncoding::Gzip ? "gzip" : "deflate";
+    res.setContentLength(ChunkedData);
+    return encoding;
+}
+
+/*!
+ * \brief The CompressedStream class
+ *
+ * Compresses incrementally everything written and writes the result to the next layer,
+ * which usually is a ChunkedStream. The zlib state comes from a per thread (event loop) pool.
+ * The compressed stream ends when the object is destroyed or \l finish is called.
+ */
+class CompressedStream final : public NextLayerStream
+{
+public:
+    CompressedStream(AbstractStream &nextLayer, ContentEncoding encoding, int level = Z_DEFAULT_COMPRESSION)
+        : NextLayerStream(nextLayer)
+    {
+        if (encoding != ContentEncoding::Identity)
+            m_deflater = Internal::Deflater::acquire(encoding, level);
+    }
+
+    ~CompressedStream()
+    {
+        try {
+            finish();
+        } catch (...) {}
+        if (m_deflater)
+            Internal::Deflater::release(std::move(m_deflater));
+    }
+
+    // abstract_stream interface
+    void write(ConstBuffer buffer) final
+    {
+        if (!m_deflater) {
+            if (!m_finished)
+                m_nextLayer.write(buffer);
+            return;
+        }
+        if (buffer.length)
+            deflate(buffer, Z_NO_FLUSH);
+    }
+
+    void write(std::vector<ConstBuffer> buffers) final
+    {
+        for (const auto &buffer : buffers)
+            write(buffer);
+    }
+
+    /*!
+     * \brief flush
+     * Sends everything written so far, e.g. before the session yields waiting for more data
+     */
+    void flush()
+    {
+        if (m_deflater && !m_finished)
+            deflate({}, Z_SYNC_FLUSH);
+    }
+
+    /*!
+     * \brief finish
+     * Ends the compressed stream, nothing can be written after it.
+     */
+    void finish()
+    {
+        if (m_finished)
+            return;
+        if (m_deflater)
+            deflate({}, Z_FINISH);
+        m_finished = true;
+    }
+
+private:
+    void deflate(ConstBuffer buffer, int flush)
+    {
+        if (m_finished)
+            throw std::make_error_code(std::errc::broken_pipe);
+        auto &stream = m_deflater->stream;
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(buffer.c_ptr));
+        size_t inputLeft = buffer.length;
+        do {
+            auto input = std::min(inputLeft, Internal::MaxZlibChunk);
+            inputLeft -= input;
+            stream.avail_in = uInt(input);
+            // flush only after the last chunk
+            const int chunkFlush = inputLeft ? Z_NO_FLUSH : flush;
+            int res;
+            do {
+                stream.next_out = m_deflater->output.get();
+                stream.avail_out = uInt(Internal::Deflater::OutputSize);
+                res = ::deflate(&stream, chunkFlush);
+                if (res == Z_STREAM_ERROR)
+                    throw std::make_error_code(std::errc::io_error);
+                size_t size = Internal::Deflater::OutputSize - stream.avail_out;
+                if (size)
+                    m_nextLayer.write({m_deflater->output.get(), size});
+            } while (stream.avail_out == 0 || (chunkFlush == Z_FINISH && res != Z_STREAM_END));
+        } while (inputLeft);
+    }
+
+private:
+    std::unique_ptr<Internal::Deflater> m_deflater;
+    bool m_finished = false;
+};
+
+/// The default upper limit of decompressed / compressed request body sizes
+constexpr size_t DefaultMaxDecompressionRatio = 100;
+
+namespace Internal {
+/*!
+ * \brief The Inflater struct
+ *
+ * A zlib decompressor and its bounded output buffer, pooled per thread like Deflater.
+ */
+struct Inflater
+{
+    static constexpr size_t OutputSize = 16 * 1024;
+    static constexpr size_t MaxPooled = 16;
+
+    Inflater()
+        : output(std::make_unique<uint8_t[]>(OutputSize))
+    {
+        // 15 + 32 detects the gzip or the zlib wrapper automatically
+        if (inflateInit2(&stream, 15 + 32) != Z_OK)
+            throw std::bad_alloc{};
+    }
+
+    ~Inflater()
+    {
+        inflateEnd(&stream);
+    }
+
+    static std::vector<std::unique_ptr<Inflater>> &pool()
+    {
+        static thread_local std::vector<std::unique_ptr<Inflater>> inflaters;
+        return inflaters;
+    }
+
+    static std::unique_ptr<Inflater> acquire()
+    {
+        auto &inflaters = pool();
+        if (inflaters.empty())
+            return std::make_unique<Inflater>();
+        auto res = std::move(inflaters.back());
+        inflaters.pop_back();
+        return res;
+    }
+
+    static void release(std::unique_ptr<Inflater> inflater) noexcept
+    {
+        if (inflateReset(&inflater->stream) != Z_OK)
+            return;
+        auto &inflaters = pool();
+        try {
+            if (inflaters.size() < MaxPooled)
+                inflaters.push_back(std::move(inflater));
+        } catch (...) {}
+    }
+
+    z_stream stream{};
+    std::unique_ptr<uint8_t[]> output;
+};
+} // namespace Internal
+
+/*!
+ * \brief The BodyDecompressor class
+ *
+ * Inflates a gzip or deflate request body as it arrives and passes the plain
+ * chunks (at most Inflater::OutputSize bytes each) to the body callback.
+ * It fails with 413 if the plain body exceeds \a maxSize or if it's more than
+ * \a maxRatio times bigger than the compressed body (decompression bombs),
+ * with 400 if the compressed data is invalid or truncated.
+ */
+class BodyDecompressor
+{
+public:
+    BodyDecompressor(Request::BodyCallback callback, size_t maxSize, size_t maxRatio = DefaultMaxDecompressionRatio)
+        : m_callback(std::move(callback))
+        , m_maxSize(maxSize)
+        , m_maxRatio(maxRatio)
+        , m_inflater(Internal::Inflater::acquire())
+    {}
+
+    ~BodyDecompressor()
+    {
+        if (m_inflater)
+            Internal::Inflater::release(std::move(m_inflater));
+    }
+
+    void write(std::string_view compressed)
+    {
+        while (compressed.size() > Internal::MaxZlibChunk) {
+            inflate(compressed.substr(0, Internal::MaxZlibChunk));
+            compressed.remove_prefix(Internal::MaxZlibChunk);
+        }
+        inflate(compressed);
+    }
+
+    /*!
+     * \brief finish
+     * Called when the whole body was received, it fails if the compressed data is truncated
+     */
+    void finish()
+    {
+        if (!m_memberEnd && m_compressedSize)
+            throw Response{400, std::string_view{"Truncated compressed body"}};
+    }
+
+    size_t compressedSize() const noexcept { return m_compressedSize; }
+    size_t size() const noexcept { return m_size; }
+
+private:
+    void inflate(std::string_view compressed)
+    {
+        if (compressed.empty())
+            return;
+        auto &stream = m_inflater->stream;
+        if (m_memberEnd) {
+            // gzip allows concatenated members, the next one may start in a later chunk.
+            // Anything else after the compressed data fails in its header.
+            if (inflateReset(&stream) != Z_OK)
+                throw Response{400, std::string_view{"Invalid compressed body"}};
+            m_memberEnd = false;
+        }
+        m_compressedSize += compressed.size();
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(compressed.data()));
+        stream.avail_in = uInt(compressed.size());
+        do {
+            stream.next_out = m_inflater->output.get();
+            stream.avail_out = uInt(Internal::Inflater::OutputSize);
+            auto res = ::inflate(&stream, Z_NO_FLUSH);
+            if (res != Z_OK && res != Z_STREAM_END && res != Z_BUF_ERROR)
+                throw Response{400, std::string_view{"Invalid compressed body"}};
+            size_t size = Internal::Inflater::OutputSize - stream.avail_out;
+            m_size += size;
+            if (m_size > m_maxSize ||
+                    m_size > std::max(Internal::Inflater::OutputSize, m_compressedSize * m_maxRatio))
+                throw Response{413};
+            if (size)
+                m_callback({reinterpret_cast<const char *>(m_inflater->output.get()), size});
+            if (res == Z_STREAM_END) {
+                // gzip allows concatenated members
+                if (!stream.avail_in) {
+                    m_memberEnd = true;
+                    break;
+                }
+                if (inflateReset(&stream) != Z_OK)
+                    throw Response{400, std::string_view{"Invalid compressed body"}};
+            } else if (res == Z_BUF_ERROR) {
+                break;
+            }
+        } while (stream.avail_in || stream.avail_out == 0);
+    }
+
+private:
+    Request::BodyCallback m_callback;
+    size_t m_maxSize;
+    size_t m_maxRatio;
+    size_t m_compressedSize = 0;
+    size_t m_size = 0;
+    // the last chunk ended exactly at the end of a member
+    bool m_memberEnd = false;
+    std::unique_ptr<Internal::Inflater> m_inflater;
+};
+
+/*!
+ * \brief appendDecompressedBodyCallback
+ *
+ * Opt-in alternative to Request::appendBodyCallback: if the body is gzip or deflate
+ * encoded, \a callback receives the decompressed chunks as they arrive, otherwise it
+ * gets the body as it is. Any other Content-Encoding is rejected with 415.
+ *
+ * \param maxSize the max size of the decompressed body
+ * \param maxRatio the max decompressed / compressed size ratio
+ * {code}
+ * std::string json;
+ * Dracon::appendDecompressedBodyCallback(req, [&](std::string_view buff){
+ *     json.append(buff);
+ * }, 512 * 1024);
+ * stream >> req;
+ * {/code}
+ */
+inline void appendDecompressedBodyCallback(Request &req, const Request::BodyCallback &callback,
+                                           size_t maxSize = std::numeric_limits<size_t>::max() - 1,
+                                           size_t maxRatio = DefaultMaxDecompressionRatio)
+{
+    auto contentEncoding = Internal::findField(req, "Content-Encoding");
+    auto encoding = contentEncoding ? Internal::trimmed(*contentEncoding) : std::string_view{};
+    if (encoding.empty() || Internal::iequals(encoding, "identity")) {
+        req.appendBodyCallback(callback, maxSize);
+        return;
+    }
+    if (!Internal::iequals(encoding, "gzip") && !Internal::iequals(encoding, "x-gzip") &&
+            !Internal::iequals(encoding, "deflate"))
+        throw Response{415, std::string_view{"Unsupported Content-Encoding"}, {{"Accept-Encoding", "gzip, deflate"}}};
+
+    // the compressed body can't be bigger than maxSize either
+    auto decompressor = std::make_shared<BodyDecompressor>(callback, maxSize, maxRatio);
+    req.appendBodyCallback([decompressor](std::string_view buff) {
+        decompressor->write(buff);
+    }, maxSize);
+    req.setBodyCompletedCallback([decompressor] {
+        decompressor->finish();
+    });
+}
+
+} // namespace Dracon
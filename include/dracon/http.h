@@ -64,6 +64,7 @@ static const std::unordered_map<uint16_t, std::string_view> StatusCodes = {
     {305, "305 Use Proxy\r\n"},
     {306, "306 Switch Proxy\r\n"},
     {307, "307 Temporary Redirect\r\n"},
+    {308, "308 Permanent Redirect\r\n"},
 
     // Client Error 4xx
     {400, "400 Bad Request\r\n"},
@@ -82,8 +83,13 @@ static const std::unordered_map<uint16_t, std::string_view> StatusCodes = {
     {413, "413 Request Entity Too Large\r\n"},
     {414, "414 Request-URI Too Long\r\n"},
     {415, "415 Unsupported Media Type\r\n"},
-    {416, "415 Requested Range Not Satisfiable\r\n"},
+    {416, "416 Requested Range Not Satisfiable\r\n"},
     {417, "417 Expectation Failed\r\n"},
+    {422, "422 Unprocessable Entity\r\n"},
+    {426, "426 Upgrade Required\r\n"},
+    {428, "428 Precondition Required\r\n"},
+    {429, "429 Too Many Requests\r\n"},
+    {431, "431 Request Header Fields Too Large\r\n"},
 
     // Server Error 5xx
     {500, "500 Internal Server Error\r\n"},
@@ -162,7 +168,7 @@ public:
             keepAliveOverride = m_keep_alive;
         if (m_contentLength == ChunkedData)
             res << "Transfer-Encoding: chunked\r\n";
-        else
+        else if (statusCode != 304) // 304 responses describe the cached body
             res << "Content-Length: " << m_contentLength << CrlfString;
         if (keepAliveOverride.count() > 0) {
             res << "Keep-Alive: timeout=" << keepAliveOverride.count() << CrlfString;
@@ -222,6 +228,10 @@ public:
     bool keepAlive() const noexcept { return m_keep_alive; }
     void setKeepAlive(bool keep) noexcept { m_keep_alive = keep; }
 
+    /// The virtual host which serves the request, as it's named in the server configuration, empty if none matches
+    std::string_view virtualHost() const noexcept { return m_virtualHost; }
+    void setVirtualHost(std::string_view host) noexcept { m_virtualHost = host; }
+
     void appendBodyCallback(const BodyCallback &callback, size_t max_size = std::numeric_limits<size_t>::max() - 1) noexcept
     {
         m_maxBodySize = max_size;
@@ -235,6 +245,21 @@ public:
         m_callback(body);
     }
 
+    /*!
+     * \brief setBodyCompletedCallback
+     * \a callback is called after the last body chunk was passed to the body callback
+     */
+    void setBodyCompletedCallback(const std::function<void()> &callback) noexcept
+    {
+        m_completedCallback = callback;
+    }
+
+    void bodyCompleted() noexcept(false)
+    {
+        if (m_completedCallback)
+            m_completedCallback();
+    }
+
     size_t contentLength() const
     {
         auto it = find("Content-Length");
@@ -257,7 +282,9 @@ private:
     bool m_keep_alive = false;
     std::string m_url;
     std::string m_method;
+    std::string_view m_virtualHost;
     BodyCallback m_callback;
+    std::function<void()> m_completedCallback;
     enum State m_state = State::Uninitialized;
     size_t m_maxBodySize = 0;
 };
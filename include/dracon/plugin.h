@@ -26,15 +26,26 @@
 
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
 #include <functional>
+#include <new>
 #include <string>
+#include <utility>
+#include <vector>
+
+#include <dracon/unique_function.h>
 
 namespace Dracon {
 class AbstractStream;
 class Request;
 
-#define PLUGIN_EXPORT extern "C" __attribute__ ((visibility("default")))
+#ifdef DRACON_STATIC_PLUGIN
+// The plugin is linked into the server, its functions are reached only through DRACON_REGISTER_PLUGIN
+# define PLUGIN_EXPORT static
+#else
+# define PLUGIN_EXPORT extern "C" __attribute__ ((visibility("default")))
+#endif
 
 /*!
  Every plugin must implement the following functions as PLUGIN_EXPORT functions:
@@ -60,9 +71,59 @@ PLUGIN_EXPORT void destory_plugin()
 {
 // This function is called by the server when it closes. The plugin should wait in this function until it finishes the clean up.
 }
+
+PLUGIN_EXPORT Dracon::PluginRoutes plugin_routes()
+{
+    // The server calls this function after init_plugin, create_session is called only
+    // for the requests which match one of the returned routes
+}
+{/code}
+
+  Only "create_session" and "plugin_order" are required, "init_plugin", "destory_plugin" and "plugin_routes" are called only if they are found.
+  The plugins without "plugin_routes" are asked for every request.
+
+ ABI v2
+
+ Instead of the above functions a plugin may export a single C function which returns its
+ DraconPlugin table. The server prefers it when it's found. Nothing but C types cross the boundary:
+ the plugin reads the requests through the DraconServer functions and declares its routes in the table.
+
+{code}
+const DraconServer *s_server = nullptr;
+const char *const s_methods[] = {"GET", nullptr};
+const DraconRoute s_routes[] = {{"/api/", s_methods, nullptr}, {nullptr, nullptr, nullptr}};
+
+PLUGIN_EXPORT const DraconPlugin *dracon_plugin(const DraconServer *server)
+{
+    s_server = server;
+    static const DraconPlugin plugin = {
+        DRACON_PLUGIN_ABI_VERSION, sizeof(DraconPlugin),
+        DRACON_PLUGIN_STREAMING_BODY | DRACON_PLUGIN_ASYNC, // capabilities
+        1000, // order
+        sizeof(MyHandler), alignof(MyHandler),
+        nullptr, // context, passed back to init, initLoop, createHandler and destroy
+        init, initLoop,
+        createHandler, // constructs a MyHandler in the server storage if it handles the request, otherwise returns null
+        Dracon::PluginHandler<MyHandler>::run,
+        Dracon::PluginHandler<MyHandler>::destroy,
+        destroy,
+        s_routes // null for all the requests
+    };
+    return &plugin;
+}
 {/code}
 
-  Only "create_session" and "plugin_order" are required, "init_plugin" and "destory_plugin" are called only if they are found
+ Static plugins
+
+ The plugins may also be linked into the server binary (see GETODAC_STATIC_PLUGINS in CMake), in that case
+ they are built with DRACON_STATIC_PLUGIN and must register their functions at the end of their source:
+
+{code}
+DRACON_REGISTER_PLUGIN(myPlugin, init_plugin, create_session, plugin_order, destory_plugin, plugin_routes);
+// or for the ABI v2 plugins
+DRACON_REGISTER_PLUGIN_V2(myPlugin, dracon_plugin);
+{/code}
+ The optional functions may be nullptr. The macros expand to nothing when the plugin is a shared library.
 */
 
 /// The server calls this function when it loads the plugin
@@ -71,11 +132,190 @@ using InitPluginType = bool (*)(const std::string &);
 /// The server calls this function to get the plugin order
 using PluginOrder = uint32_t (*)();
 
+/// The sessions up to this size (e.g. a RESTful handler with its parsed route) are created without allocations
+constexpr size_t HttpSessionInlineSize = 320;
+
 /// The server calls this function when it needs to create a new session
-using HttpSession = std::function<void(Dracon::AbstractStream&, Dracon::Request&)>;
+using HttpSession = UniqueFunction<void(Dracon::AbstractStream&, Dracon::Request&), HttpSessionInlineSize>;
 using CreateSessionType = HttpSession (*)(const Dracon::Request&);
 
 /// The server calls this function when it destoyes the plugins
 using DestoryPluginType = void (*)();
 
+/*!
+ * \brief The PluginRoute struct
+ *
+ * The requests a plugin handles: the url prefix, the methods and the hosts.
+ * A host matches the Host header without the port or the name of the virtual host which serves the request.
+ * Empty methods or hosts match all of them.
+ */
+struct PluginRoute
+{
+    std::string prefix;
+    std::vector<std::string> methods = {};
+    std::vector<std::string> hosts = {};
+};
+using PluginRoutes = std::vector<PluginRoute>;
+
+/// The server calls this function after it initializes the plugin, to index its routes
+using PluginRoutesType = PluginRoutes (*)();
+
 } // namespace dracon
+
+extern "C" {
+
+#define DRACON_PLUGIN_ABI_VERSION 2
+
+/// The DraconPlugin capabilities
+enum DraconPluginCapabilities {
+    /// The handlers read the request body, without it the plugin gets only the requests without a body
+    DRACON_PLUGIN_STREAMING_BODY = 1,
+    /// The handlers may suspend the session (e.g. to wait for a worker or a descriptor)
+    DRACON_PLUGIN_ASYNC = 2,
+    /// The server calls initLoop from every event loop thread, before it serves any request
+    DRACON_PLUGIN_PER_LOOP_INIT = 4,
+};
+
+/// A Dracon::Request, opaque for the C plugins
+typedef struct DraconRequest DraconRequest;
+/// A Dracon::AbstractStream, opaque for the C plugins
+typedef struct DraconStream DraconStream;
+
+/// A string which is not null terminated
+typedef struct DraconString {
+    const char *data;
+    size_t size;
+} DraconString;
+
+/*!
+ * \brief The DraconServer struct
+ *
+ * The server functions given to the ABI v2 plugins, they read the requests without
+ * depending on the C++ classes layout. The strings point into the request.
+ * New members are added only at the end, \a size tells the plugin which ones are set.
+ */
+typedef struct DraconServer {
+    uint32_t abiVersion;
+    uint32_t size;
+    DraconString (*requestUrl)(const DraconRequest *request);
+    DraconString (*requestMethod)(const DraconRequest *request);
+    /// The value of the \a name header (case sensitive), its data is null if the request doesn't have it
+    DraconString (*requestHeader)(const DraconRequest *request, const char *name);
+} DraconServer;
+
+/*!
+ * \brief The DraconRoute struct
+ *
+ * A Dracon::PluginRoute, \a methods and \a hosts are null terminated arrays, null for all of them
+ */
+typedef struct DraconRoute {
+    const char *prefix;
+    const char *const *methods;
+    const char *const *hosts;
+} DraconRoute;
+
+/*!
+ * \brief The DraconPlugin struct
+ *
+ * The ABI v2 plugin table. The handlers are constructed by createHandler in a server storage
+ * of at least handlerSize bytes aligned to handlerAlign, runHandler serves the request and
+ * destroyHandler is called after it, even if runHandler throws.
+ * New members are added only at the end, \a size tells the server which ones are set and it's
+ * the only compatibility check: the server accepts any table which has at least the members up to
+ * \a destroy and treats the missing ones as null. \a abiVersion is the version the plugin was built with.
+ */
+typedef struct DraconPlugin {
+    uint32_t abiVersion;
+    uint32_t size;
+    uint32_t capabilities;
+    uint32_t order;
+    size_t handlerSize;
+    size_t handlerAlign;
+    void *context;
+    int (*init)(void *context, const char *confDir);
+    void (*initLoop)(void *context, uint32_t loop);
+    void *(*createHandler)(void *context, const DraconRequest *request, void *storage);
+    void (*runHandler)(void *handler, DraconStream *stream, DraconRequest *request);
+    void (*destroyHandler)(void *handler);
+    void (*destroy)(void *context);
+    /// The routes handled by the plugin, terminated by a null prefix. If it's null the plugin gets every request
+    const DraconRoute *routes;
+} DraconPlugin;
+
+/// The ABI v2 entry point, \a server is valid until the plugin is destroyed
+typedef const DraconPlugin *(*DraconPluginEntry)(const DraconServer *server);
+
+} // extern "C"
+
+namespace Dracon {
+
+inline const Request &request(const DraconRequest *request) { return *reinterpret_cast<const Request *>(request); }
+inline Request &request(DraconRequest *request) { return *reinterpret_cast<Request *>(request); }
+inline AbstractStream &stream(DraconStream *stream) { return *reinterpret_cast<AbstractStream *>(stream); }
+
+/*!
+ * \brief The PluginHandler struct
+ *
+ * The DraconPlugin functions of a C++ handler, \a Handler is called as handler(AbstractStream&, Request&).
+ */
+template <typename Handler>
+struct PluginHandler
+{
+    template <typename ...Args>
+    static void *construct(void *storage, Args &&...args)
+    {
+        return new (storage) Handler(std::forward<Args>(args)...);
+    }
+
+    static void run(void *handler, DraconStream *stream, DraconRequest *request)
+    {
+        (*static_cast<Handler *>(handler))(Dracon::stream(stream), Dracon::request(request));
+    }
+
+    static void destroy(void *handler)
+    {
+        static_cast<Handler *>(handler)->~Handler();
+    }
+};
+
+/*!
+ * \brief The StaticPlugin struct
+ *
+ * The functions of a plugin linked into the server, the same ones a shared plugin exports
+ */
+struct StaticPlugin
+{
+    /// The file name of the plugin shared library (e.g. libStaticContent.so), the shared plugins have the same name
+    const char *name;
+    InitPluginType init;
+    CreateSessionType createSession;
+    PluginOrder order;
+    DestoryPluginType destroy;
+    PluginRoutesType routes;
+    DraconPluginEntry entry;
+};
+
+} // namespace Dracon
+
+#ifdef DRACON_STATIC_PLUGIN
+# ifndef DRACON_PLUGIN_FILE_NAME
+#  error "The static plugins must define DRACON_PLUGIN_FILE_NAME, see add_plugin"
+# endif
+# define DRACON_REGISTER_PLUGIN(name, init, createSession, order, destroy, routes) \
+    extern "C" const Dracon::StaticPlugin *dracon_static_plugin_##name() \
+    { \
+        static const Dracon::StaticPlugin plugin{DRACON_PLUGIN_FILE_NAME, init, createSession, order, destroy, routes, nullptr}; \
+        return &plugin; \
+    } \
+    static_assert(true, "")
+# define DRACON_REGISTER_PLUGIN_V2(name, entry) \
+    extern "C" const Dracon::StaticPlugin *dracon_static_plugin_##name() \
+    { \
+        static const Dracon::StaticPlugin plugin{DRACON_PLUGIN_FILE_NAME, nullptr, nullptr, nullptr, nullptr, nullptr, entry}; \
+        return &plugin; \
+    } \
+    static_assert(true, "")
+#else
+# define DRACON_REGISTER_PLUGIN(name, init, createSession, order, destroy, routes) static_assert(true, "")
+# define DRACON_REGISTER_PLUGIN_V2(name, entry) static_assert(true, "")
+#endif
@@ -25,11 +25,18 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
 #include <cstring>
+#include <limits>
 #include <functional>
+#include <map>
 #include <memory>
 #include <string>
 #include <optional>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -44,13 +51,76 @@ class AbstractServerSession;
 
 using QueryStrings = std::vector<std::pair<std::string, std::string>>;
 
+/*!
+ * \brief The CapturedResources class
+ *
+ * The captured values of a route, in the route order. The first \a InlineCapacity of them
+ * are stored inline and the short values fit in the strings themselves,
+ * so capturing them allocates nothing in the common case.
+ * The names point to the route, which must outlive it.
+ */
+class CapturedResources
+{
+public:
+    using value_type = std::pair<std::string_view, std::string>;
+    using const_iterator = const value_type *;
+    static constexpr size_t InlineCapacity = 4;
+
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + m_size; }
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    const_iterator find(std::string_view name) const
+    {
+        for (auto it = begin(); it != end(); ++it)
+            if (it->first == name)
+                return it;
+        return end();
+    }
+
+    const std::string &at(std::string_view name) const
+    {
+        auto it = find(name);
+        if (it == end())
+            throw std::out_of_range{"No such captured resource"};
+        return it->second;
+    }
+
+    void emplace(std::string_view name, std::string_view value)
+    {
+        if (m_size < InlineCapacity) {
+            m_inline[m_size].first = name;
+            m_inline[m_size].second.assign(value.data(), value.size());
+        } else {
+            if (m_spilled.empty())
+                m_spilled.assign(std::make_move_iterator(m_inline.begin()), std::make_move_iterator(m_inline.end()));
+            m_spilled.emplace_back(name, std::string{value});
+        }
+        ++m_size;
+    }
+
+    bool operator ==(const CapturedResources &other) const
+    {
+        return std::equal(begin(), end(), other.begin(), other.end());
+    }
+
+private:
+    const value_type *data() const { return m_spilled.empty() ? m_inline.data() : m_spilled.data(); }
+
+private:
+    std::array<value_type, InlineCapacity> m_inline;
+    std::vector<value_type> m_spilled;
+    size_t m_size = 0;
+};
+
 struct ParsedRoute
 {
     /*!
      * \brief capturedResources
      * It contains all captured values
      */
-    std::unordered_map<std::string, std::string> capturedResources;
+    CapturedResources capturedResources;
     /*!
      * \brief The parsed queryStrings.
      * It's a key value pair vector. The order is the same as the URL order
@@ -61,9 +131,9 @@ struct ParsedRoute
      * \brief allNodeMethodsButOPTIONS
      *
      *  All the route node methods but without OPTIONS.
-     *  It's alredy formated to send OPTIONS responses.
+     *  It's alredy formated to send OPTIONS responses, it points to the route.
      */
-    std::string allButOPTIONSNodeMethods;
+    std::string_view allButOPTIONSNodeMethods;
 
     bool operator ==(const ParsedRoute &other) const
     {
@@ -72,6 +142,201 @@ struct ParsedRoute
     }
 };
 
+/*!
+ * The typed captures of the routes created with RestfulRouter::createTypedRoute.
+ * Every capture has a Type, match() validates a url segment and parse() converts it.
+ * The segments which don't match the capture types don't match the route.
+ */
+namespace Capture {
+
+/*!
+ * \brief The Integer struct
+ * A decimal integer in the [Min, Max] range
+ */
+template <typename T = uint64_t, T Min = std::numeric_limits<T>::min(), T Max = std::numeric_limits<T>::max()>
+struct Integer
+{
+    static_assert(std::is_integral_v<T>, "Integer captures must be integral");
+    using Type = T;
+    static bool parse(std::string_view str, T &value) noexcept
+    {
+        auto end = str.data() + str.size();
+        auto res = std::from_chars(str.data(), end, value);
+        return res.ec == std::errc{} && res.ptr == end && value >= Min && value <= Max;
+    }
+    static bool match(std::string_view str) noexcept
+    {
+        T value;
+        return parse(str, value);
+    }
+};
+
+/*!
+ * \brief The Uuid struct
+ * An UUID in the canonical 8-4-4-4-12 hex digits form
+ */
+struct Uuid
+{
+    using Type = std::array<uint8_t, 16>;
+    static bool parse(std::string_view str, Type &value) noexcept
+    {
+        if (!match(str))
+            return false;
+        size_t byte = 0;
+        for (size_t i = 0; i < str.size(); i += 2) {
+            if (str[i] == '-')
+                ++i;
+            value[byte++] = fromHex(str[i]) << 4 | fromHex(str[i + 1]);
+        }
+        return true;
+    }
+    static bool match(std::string_view str) noexcept
+    {
+        if (str.size() != 36)
+            return false;
+        for (size_t i = 0; i < str.size(); ++i) {
+            if (i == 8 || i == 13 || i == 18 || i == 23) {
+                if (str[i] != '-')
+                    return false;
+            } else if (!isxdigit(static_cast<unsigned char>(str[i]))) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/*!
+ * \brief The EnumNames struct
+ * Must be specialized for the enums used as Enumeration captures, e.g.
+ * template <> struct EnumNames<Color> {
+ *     static constexpr std::pair<std::string_view, Color> values[] = {{"red", Color::Red}, {"green", Color::Green}};
+ * };
+ */
+template <typename Enum>
+struct EnumNames;
+
+template <typename Enum>
+struct Enumeration
+{
+    using Type = Enum;
+    static bool parse(std::string_view str, Enum &value) noexcept
+    {
+        for (const auto &name : EnumNames<Enum>::values) {
+            if (name.first == str) {
+                value = name.second;
+                return true;
+            }
+        }
+        return false;
+    }
+    static bool match(std::string_view str) noexcept
+    {
+        Enum value;
+        return parse(str, value);
+    }
+};
+
+/*!
+ * \brief The String struct
+ * Any segment with a length in the [MinLength, MaxLength] range
+ */
+template <size_t MinLength = 1, size_t MaxLength = std::numeric_limits<size_t>::max()>
+struct String
+{
+    using Type = std::string;
+    static bool parse(std::string_view str, std::string &value)
+    {
+        if (!match(str))
+            return false;
+        value.assign(str.data(), str.size());
+        return true;
+    }
+    static bool match(std::string_view str) noexcept
+    {
+        return str.size() >= MinLength && str.size() <= MaxLength;
+    }
+};
+
+} // namespace Capture
+
+/*!
+ * \brief The TypedParsedRoute struct
+ * The ParsedRoute of the typed routes, the captures are already parsed, in the route order.
+ */
+template <typename ...Captures>
+struct TypedParsedRoute
+{
+    std::tuple<typename Captures::Type...> captures;
+    QueryStrings queryStrings;
+    std::string_view allButOPTIONSNodeMethods;
+};
+
+/// Validates a captured url segment, nullptr matches anything
+using CaptureMatcher = bool (*)(std::string_view) noexcept;
+
+/*!
+ * \brief The CapturedValues class
+ *
+ * The url segments captured while a route is looked up, in the route order.
+ * The first \a InlineCapacity of them are stored inline, only the routes with
+ * more captures allocate.
+ */
+class CapturedValues
+{
+public:
+    static constexpr size_t InlineCapacity = 8;
+
+    size_t size() const { return m_size; }
+    bool empty() const { return !m_size; }
+
+    std::string_view operator [](size_t pos) const
+    {
+        return pos < InlineCapacity ? m_inline[pos] : m_spilled[pos - InlineCapacity];
+    }
+
+    void push_back(std::string_view value)
+    {
+        if (m_size < InlineCapacity)
+            m_inline[m_size] = value;
+        else
+            m_spilled.push_back(value);
+        ++m_size;
+    }
+
+    void pop_back()
+    {
+        if (m_size > InlineCapacity)
+            m_spilled.pop_back();
+        --m_size;
+    }
+
+private:
+    std::array<std::string_view, InlineCapacity> m_inline;
+    std::vector<std::string_view> m_spilled;
+    size_t m_size = 0;
+};
+
+inline QueryStrings parseQueryStrings(std::string_view query)
+{
+    QueryStrings queryStrings;
+    for (const auto &kvPair : split(query, '&')) {
+        auto kv = split(kvPair, '=');
+        switch (kv.size()) {
+        case 1:
+            queryStrings.emplace_back(std::make_pair(unescapeUrl(kv[0]), ""));
+            break;
+        case 2:
+            queryStrings.emplace_back(std::make_pair(unescapeUrl(kv[0]),
+                                      unescapeUrl(kv[1])));
+            break;
+        default:
+            throw Response{400, "Invalid query strings"};
+        }
+    }
+    return queryStrings;
+}
+
 template <typename ReturnType, typename ...Args>
 using RESTfulRouteMethodHandler = std::function<ReturnType(ParsedRoute parsedRoute, Args ...args)>;
 
@@ -88,40 +353,68 @@ public:
      * \return
      */
     RestfullRoute &addMethodHandler(std::string method, RESTfulRouteMethodHandler<ReturnType, Args...> creator)
+    {
+        return addDispatcher(std::move(method), [this, creator = std::move(creator)](const Match &match, Args ...args) -> ReturnType {
+            ParsedRoute parsedRoute;
+            parsedRoute.allButOPTIONSNodeMethods = m_allMethods;
+            size_t capture = 0;
+            for (const auto &part : m_routeParts)
+                if (part.first)
+                    parsedRoute.capturedResources.emplace(part.second, match.captures[capture++]);
+            if (!match.query.empty())
+                parsedRoute.queryStrings = parseQueryStrings(match.query);
+            return creator(std::move(parsedRoute), args...);
+        });
+    }
+
+    bool operator == (std::string_view route) {
+        return sameRoute(routeParts(route), {});
+    }
+protected:
+    using RouteParts = std::vector<std::pair<bool, std::string>>;
+
+    /// The url parts which matched a route
+    struct Match
+    {
+        const CapturedValues &captures;
+        std::string_view query;
+    };
+    using Dispatcher = std::function<ReturnType(const Match &match, Args ...args)>;
+
+    RestfullRoute &addDispatcher(std::string method, Dispatcher dispatcher)
     {
         if (m_methods.find(method) == m_methods.end()) {
             if (method != "OPTIONS")
                 m_allMethods += m_allMethods.empty() ? method : ", " + method;
-            m_methods.emplace(std::move(method), std::move(creator));
+            m_methods.emplace(std::move(method), std::move(dispatcher));
         } else {
-            m_methods[method] = std::move(creator);
+            m_methods[method] = std::move(dispatcher);
         }
         return *this;
     }
 
-    bool operator == (std::string_view route) {
-        auto other = routeParts(route);
-        if (other.size() != m_routeParts.size())
-            return false;
-        for (size_t i = 0; i < other.size(); ++i) {
-            if (other[i].first != m_routeParts[i].first ||
-                    other[i].second != m_routeParts[i].second) {
-                return false;
-            }
-        }
-        return true;
+    bool sameRoute(const RouteParts &parts, const std::vector<CaptureMatcher> &matchers) const
+    {
+        return parts == m_routeParts && (matchers.empty() ? std::vector<CaptureMatcher>(captures(), nullptr) : matchers) == m_matchers;
+    }
+
+    size_t captures() const
+    {
+        return std::count_if(m_routeParts.begin(), m_routeParts.end(), [](const auto &part) { return part.first; });
     }
+
 protected:
-    using RouteParts = std::vector<std::pair<bool, std::string>>;
     RouteParts m_routeParts;
-    std::unordered_map<std::string, RESTfulRouteMethodHandler<ReturnType, Args...>> m_methods;
+    // one for every capture
+    std::vector<CaptureMatcher> m_matchers;
+    std::unordered_map<std::string, Dispatcher> m_methods;
     std::string m_allMethods;
 
 private:
     template <typename T, typename ...A>
     friend class RestfulRouter;
 
-    RouteParts routeParts(std::string_view route) const
+    static RouteParts routeParts(std::string_view route)
     {
         RouteParts res;
         auto routeParts = split(route, '/');
@@ -141,31 +434,95 @@ private:
      *
      * \param route the route to match, the capture resources must be inside {}
      *               e.g /api/v1/parents/{parent}/children/{child}
+     * \param matchers the capture validators, empty if any value is accepted
      */
-    RestfullRoute(std::string_view route)
-        : m_routeParts(std::move(routeParts(route)))
-    {}
+    RestfullRoute(RouteParts routeParts, std::vector<CaptureMatcher> matchers = {})
+        : m_routeParts(std::move(routeParts))
+        , m_matchers(std::move(matchers))
+    {
+        if (m_matchers.empty())
+            m_matchers.resize(captures(), nullptr);
+    }
 
-    using Captures = std::unordered_map<std::string, std::string>;
-    std::optional<std::pair<Captures, RESTfulRouteMethodHandler<ReturnType, Args...>>>
-    createHandler(const SplitVector &urlParts, const std::string &method) const
+    const Dispatcher &methodHandler(const std::string &method) const
     {
-        if (urlParts.size() != m_routeParts.size())
-            return {};
-        Captures captures;
-        for (size_t i = 0; i < urlParts.size(); ++i) {
-            const auto &part = m_routeParts[i];
-            if (part.first) {
-                captures[part.second] = urlParts[i];
-            } else if (part.second != urlParts[i]) {
-                return  {};
-            }
-        }
         auto method_it = m_methods.find(method);
         if (method_it == m_methods.end())
             throw Response{405, {}, {{"Allow", m_allMethods}}};
-        return std::make_optional(std::make_pair(std::move(captures), method_it->second));
+        return method_it->second;
+    }
+};
+
+/*!
+ * \brief The RouteTree class
+ *
+ * A trie of route segments compiled from the registered routes. The lookup walks
+ * the url segments once, the static segments are preferred over the captures
+ * and the typed captures over the untyped ones.
+ * The captured values are collected by their position, the route knows their names.
+ */
+template <typename Route>
+class RouteTree
+{
+public:
+    using RouteParts = std::vector<std::pair<bool, std::string>>;
+
+    void insert(const RouteParts &parts, const std::vector<CaptureMatcher> &matchers, std::shared_ptr<Route> route)
+    {
+        auto node = this;
+        size_t capture = 0;
+        for (const auto &part : parts) {
+            auto &next = part.first ? node->captureNode(matchers[capture++]) : node->m_children[part.second];
+            if (!next)
+                next = std::make_unique<RouteTree>();
+            node = next.get();
+        }
+        // like before, the first route registered with the same segments wins
+        if (!node->m_route)
+            node->m_route = std::move(route);
     }
+
+    /*!
+     * \brief find the route which matches the remaining url \a path
+     * \param captures the captured values, in the route order
+     */
+    const Route *find(std::string_view path, CapturedValues &captures) const
+    {
+        auto part = nextSegment(path, '/');
+        if (part.empty())
+            return m_route.get();
+        auto it = m_children.find(part);
+        if (it != m_children.end())
+            if (auto route = it->second->find(path, captures))
+                return route;
+        for (const auto &capture : m_captures) {
+            if (capture.first && !capture.first(part))
+                continue;
+            captures.push_back(part);
+            if (auto route = capture.second->find(path, captures))
+                return route;
+            captures.pop_back();
+        }
+        return nullptr;
+    }
+
+private:
+    std::unique_ptr<RouteTree> &captureNode(CaptureMatcher matcher)
+    {
+        for (auto &capture : m_captures)
+            if (capture.first == matcher)
+                return capture.second;
+        // the untyped capture is the last one
+        auto it = m_captures.end();
+        if (matcher && !m_captures.empty() && !m_captures.back().first)
+            --it;
+        return m_captures.emplace(it, matcher, nullptr)->second;
+    }
+
+private:
+    std::map<std::string, std::unique_ptr<RouteTree>, std::less<>> m_children;
+    std::vector<std::pair<CaptureMatcher, std::unique_ptr<RouteTree>>> m_captures;
+    std::shared_ptr<Route> m_route;
 };
 
 /*!
@@ -174,7 +531,54 @@ private:
 template <typename ReturnType, typename ...Args>
 class RestfulRouter
 {
-    using RESTfulRoutePtr = std::shared_ptr<RestfullRoute<ReturnType, Args...>>;
+    using RESTfulRoute = RestfullRoute<ReturnType, Args...>;
+    using RESTfulRoutePtr = std::shared_ptr<RESTfulRoute>;
+public:
+    /*!
+     * \brief The TypedRoute class
+     *
+     * A route with typed \a Captures, see createTypedRoute.
+     */
+    template <typename ...Captures>
+    class TypedRoute
+    {
+    public:
+        using Parsed = TypedParsedRoute<Captures...>;
+        using MethodHandler = std::function<ReturnType(Parsed parsedRoute, Args ...args)>;
+
+        TypedRoute &addMethodHandler(std::string method, MethodHandler creator)
+        {
+            auto route = m_route.get();
+            m_route->addDispatcher(std::move(method), [route, creator = std::move(creator)](const typename RESTfulRoute::Match &match, Args ...args) -> ReturnType {
+                Parsed parsedRoute;
+                parsedRoute.captures = parse(match.captures, std::index_sequence_for<Captures...>{});
+                parsedRoute.allButOPTIONSNodeMethods = route->m_allMethods;
+                if (!match.query.empty())
+                    parsedRoute.queryStrings = parseQueryStrings(match.query);
+                return creator(std::move(parsedRoute), args...);
+            });
+            return *this;
+        }
+
+    private:
+        friend class RestfulRouter;
+        explicit TypedRoute(RESTfulRoutePtr route)
+            : m_route(std::move(route))
+        {}
+
+        template <size_t ...I>
+        static std::tuple<typename Captures::Type...> parse(const CapturedValues &values, std::index_sequence<I...>)
+        {
+            // the values were already matched by the router
+            std::tuple<typename Captures::Type...> res;
+            (Captures::parse(values[I], std::get<I>(res)), ...);
+            return res;
+        }
+
+    private:
+        RESTfulRoutePtr m_route;
+    };
+
 public:
     RestfulRouter(std::string_view baseUrl = {})
     {
@@ -189,67 +593,89 @@ public:
      */
     RESTfulRoutePtr createRoute(std::string_view route)
     {
-        for (auto rt : m_routes)
-            if (*rt == route)
-                return rt;
-        return m_routes.emplace_back(RESTfulRoutePtr{new RestfullRoute<ReturnType, Args...>{route}});
+        return addRoute(RESTfulRoute::routeParts(route), {});
+    }
+
+    /*!
+     * \brief createTypedRoute
+     * Creates a route with typed \a Captures, one for every capture of the \a route, e.g.
+     * router.createTypedRoute<Capture::Integer<size_t>>("/devices/{device}")
+     * The url segments which don't match their capture types don't match the route
+     * and the method handlers get the parsed values.
+     */
+    template <typename ...Captures>
+    TypedRoute<Captures...> createTypedRoute(std::string_view route)
+    {
+        static_assert(sizeof...(Captures), "Use createRoute for the routes without captures");
+        auto parts = RESTfulRoute::routeParts(route);
+        auto captures = std::count_if(parts.begin(), parts.end(), [](const auto &part) { return part.first; });
+        if (captures != sizeof...(Captures))
+            throw Response{400, "Invalid route, the captures don't match their types"};
+        return TypedRoute<Captures...>{addRoute(std::move(parts), {&Captures::match...})};
     }
 
     /*!
      * \brief createHandle parse the given \a url and \a method and if they match
      * with a route, it creates and returns a handler. Otherwise it returns {}
+     * The url segments are walked in place, the lookup itself doesn't allocate.
      */
     ReturnType createHandler(std::string_view url, const std::string &method, Args ...args) const
     {
         auto qpos = url.find('?');
-        auto resources = split(url.substr(0, qpos), '/');
-        if (resources.size() < m_baseUrl.size() + 1)
-            return {};
-        for (size_t i = 0; i < m_baseUrl.size(); ++i)
-            if (resources[i] != m_baseUrl[i])
+        auto path = url.substr(0, qpos);
+        for (const auto &part : m_baseUrl)
+            if (nextSegment(path, '/') != part)
                 return {};
-        resources.erase(resources.begin(), resources.begin() + m_baseUrl.size());
-        for (const auto &route : m_routes) {
-            if (auto handle = route->createHandler(resources, method)) {
-                ParsedRoute parsedRoute;
-                parsedRoute.allButOPTIONSNodeMethods = route->m_allMethods;
-                parsedRoute.capturedResources = std::move(handle->first);
-                if (qpos != std::string::npos) {
-                    auto &queryStrings = parsedRoute.queryStrings;
-                    for (const auto &kvPair : split(url.substr(qpos + 1), '&')) {
-                        auto kv = split(kvPair, '=');
-                        switch (kv.size()) {
-                        case 1:
-                            queryStrings.emplace_back(std::make_pair(unescapeUrl(kv[0]), ""));
-                            break;
-                        case 2:
-                            queryStrings.emplace_back(std::make_pair(unescapeUrl(kv[0]),
-                                                      unescapeUrl(kv[1])));
-                            break;
-                        default:
-                            throw Response{400, "Invalid query strings"};
-                        }
-                    }
-                }
-                return handle->second(parsedRoute, args...);
-            }
-        }
-        return {};
+        if (path.find_first_not_of('/') == std::string_view::npos)
+            return {};
+        CapturedValues captures;
+        auto route = m_tree.find(path, captures);
+        if (!route)
+            return {};
+        const auto &handler = route->methodHandler(method);
+        return handler({captures, qpos == std::string::npos ? std::string_view{} : url.substr(qpos + 1)}, args...);
+    }
+
+protected:
+    RESTfulRoutePtr addRoute(typename RESTfulRoute::RouteParts parts, std::vector<CaptureMatcher> matchers)
+    {
+        for (auto rt : m_routes)
+            if (rt->sameRoute(parts, matchers))
+                return rt;
+        auto res = m_routes.emplace_back(RESTfulRoutePtr{new RESTfulRoute{std::move(parts), std::move(matchers)}});
+        m_tree.insert(res->m_routeParts, res->m_matchers, res);
+        return res;
     }
 
 protected:
     std::vector<std::string> m_baseUrl;
     std::vector<RESTfulRoutePtr> m_routes;
+    RouteTree<RESTfulRoute> m_tree;
 };
 
 using RESTfulRouterType = RestfulRouter<HttpSession>;
 
+/*!
+ * \brief sessionHandler
+ * Makes a route method handler which creates \a function sessions.
+ * It works for both the routes and the typed routes, \a function gets
+ * their parsed route followed by the stream and the request.
+ */
 template <typename T>
-RESTfulRouteMethodHandler<HttpSession> sessionHandler(T && function)
+auto sessionHandler(T && function)
 {
-    return [function = std::move(function)](ParsedRoute &&route) -> HttpSession {
-        return std::bind<void>(function, std::move(route), std::placeholders::_1, std::placeholders::_2);
+    return [function = std::move(function)](auto &&route) -> HttpSession {
+        using Route = std::decay_t<decltype(route)>;
+        static_assert(std::is_invocable_v<const std::decay_t<T> &, Route &&, AbstractStream &, Request &>,
+                      "the session function doesn't take this route");
+        // the session is called only once, the route is moved into the function
+        return [function, route = std::move(route)](AbstractStream &stream, Request &req) mutable {
+            function(std::move(route), stream, req);
+        };
     };
 }
 
+static_assert(sizeof(ParsedRoute) + sizeof(void (*)(ParsedRoute, AbstractStream &, Request &)) <= HttpSessionInlineSize,
+              "the sessionHandler sessions must be stored inline");
+
 } // namespace dracon
@@ -0,0 +1,347 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    AGPL EXCEPTION:
+    The AGPL license applies only to this file itself.
+
+    As a special exception, the copyright holders of this file give you permission
+    to use it, regardless of the license terms of your work, and to copy and distribute
+    them under terms of your choice.
+    If you do any changes to this file, these changes must be published under AGPL.
+
+*/
+
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <dracon/http.h>
+#include <dracon/stream.h>
+#include <dracon/utils.h>
+
+namespace Dracon {
+
+/// An encoded event, shared by all the subscribers
+using SharedBuffer = std::shared_ptr<const std::string>;
+
+/*!
+ * \brief encodeSseEvent
+ *
+ * Encodes an event using the Server-Sent Events wire format.
+ * Every line of \a data becomes a "data:" field, \a event and \a id are optional.
+ */
+inline SharedBuffer encodeSseEvent(std::string_view data, std::string_view event = {}, std::string_view id = {})
+{
+    std::string res;
+    res.reserve(data.size() + event.size() + id.size() + 32);
+    if (!id.empty())
+        res.append("id: ").append(id).append("\n");
+    if (!event.empty())
+        res.append("event: ").append(event).append("\n");
+    size_t pos = 0;
+    do {
+        auto next = data.find('\n', pos);
+        if (next == std::string_view::npos)
+            next = data.size();
+        auto line = data.substr(pos, next - pos);
+        if (!line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        res.append("data: ").append(line).append("\n");
+        pos = next + 1;
+    } while (pos < data.size());
+    res.append("\n");
+    return std::make_shared<const std::string>(std::move(res));
+}
+
+/*!
+ * \brief The SseBroadcaster class
+ *
+ * Fans out Server-Sent Events from one producer to many subscribers.
+ * Every event is encoded once and the same buffer is queued to all subscribers.
+ * The subscribers are grouped by their event loop and each group is woken up
+ * with a single notification.
+ *
+ * The broadcaster must outlive all its subscribers.
+ *
+ * {code}
+ * stream >> req;
+ * auto subscriber = s_broadcaster.subscribe(stream);
+ * stream << Dracon::SseBroadcaster::response();
+ * Dracon::ChunkedStream chunkedStream{stream};
+ * subscriber->serve(chunkedStream);
+ * {/code}
+ */
+class SseBroadcaster
+{
+public:
+    /// What to do when a subscriber's queue is full
+    enum class OverflowPolicy {
+        DropOldest, ///< discards the oldest queued event
+        DropNewest, ///< discards the new event
+        Disconnect  ///< closes the subscriber's connection
+    };
+
+    class Subscriber
+    {
+    public:
+        ~Subscriber()
+        {
+            m_broadcaster.unsubscribe(this);
+        }
+
+        /*!
+         * \brief serve
+         *
+         * Writes the queued events to \a stream until the broadcaster is closed
+         * or the subscriber is disconnected.
+         * Usually \a stream is a ChunkedStream. The session timeout is set to \a timeout,
+         * by default the session never expires.
+         */
+        void serve(AbstractStream &stream, std::chrono::seconds timeout = std::chrono::seconds{0})
+        {
+            stream.setSessionTimeout(timeout);
+            std::vector<SharedBuffer> pending;
+            std::vector<ConstBuffer> buffers;
+            for (;;) {
+                {
+                    std::unique_lock<SpinLock> lock{m_lock};
+                    if (m_queue.empty()) {
+                        if (m_closed)
+                            break;
+                        m_waiting = true;
+                    } else {
+                        pending.assign(std::make_move_iterator(m_queue.begin()),
+                                       std::make_move_iterator(m_queue.end()));
+                        m_queue.clear();
+                    }
+                }
+                if (pending.empty()) {
+                    if (auto ec = stream.yield())
+                        throw ec;
+                    continue;
+                }
+                buffers.clear();
+                for (const auto &buffer : pending)
+                    buffers.emplace_back(*buffer);
+                stream.write(buffers);
+                pending.clear();
+            }
+            if (m_overflowed)
+                stream.setKeepAlive(std::chrono::seconds{0});
+        }
+
+        /// The number of events that were dropped because the queue was full
+        size_t dropped() const
+        {
+            std::unique_lock<SpinLock> lock{m_lock};
+            return m_dropped;
+        }
+
+    private:
+        friend class SseBroadcaster;
+        Subscriber(SseBroadcaster &broadcaster, std::shared_ptr<AbstractStream::AbstractWakeupper> wakeupper)
+            : m_broadcaster(broadcaster)
+            , m_wakeupper(std::move(wakeupper))
+        {}
+
+        /// \return true if the subscriber must be woken up
+        bool push(const SharedBuffer &buffer)
+        {
+            std::unique_lock<SpinLock> lock{m_lock};
+            if (m_closed)
+                return false;
+            if (m_queue.size() >= m_broadcaster.m_queueSize) {
+                ++m_dropped;
+                switch (m_broadcaster.m_policy) {
+                case OverflowPolicy::DropOldest:
+                    m_queue.pop_front();
+                    break;
+                case OverflowPolicy::DropNewest:
+                    return false;
+                case OverflowPolicy::Disconnect:
+                    m_queue.clear();
+                    m_closed = true;
+                    m_overflowed = true;
+                    return wake();
+                }
+            }
+            m_queue.push_back(buffer);
+            return wake();
+        }
+
+        bool close()
+        {
+            std::unique_lock<SpinLock> lock{m_lock};
+            m_closed = true;
+            return wake();
+        }
+
+        inline bool wake()
+        {
+            // Only the first event after the subscriber went to sleep wakes it up
+            bool res = m_waiting;
+            m_waiting = false;
+            return res;
+        }
+
+    private:
+        SseBroadcaster &m_broadcaster;
+        std::shared_ptr<AbstractStream::AbstractWakeupper> m_wakeupper;
+        mutable SpinLock m_lock;
+        std::deque<SharedBuffer> m_queue;
+        size_t m_dropped = 0;
+        bool m_waiting = false;
+        bool m_closed = false;
+        bool m_overflowed = false;
+    };
+
+public:
+    /*!
+     * \brief SseBroadcaster
+     *
+     * \param queueSize the maximum number of events queued for every subscriber
+     * \param policy what to do with slow subscribers
+     */
+    explicit SseBroadcaster(size_t queueSize = 64, OverflowPolicy policy = OverflowPolicy::DropOldest)
+        : m_queueSize(std::max<size_t>(1, queueSize))
+        , m_policy(policy)
+    {}
+
+    /*!
+     * \brief response
+     * \return the response headers needed to start an event stream
+     */
+    static Response response()
+    {
+        return Response{200, {}, {{"Content-Type", "text/event-stream"},
+                                  {"Cache-Control", "no-cache"}}}.setContentLength(ChunkedData);
+    }
+
+    /*!
+     * \brief subscribe
+     *
+     * Creates a new subscriber for the session which owns \a stream.
+     * The subscriber unsubscribes itself when it's destroyed.
+     */
+    std::unique_ptr<Subscriber> subscribe(AbstractStream &stream)
+    {
+        std::unique_ptr<Subscriber> subscriber{new Subscriber{*this, stream.wakeupper()}};
+        std::unique_lock<std::mutex> lock{m_mutex};
+        if (m_closed)
+            subscriber->m_closed = true;
+        else
+            m_groups[subscriber->m_wakeupper->eventLoop()].insert(subscriber.get());
+        return subscriber;
+    }
+
+    /*!
+     * \brief broadcast
+     *
+     * Encodes the event once and queues it to all subscribers.
+     *
+     * \return the number of subscribers
+     */
+    size_t broadcast(std::string_view data, std::string_view event = {}, std::string_view id = {})
+    {
+        return broadcast(encodeSseEvent(data, event, id));
+    }
+
+    /*!
+     * \brief broadcast
+     *
+     * Queues the already encoded \a event to all subscribers.
+     *
+     * \return the number of subscribers
+     */
+    size_t broadcast(const SharedBuffer &event)
+    {
+        return forEachGroup([&event](Subscriber *subscriber) {
+            return subscriber->push(event);
+        });
+    }
+
+    /*!
+     * \brief close
+     *
+     * Ends the event streams of all the subscribers.
+     * New subscribers are closed right away.
+     */
+    void close()
+    {
+        forEachGroup([](Subscriber *subscriber) {
+            return subscriber->close();
+        }, true);
+    }
+
+    /// \return the number of subscribers
+    size_t subscribers() const
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        size_t res = 0;
+        for (const auto &group : m_groups)
+            res += group.second.size();
+        return res;
+    }
+
+private:
+    void unsubscribe(Subscriber *subscriber)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        auto it = m_groups.find(subscriber->m_wakeupper->eventLoop());
+        if (it == m_groups.end())
+            return;
+        it->second.erase(subscriber);
+        if (it->second.empty())
+            m_groups.erase(it);
+    }
+
+    template <typename F>
+    size_t forEachGroup(F function, bool close = false)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        if (close)
+            m_closed = true;
+        size_t res = 0;
+        for (const auto &group : m_groups) {
+            m_wakeuppers.clear();
+            for (auto subscriber : group.second) {
+                if (function(subscriber))
+                    m_wakeuppers.push_back(subscriber->m_wakeupper.get());
+            }
+            res += group.second.size();
+            if (!m_wakeuppers.empty())
+                m_wakeuppers.front()->wakeupAll(m_wakeuppers);
+        }
+        return res;
+    }
+
+private:
+    const size_t m_queueSize;
+    const OverflowPolicy m_policy;
+    mutable std::mutex m_mutex;
+    bool m_closed = false;
+    std::unordered_map<const void *, std::unordered_set<Subscriber *>> m_groups;
+    std::vector<AbstractStream::AbstractWakeupper *> m_wakeuppers;
+};
+
+} // namespace Dracon
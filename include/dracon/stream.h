@@ -27,11 +27,15 @@
 #pragma once
 
 #include <chrono>
+#include <limits>
 #include <memory>
+#include <optional>
 #include <sstream>
 #include <vector>
 #include <system_error>
 
+#include <sys/types.h>
+
 #include <dracon/utils.h>
 
 namespace Dracon {
@@ -63,6 +67,26 @@ struct ConstBuffer
     size_t length = 0;
 };
 
+/*!
+ * \brief The RelayDirection enum
+ * The direction in which AbstractStream::relay moves the bytes
+ */
+enum class RelayDirection {
+    ToStream,   ///< from the descriptor to the stream's peer
+    FromStream  ///< from the stream's peer to the descriptor
+};
+
+/*!
+ * \brief The PeerCredentials struct
+ * The credentials of a local (unix domain socket) peer
+ */
+struct PeerCredentials
+{
+    pid_t pid = 0;
+    uid_t uid = uid_t(-1);
+    gid_t gid = gid_t(-1);
+};
+
 class Request;
 class AbstractStream
 {
@@ -71,6 +95,24 @@ public:
     {
         virtual ~AbstractWakeupper() = default;
         virtual void wakeup() noexcept = 0;
+
+        /*!
+         * \brief eventLoop
+         * \return an opaque key of the event loop that serves the session.
+         * Wakeuppers which share the same key can be woken up together by \l wakeupAll.
+         */
+        virtual const void *eventLoop() const noexcept { return nullptr; }
+
+        /*!
+         * \brief wakeupAll
+         * Wakes up all \a wakeuppers at once. The wakeuppers should share
+         * the same \l eventLoop as this object, the others are woken up one by one.
+         */
+        virtual void wakeupAll(const std::vector<AbstractWakeupper *> &wakeuppers) noexcept
+        {
+            for (auto wakeupper : wakeuppers)
+                wakeupper->wakeup();
+        }
     };
 
 public:
@@ -108,6 +150,38 @@ public:
      */
     virtual std::shared_ptr<AbstractWakeupper> wakeupper() const noexcept = 0;
 
+    /*!
+     * \brief watchDescriptor
+     * Adds \a fd to the session's event loop. Any of the epoll \a events
+     * (e.g. EPOLLIN, EPOLLOUT) on \a fd wakes up the yielded session.
+     * Use it to wait for other sockets (e.g. upstream connections) without blocking the loop.
+     * The descriptor must be unwatched before it's closed.
+     */
+    virtual void watchDescriptor(int fd, uint32_t events) = 0;
+
+    /*!
+     * \brief unwatchDescriptor
+     * Removes \a fd from the session's event loop.
+     */
+    virtual void unwatchDescriptor(int fd) noexcept = 0;
+
+    /*!
+     * \brief relay
+     * Moves \a length bytes in the given \a direction between the stream's peer
+     * and the \a fd socket, it stops earlier if the source reaches its end.
+     * On plaintext connections the bytes are spliced through a pipe and never enter
+     * userspace, secured connections fall back to a buffered copy.
+     * \a fd must be non-blocking and watched (see \l watchDescriptor),
+     * the session yields while either side would block.
+     * The streams which transform the data (e.g. ChunkedStream) don't support it.
+     * \return the number of bytes moved
+     */
+    virtual size_t relay(int fd, RelayDirection direction, size_t length = std::numeric_limits<size_t>::max())
+    {
+        (void)fd; (void)direction; (void)length;
+        throw std::make_error_code(std::errc::operation_not_supported);
+    }
+
     /*!
      * \brief keepAlive
      * \return the number of seconds to keep the connection alive.
@@ -131,6 +205,13 @@ public:
      */
     virtual const std::string& peerAddress() const noexcept = 0;
 
+    /*!
+     * \brief peerCredentials
+     * \return the peer process credentials for the unix domain socket connections,
+     * nothing for the other connections.
+     */
+    virtual std::optional<PeerCredentials> peerCredentials() const noexcept { return {}; }
+
     /*!
      * \brief isSecuredConnection
      * \return true if this is a SSL connection
@@ -203,6 +284,16 @@ public:
         return m_nextLayer.wakeupper();
     }
 
+    void watchDescriptor(int fd, uint32_t events) override
+    {
+        m_nextLayer.watchDescriptor(fd, events);
+    }
+
+    void unwatchDescriptor(int fd) noexcept override
+    {
+        m_nextLayer.unwatchDescriptor(fd);
+    }
+
     void setKeepAlive(std::chrono::seconds seconds) noexcept override
     {
         m_nextLayer.setKeepAlive(seconds);
@@ -218,6 +309,11 @@ public:
         return m_nextLayer.peerAddress();
     }
 
+    std::optional<PeerCredentials> peerCredentials() const noexcept override
+    {
+        return m_nextLayer.peerCredentials();
+    }
+
     bool isSecuredConnection() const noexcept override
     {
         return m_nextLayer.isSecuredConnection();
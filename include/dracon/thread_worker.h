@@ -26,49 +26,79 @@
 
 #pragma once
 
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
-#include <stack>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#include <dracon/http.h>
+#include <dracon/stream.h>
+#include <dracon/unique_function.h>
+
 namespace Dracon {
 
 /*!
  * \brief The ThreadWorker class
  *
- * Helper class to sync run tasks on worker thread(s)
+ * Helper class to run tasks on worker thread(s).
+ *
+ * Every worker has its own FIFO queues, one for each priority, the idle workers steal
+ * the oldest tasks from the others, so the tasks inserted from many threads don't contend on a single lock.
+ * The tasks inserted from a worker thread go to that worker queue, the others are spread round-robin.
+ * The higher priority tasks are run first.
+ *
+ * If \a capacity is set, the number of pending tasks is bounded: tryInsertTask rejects
+ * the new tasks and insertTask waits until there is room for them.
  */
 class ThreadWorker
 {
+public:
+    /// The tasks which fit in 64 bytes are not allocated
+    using Task = UniqueFunction<void(), 64>;
+    using ExceptionHandler = std::function<void(std::exception_ptr)>;
+    enum class Priority : uint8_t {
+        High,
+        Normal,
+        Low
+    };
+
 public:
     /*!
      * \brief ThreadWorker
      *
      * \param workers the number of threads that will be used to run the tasks
+     * \param capacity the maximum number of pending tasks, 0 means unbounded
+     * \param exceptionHandler called with the exceptions thrown by the tasks, by default they are ignored
      */
-    ThreadWorker(uint32_t workers = 1)
+    ThreadWorker(uint32_t workers = 1, size_t capacity = 0, ExceptionHandler exceptionHandler = {})
+        : m_queuesSize(std::max(uint32_t(1), workers))
+        , m_queues(std::make_unique<Queue[]>(m_queuesSize))
+        , m_capacity(capacity)
+        , m_exceptionHandler(std::move(exceptionHandler))
     {
-        workers = std::max(uint32_t(1), workers);
-        m_quit.store(false);
-        m_workers.reserve(workers);
-        for (uint32_t i = 0; i < workers; ++i)
-            m_workers.emplace_back([this]{
-                while (!m_quit) {
-                    try {
-                        if (auto task = nextTask())
-                            task();
-                    } catch (...) {}
-                }
-            });
+        m_workers.reserve(m_queuesSize);
+        for (uint32_t i = 0; i < m_queuesSize; ++i)
+            m_workers.emplace_back([this, i]{ work(i); });
     }
 
     ~ThreadWorker()
     {
         try {
-            m_quit.store(true);
+            {
+                std::unique_lock<std::mutex> lock(m_idleLock);
+                m_quit.store(true);
+            }
             m_waitCondition.notify_all();
+            m_roomCondition.notify_all();
             for (auto & m_worker : m_workers) {
                 if (m_worker.joinable())
                     m_worker.join();
@@ -79,42 +109,256 @@ public:
     /*!
      * \brief insertTask
      *
-     * Enqueue a new task. The task will be run on one of the worker threads
+     * Enqueue a new task. The task will be run on one of the worker threads.
+     * If the queue is full it waits until there is room for it.
      *
      * \param task to execute
+     * \param priority the task priority
+     *
+     * \return false if the worker is shutting down
      */
-    void insertTask(const std::function<void()> &task)
+    bool insertTask(Task task, Priority priority = Priority::Normal)
     {
-        std::unique_lock<std::mutex> lock(m_lock);
-        m_pendingTasks.push(task);
-        m_waitCondition.notify_one();
+        while (!reserve()) {
+            std::unique_lock<std::mutex> lock(m_idleLock);
+            ++m_waitingProducers;
+            m_roomCondition.wait(lock, [this]{ return m_quit || m_pendingTasks < m_capacity; });
+            --m_waitingProducers;
+            if (m_quit)
+                return false;
+        }
+        push(std::move(task), priority);
+        return true;
     }
 
-private:
     /*!
-     * \brief nextTask
+     * \brief tryInsertTask
+     *
+     * Enqueue a new task, if there is room for it.
      *
-     * Waits until a new task is available and then returns it to any available worker thread
+     * \param task to execute
+     * \param priority the task priority
      *
-     * \return the next task to run
+     * \return false if the task was rejected
      */
-    inline std::function<void()> nextTask()
+    bool tryInsertTask(Task task, Priority priority = Priority::Normal)
+    {
+        if (!reserve())
+            return false;
+        push(std::move(task), priority);
+        return true;
+    }
+
+    /// The number of tasks waiting to be run
+    size_t pendingTasks() const { return m_pendingTasks; }
+
+private:
+    static constexpr size_t PrioritiesSize = 3;
+    struct alignas(64) Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks[PrioritiesSize];
+    };
+
+    bool reserve()
     {
-        std::unique_lock<std::mutex> lock(m_lock);
-        m_waitCondition.wait(lock, [this]{return m_quit || !m_pendingTasks.empty();});
         if (m_quit)
-            return {};
-        auto ret = m_pendingTasks.top();
-        m_pendingTasks.pop();
-        return ret;
+            return false;
+        auto pending = m_pendingTasks.load();
+        do {
+            if (m_capacity && pending >= m_capacity)
+                return false;
+        } while (!m_pendingTasks.compare_exchange_weak(pending, pending + 1));
+        return true;
+    }
+
+    void push(Task task, Priority priority)
+    {
+        // the tasks inserted by our workers stay on their queues
+        uint32_t index = s_currentWorker == this ? s_currentQueue : m_nextQueue++ % m_queuesSize;
+        {
+            auto &queue = m_queues[index];
+            std::unique_lock<std::mutex> lock(queue.lock);
+            queue.tasks[size_t(priority)].push_back(std::move(task));
+        }
+        // m_pendingTasks was increased before, an idle worker either sees it or gets notified
+        if (m_idleWorkers) {
+            std::unique_lock<std::mutex> lock(m_idleLock);
+            m_waitCondition.notify_one();
+        }
+    }
+
+    bool pop(uint32_t index, size_t priority, Task &task)
+    {
+        auto &queue = m_queues[index];
+        std::unique_lock<std::mutex> lock(queue.lock);
+        auto &tasks = queue.tasks[priority];
+        if (tasks.empty())
+            return false;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+        return true;
+    }
+
+    /*!
+     * \brief nextTask
+     *
+     * \return the oldest task with the highest priority, from our queue or stolen from the other workers
+     */
+    Task nextTask(uint32_t index)
+    {
+        Task task;
+        for (size_t priority = 0; priority < PrioritiesSize; ++priority)
+            for (uint32_t i = 0; i < m_queuesSize; ++i)
+                if (pop((index + i) % m_queuesSize, priority, task))
+                    return task;
+        return task;
+    }
+
+    void work(uint32_t index)
+    {
+        s_currentWorker = this;
+        s_currentQueue = index;
+        while (!m_quit) {
+            if (auto task = nextTask(index)) {
+                --m_pendingTasks;
+                if (m_waitingProducers) {
+                    std::unique_lock<std::mutex> lock(m_idleLock);
+                    m_roomCondition.notify_one();
+                }
+                try {
+                    task();
+                } catch (...) {
+                    if (m_exceptionHandler) {
+                        try {
+                            m_exceptionHandler(std::current_exception());
+                        } catch (...) {}
+                    }
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_idleLock);
+            ++m_idleWorkers;
+            m_waitCondition.wait(lock, [this]{ return m_quit || m_pendingTasks; });
+            --m_idleWorkers;
+        }
     }
 
 private:
+    static inline thread_local const ThreadWorker *s_currentWorker = nullptr;
+    static inline thread_local uint32_t s_currentQueue = 0;
     std::atomic_bool m_quit{false};
-    std::stack<std::function<void()>> m_pendingTasks;
-    std::mutex m_lock;
+    const uint32_t m_queuesSize;
+    std::unique_ptr<Queue[]> m_queues;
+    const size_t m_capacity;
+    std::atomic<size_t> m_pendingTasks{0};
+    std::atomic<uint32_t> m_nextQueue{0};
+    std::atomic<uint32_t> m_idleWorkers{0};
+    std::atomic<uint32_t> m_waitingProducers{0};
+    std::mutex m_idleLock;
     std::condition_variable m_waitCondition;
+    std::condition_variable m_roomCondition;
+    ExceptionHandler m_exceptionHandler;
     std::vector<std::thread> m_workers;
 };
 
+namespace Internal {
+template <typename T>
+struct IsReferenceWrapper : std::false_type {};
+template <typename T>
+struct IsReferenceWrapper<std::reference_wrapper<T>> : std::true_type {};
+
+template <typename R>
+struct OffloadState
+{
+    std::shared_ptr<AbstractStream::AbstractWakeupper> wakeupper;
+    std::atomic_bool done{false};
+    std::exception_ptr error;
+    std::optional<R> result;
+};
+template <>
+struct OffloadState<void>
+{
+    std::shared_ptr<AbstractStream::AbstractWakeupper> wakeupper;
+    std::atomic_bool done{false};
+    std::exception_ptr error;
+};
+
+// Completes the state once, if the task is dropped without running the session gets an error
+template <typename R>
+class OffloadCompletion
+{
+public:
+    explicit OffloadCompletion(std::shared_ptr<OffloadState<R>> state)
+        : m_state(std::move(state))
+    {}
+    OffloadCompletion(OffloadCompletion &&) noexcept = default;
+    ~OffloadCompletion()
+    {
+        if (m_state)
+            complete(std::make_exception_ptr(std::runtime_error{"The offloaded task was dropped"}));
+    }
+
+    OffloadState<R> &state() { return *m_state; }
+    void complete(std::exception_ptr error = {}) noexcept
+    {
+        auto state = std::move(m_state);
+        state->error = std::move(error);
+        state->done.store(true, std::memory_order_release);
+        state->wakeupper->wakeup();
+    }
+
+private:
+    std::shared_ptr<OffloadState<R>> m_state;
+};
+} // namespace Internal
+
+/*!
+ * \brief offload
+ *
+ * Runs \a function on one of the \a worker threads. The session yields until the function
+ * finishes and is resumed exactly once, the spurious wakeups are ignored.
+ * If the worker queue is full the session gets a 503 response.
+ *
+ * \a function may outlive the session: if yield() fails (e.g. the session is canceled or
+ * times out) offload throws while the task is still queued or running. \a function must
+ * capture by value or by owning pointers (e.g. std::shared_ptr), never the session locals by reference.
+ *
+ * \return the \a function result, the exceptions thrown by \a function are rethrown here
+ */
+template <typename Function, typename R = std::invoke_result_t<std::decay_t<Function>&>>
+R offload(AbstractStream &stream, ThreadWorker &worker, Function &&function,
+          ThreadWorker::Priority priority = ThreadWorker::Priority::Normal)
+{
+    // the by reference lambda captures can't be detected, but the explicit references are rejected
+    static_assert(!Internal::IsReferenceWrapper<std::decay_t<Function>>::value,
+                  "the offloaded function may outlive the session, it must own what it uses");
+    auto state = std::make_shared<Internal::OffloadState<R>>();
+    state->wakeupper = stream.wakeupper();
+    auto task = [completion = Internal::OffloadCompletion<R>{state},
+                 function = std::forward<Function>(function)]() mutable {
+        try {
+            if constexpr (std::is_void_v<R>)
+                function();
+            else
+                completion.state().result.emplace(function());
+        } catch (...) {
+            completion.complete(std::current_exception());
+            return;
+        }
+        completion.complete();
+    };
+    if (!worker.tryInsertTask(std::move(task), priority))
+        throw Response{503};
+
+    while (!state->done.load(std::memory_order_acquire)) {
+        if (auto ec = stream.yield())
+            throw ec;
+    }
+    if (state->error)
+        std::rethrow_exception(state->error);
+    if constexpr (!std::is_void_v<R>)
+        return std::move(*state->result);
+}
+
 } // namespace dracon
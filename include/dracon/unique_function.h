@@ -0,0 +1,185 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+    AGPL EXCEPTION:
+    The AGPL license applies only to this file itself.
+
+    As a special exception, the copyright holders of this file give you permission
+    to use it, regardless of the license terms of your work, and to copy and distribute
+    them under terms of your choice.
+    If you do any changes to this file, these changes must be published under AGPL.
+
+*/
+
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Dracon {
+
+template <typename Signature, size_t InlineSize = 64>
+class UniqueFunction;
+
+/*!
+ * \brief The UniqueFunction class
+ *
+ * A move-only std::function. The callables which fit in \a InlineSize bytes
+ * (and can be moved without throwing) are stored inline, so creating and moving it allocates nothing,
+ * the bigger ones are allocated on the heap.
+ * Null function pointers and empty std::functions make an empty object, like std::function does.
+ */
+template <typename R, typename ...Args, size_t InlineSize>
+class UniqueFunction<R(Args...), InlineSize>
+{
+    template <typename T>
+    static constexpr bool fitsInline = sizeof(T) <= InlineSize && alignof(T) <= alignof(std::max_align_t) &&
+            std::is_nothrow_move_constructible_v<T>;
+
+    template <typename T>
+    struct IsStdFunction : std::false_type {};
+    template <typename T>
+    struct IsStdFunction<std::function<T>> : std::true_type {};
+
+public:
+    UniqueFunction() noexcept = default;
+    UniqueFunction(std::nullptr_t) noexcept {}
+
+    template <typename F, typename T = std::decay_t<F>,
+              typename = std::enable_if_t<!std::is_same_v<T, UniqueFunction> && std::is_invocable_r_v<R, T&, Args...>>>
+    UniqueFunction(F &&function)
+    {
+        if constexpr (std::is_pointer_v<T> || std::is_member_pointer_v<T> || IsStdFunction<T>::value) {
+            if (!function)
+                return;
+        }
+        if constexpr (fitsInline<T>) {
+            new (m_storage) T(std::forward<F>(function));
+            m_ops = &InlineOps<T>::ops;
+        } else {
+            *reinterpret_cast<T **>(m_storage) = new T(std::forward<F>(function));
+            m_ops = &HeapOps<T>::ops;
+        }
+    }
+
+    UniqueFunction(UniqueFunction &&other) noexcept
+    {
+        if (other.m_ops) {
+            other.m_ops->move(m_storage, other.m_storage);
+            m_ops = other.m_ops;
+            other.m_ops = nullptr;
+        }
+    }
+
+    UniqueFunction &operator=(UniqueFunction &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            if (other.m_ops) {
+                other.m_ops->move(m_storage, other.m_storage);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+
+    UniqueFunction &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    UniqueFunction(const UniqueFunction &) = delete;
+    UniqueFunction &operator=(const UniqueFunction &) = delete;
+
+    ~UniqueFunction()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept { return m_ops; }
+
+    R operator()(Args ...args) const
+    {
+        if (!m_ops)
+            throw std::bad_function_call{};
+        return m_ops->invoke(m_storage, std::forward<Args>(args)...);
+    }
+
+private:
+    struct Ops
+    {
+        R (*invoke)(void *storage, Args &&...args);
+        void (*move)(void *to, void *from) noexcept;
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template <typename T>
+    struct InlineOps
+    {
+        static R invoke(void *storage, Args &&...args)
+        {
+            return std::invoke(*static_cast<T *>(storage), std::forward<Args>(args)...);
+        }
+        static void move(void *to, void *from) noexcept
+        {
+            new (to) T(std::move(*static_cast<T *>(from)));
+            static_cast<T *>(from)->~T();
+        }
+        static void destroy(void *storage) noexcept
+        {
+            static_cast<T *>(storage)->~T();
+        }
+        static constexpr Ops ops{&invoke, &move, &destroy};
+    };
+
+    template <typename T>
+    struct HeapOps
+    {
+        static R invoke(void *storage, Args &&...args)
+        {
+            return std::invoke(**static_cast<T **>(storage), std::forward<Args>(args)...);
+        }
+        static void move(void *to, void *from) noexcept
+        {
+            *static_cast<T **>(to) = *static_cast<T **>(from);
+        }
+        static void destroy(void *storage) noexcept
+        {
+            delete *static_cast<T **>(storage);
+        }
+        static constexpr Ops ops{&invoke, &move, &destroy};
+    };
+
+    void reset() noexcept
+    {
+        if (m_ops) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+    alignas(std::max_align_t) mutable unsigned char m_storage[std::max(InlineSize, sizeof(void *))];
+    const Ops *m_ops = nullptr;
+};
+
+} // namespace Dracon
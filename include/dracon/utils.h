@@ -33,7 +33,10 @@
 #include <atomic>
 #include <condition_variable>
 #include <cstring>
+#include <functional>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <stdexcept>
 #include <string>
 #include <string_view>
@@ -154,6 +157,27 @@ inline SplitVector split(std::string_view str, char ch, std::string::size_type c
     return ret;
 }
 
+/*!
+ * \brief nextSegment
+ *
+ * Walks the \a ch separated segments of \a str in place, like split without the vector.
+ * The empty segments are skipped, \a str is advanced past the returned segment.
+ *
+ * \return the next segment or an empty view when there are no more segments
+ */
+inline std::string_view nextSegment(std::string_view &str, char ch)
+{
+    auto pos = str.find_first_not_of(ch);
+    if (pos == std::string_view::npos) {
+        str = {};
+        return {};
+    }
+    auto end = str.find(ch, pos);
+    auto segment = str.substr(pos, end == std::string_view::npos ? std::string_view::npos : end - pos);
+    str.remove_prefix(end == std::string_view::npos ? str.size() : end + 1);
+    return segment;
+}
+
 template <typename K, typename V>
 class LruCache
 {
@@ -257,6 +281,232 @@ private:
     size_t m_cacheSize;
 };
 
+/*!
+ * \brief The ShardedCache class
+ *
+ * Concurrent cache limited by the total cost (e.g. bytes) of its values.
+ * The keys are spread over independently locked shards, so the threads
+ * rarely contend and no lock is held for more than a hash lookup.
+ * Every shard evicts its LRU values, but a new value is admitted only if it's
+ * accessed more often than the values it would evict (TinyLFU), the access
+ * frequencies are estimated by a small count-min sketch which ages periodically.
+ * Therefore a big value that's used once doesn't evict many hot small ones.
+ */
+template <typename K, typename V, typename Hash = std::hash<K>>
+class ShardedCache
+{
+public:
+    /*!
+     * \param budget the max total cost of the cached values
+     * \param shards how many shards to use, it's rounded to a power of 2
+     */
+    explicit ShardedCache(size_t budget, size_t shards = 16)
+    {
+        size_t count = 1;
+        while (count < shards)
+            count <<= 1;
+        m_shardMask = count - 1;
+        m_shardBudget = budget / count;
+        m_shards.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+            m_shards.emplace_back(std::make_unique<Shard>());
+    }
+
+    /*!
+     * \brief value
+     * Records the access and returns the value for \a key or V{} if it's not cached.
+     */
+    V value(const K &key)
+    {
+        auto hash = mix(m_hash(key));
+        auto &shard = shardFor(hash);
+        std::unique_lock<std::mutex> lock{shard.mutex};
+        shard.sketch.increment(hash);
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+            return V{};
+        shard.items.splice(shard.items.begin(), shard.items, it->second);
+        return it->second->value;
+    }
+
+    /*!
+     * \brief put
+     * Caches \a value for \a key, if it's admitted.
+     * The values which cost more than \l maxCost are never cached.
+     * \return true if the value was cached
+     */
+    bool put(const K &key, const V &value, size_t cost)
+    {
+        auto hash = mix(m_hash(key));
+        auto &shard = shardFor(hash);
+        std::unique_lock<std::mutex> lock{shard.mutex};
+        auto it = shard.index.find(key);
+        if (it != shard.index.end())
+            remove(shard, it);
+        if (cost > m_shardBudget)
+            return false;
+
+        if (shard.cost + cost > m_shardBudget) {
+            // the candidate must be more popular than all the values it evicts
+            auto frequency = shard.sketch.frequency(hash);
+            size_t freed = 0;
+            for (auto victim = shard.items.rbegin(); shard.cost - freed + cost > m_shardBudget; ++victim) {
+                if (frequency <= shard.sketch.frequency(mix(m_hash(victim->key))))
+                    return false;
+                freed += victim->cost;
+            }
+            while (shard.cost + cost > m_shardBudget)
+                remove(shard, shard.index.find(shard.items.back().key));
+        }
+        shard.items.push_front({key, value, cost});
+        shard.index[key] = shard.items.begin();
+        shard.cost += cost;
+        m_cost += cost;
+        return true;
+    }
+
+    bool erase(const K &key)
+    {
+        auto &shard = shardFor(mix(m_hash(key)));
+        std::unique_lock<std::mutex> lock{shard.mutex};
+        auto it = shard.index.find(key);
+        if (it == shard.index.end())
+            return false;
+        remove(shard, it);
+        return true;
+    }
+
+    /*!
+     * \brief eraseIf
+     * Removes all the values for which \a pred(key, value) returns true
+     */
+    template <typename Pred>
+    void eraseIf(Pred pred)
+    {
+        for (auto &shard : m_shards) {
+            std::unique_lock<std::mutex> lock{shard->mutex};
+            for (auto it = shard->items.begin(); it != shard->items.end();) {
+                auto next = std::next(it);
+                if (pred(it->key, it->value))
+                    remove(*shard, shard->index.find(it->key));
+                it = next;
+            }
+        }
+    }
+
+    void clear()
+    {
+        eraseIf([](const K &, const V &) { return true; });
+    }
+
+    /// The total cost of the cached values
+    size_t cost() const noexcept { return m_cost; }
+
+    /// The max cost of a single value, the budget of one shard
+    size_t maxCost() const noexcept { return m_shardBudget; }
+
+    size_t size() const
+    {
+        size_t res = 0;
+        for (auto &shard : m_shards) {
+            std::unique_lock<std::mutex> lock{shard->mutex};
+            res += shard->index.size();
+        }
+        return res;
+    }
+
+private:
+    struct Item
+    {
+        K key;
+        V value;
+        size_t cost;
+    };
+    using Iterator = typename std::list<Item>::iterator;
+
+    // 4 rows of saturating counters, halved when the sample is full
+    class FrequencySketch
+    {
+    public:
+        static constexpr size_t Width = 1024;
+        static constexpr uint8_t MaxCount = 15;
+
+        void increment(size_t hash)
+        {
+            for (size_t row = 0; row < 4; ++row) {
+                auto &counter = m_table[row][index(hash, row)];
+                if (counter < MaxCount)
+                    ++counter;
+            }
+            if (++m_additions == Width * 10) {
+                m_additions /= 2;
+                for (auto &row : m_table)
+                    for (auto &counter : row)
+                        counter >>= 1;
+            }
+        }
+
+        uint8_t frequency(size_t hash) const
+        {
+            uint8_t res = MaxCount;
+            for (size_t row = 0; row < 4; ++row)
+                res = std::min(res, m_table[row][index(hash, row)]);
+            return res;
+        }
+
+    private:
+        static size_t index(size_t hash, size_t row)
+        {
+            static constexpr uint64_t seeds[] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                                 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+            return ((hash + seeds[row]) * seeds[row]) >> 32 & (Width - 1);
+        }
+
+    private:
+        uint8_t m_table[4][Width] = {};
+        size_t m_additions = 0;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Item> items;
+        std::unordered_map<K, Iterator, Hash> index;
+        FrequencySketch sketch;
+        size_t cost = 0;
+    };
+
+private:
+    static size_t mix(size_t hash)
+    {
+        // std::hash may be the identity, spread the bits
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    Shard &shardFor(size_t hash) const
+    {
+        return *m_shards[(hash >> 48) & m_shardMask];
+    }
+
+    void remove(Shard &shard, typename std::unordered_map<K, Iterator, Hash>::iterator it)
+    {
+        shard.cost -= it->second->cost;
+        m_cost -= it->second->cost;
+        shard.items.erase(it->second);
+        shard.index.erase(it);
+    }
+
+private:
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    size_t m_shardMask;
+    size_t m_shardBudget;
+    std::atomic<size_t> m_cost{0};
+    Hash m_hash;
+};
+
 /*!
  * \brief addrText
  *
@@ -0,0 +1,723 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <dracon/http.h>
+#include <dracon/logging.h>
+#include <dracon/plugin.h>
+#include <dracon/stream.h>
+#include <dracon/utils.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <filesystem>
+#include <optional>
+#include <unordered_map>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/property_tree/info_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <http_parser.h>
+
+namespace {
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+TaggedLogger<> logger{"proxy"};
+
+constexpr size_t ReadBufferSize = 16 * 1024;
+
+struct Upstream
+{
+    std::string name;
+    sockaddr_storage address;
+    socklen_t addressLength = 0;
+    std::atomic<uint32_t> outstanding{0};
+};
+
+struct Route
+{
+    std::string prefix;
+    std::optional<std::string> rewrite;
+    std::vector<std::unique_ptr<Upstream>> upstreams;
+    mutable std::atomic<uint32_t> next{0};
+
+    /*!
+     * \brief pickUpstream
+     * \return the upstream with the least outstanding requests,
+     * the ties are broken in a round robin fashion.
+     */
+    Upstream &pickUpstream() const
+    {
+        const size_t size = upstreams.size();
+        const size_t start = next++ % size;
+        Upstream *res = upstreams[start].get();
+        for (size_t i = 1; i < size && res->outstanding; ++i) {
+            auto upstream = upstreams[(start + i) % size].get();
+            if (upstream->outstanding < res->outstanding)
+                res = upstream;
+        }
+        return *res;
+    }
+};
+
+std::vector<std::unique_ptr<Route>> s_routes;
+size_t s_maxIdleConnections = 16;
+std::chrono::seconds s_idleTimeout{30};
+std::chrono::seconds s_timeout{60};
+size_t s_maxBodySize = std::numeric_limits<size_t>::max() - 1;
+
+inline bool isHopByHop(const std::string &field, const std::vector<std::string> &connectionFields = {})
+{
+    static const std::vector<std::string_view> hopByHop = {
+        "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer",
+        "Transfer-Encoding", "Upgrade", "Proxy-Authenticate", "Proxy-Authorization"
+    };
+    for (const auto &hop : hopByHop)
+        if (boost::iequals(field, hop))
+            return true;
+    for (const auto &hop : connectionFields)
+        if (boost::iequals(field, hop))
+            return true;
+    return false;
+}
+
+// The fields listed by the Connection header are hop-by-hop too
+inline std::vector<std::string> connectionFields(const Dracon::Fields &fields)
+{
+    std::vector<std::string> res;
+    for (const auto &kv : fields) {
+        if (!boost::iequals(kv.first, "Connection"))
+            continue;
+        for (auto field : Dracon::split(kv.second, ','))
+            res.emplace_back(boost::trim_copy(std::string{field}));
+    }
+    return res;
+}
+
+inline const std::string *findField(const Dracon::Fields &fields, std::string_view name)
+{
+    for (const auto &kv : fields)
+        if (boost::iequals(kv.first, name))
+            return &kv.second;
+    return nullptr;
+}
+
+struct IdleConnection
+{
+    int fd;
+    Clock::time_point since;
+};
+
+/*!
+ * \brief The IdleConnections struct
+ *
+ * Keep-alive upstream connections which are not in use.
+ * Every event loop runs on its own thread, therefore a thread local
+ * pool is a per loop pool and it doesn't need any locking.
+ */
+struct IdleConnections : std::unordered_map<const Upstream *, std::vector<IdleConnection>>
+{
+    ~IdleConnections()
+    {
+        for (const auto &upstream : *this)
+            for (const auto &connection : upstream.second)
+                ::close(connection.fd);
+    }
+};
+thread_local IdleConnections t_idleConnections;
+
+/*!
+ * \brief The UpstreamConnection class
+ *
+ * A connection to an upstream server driven by the session's coroutine.
+ * When it is released, a keep-alive connection goes back to the loop's pool.
+ */
+class UpstreamConnection
+{
+public:
+    UpstreamConnection(Dracon::AbstractStream &stream, Upstream &upstream)
+        : m_stream(stream)
+        , m_upstream(upstream)
+    {
+        ++m_upstream.outstanding;
+        try {
+            m_fd = idleConnection();
+            m_reused = m_fd != -1;
+            if (!m_reused)
+                connect();
+            else
+                m_stream.watchDescriptor(m_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        } catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    ~UpstreamConnection()
+    {
+        release();
+    }
+
+    inline int fd() const { return m_fd; }
+    inline bool reused() const { return m_reused; }
+    inline void setKeepAlive(bool keepAlive) { m_keepAlive = keepAlive; }
+
+    /*!
+     * \brief reconnect
+     * Replaces a stale pooled connection with a new one.
+     */
+    void reconnect()
+    {
+        closeConnection();
+        m_reused = false;
+        connect();
+    }
+
+    size_t readSome(char *data, size_t size)
+    {
+        for (;;) {
+            auto res = ::read(m_fd, data, size);
+            if (res >= 0)
+                return res;
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                throw std::make_error_code(std::errc(errno));
+            if (auto ec = m_stream.yield())
+                throw ec;
+        }
+    }
+
+    void write(std::vector<Dracon::ConstBuffer> buffers)
+    {
+        size_t pos = 0;
+        while (pos < buffers.size()) {
+            msghdr msg{};
+            msg.msg_iov = reinterpret_cast<iovec*>(&buffers[pos]);
+            msg.msg_iovlen = buffers.size() - pos;
+            auto written = ::sendmsg(m_fd, &msg, MSG_NOSIGNAL);
+            if (written < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno != EAGAIN)
+                    throw std::make_error_code(std::errc(errno));
+                if (auto ec = m_stream.yield())
+                    throw ec;
+                continue;
+            }
+            while (pos < buffers.size() && size_t(written) >= buffers[pos].length)
+                written -= buffers[pos++].length;
+            if (pos < buffers.size()) {
+                buffers[pos].c_ptr += written;
+                buffers[pos].length -= written;
+            }
+        }
+    }
+
+private:
+    int idleConnection()
+    {
+        auto it = t_idleConnections.find(&m_upstream);
+        if (it == t_idleConnections.end())
+            return -1;
+        auto &connections = it->second;
+        const auto now = Clock::now();
+        while (!connections.empty()) {
+            auto connection = connections.back();
+            connections.pop_back();
+            char ch;
+            // Drop the connections which are too old or were closed by the upstream
+            if (now - connection.since < s_idleTimeout &&
+                    ::recv(connection.fd, &ch, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && errno == EAGAIN) {
+                return connection.fd;
+            }
+            ::close(connection.fd);
+        }
+        return -1;
+    }
+
+    void connect()
+    {
+        m_fd = ::socket(m_upstream.address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (m_fd == -1)
+            throw std::make_error_code(std::errc(errno));
+        int opt = 1;
+        setsockopt(m_fd, SOL_TCP, TCP_NODELAY, &opt, sizeof(int));
+        m_stream.watchDescriptor(m_fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP);
+        if (!::connect(m_fd, reinterpret_cast<const sockaddr *>(&m_upstream.address), m_upstream.addressLength))
+            return;
+        if (errno != EINPROGRESS) {
+            WARNING(logger) << "Can't connect to " << m_upstream.name << " : " << strerror(errno);
+            throw Dracon::Response{502};
+        }
+        for (;;) {
+            pollfd pfd{m_fd, POLLOUT, 0};
+            if (::poll(&pfd, 1, 0) == 1)
+                break;
+            if (auto ec = m_stream.yield())
+                throw ec;
+        }
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &len) || error) {
+            WARNING(logger) << "Can't connect to " << m_upstream.name << " : " << strerror(error);
+            throw Dracon::Response{502};
+        }
+    }
+
+    void closeConnection()
+    {
+        if (m_fd == -1)
+            return;
+        m_stream.unwatchDescriptor(m_fd);
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    void release()
+    {
+        if (m_released)
+            return;
+        m_released = true;
+        --m_upstream.outstanding;
+        if (m_fd == -1)
+            return;
+        m_stream.unwatchDescriptor(m_fd);
+        if (m_keepAlive) {
+            try {
+                auto &connections = t_idleConnections[&m_upstream];
+                if (connections.size() < s_maxIdleConnections) {
+                    connections.push_back({m_fd, Clock::now()});
+                    m_fd = -1;
+                    return;
+                }
+            } catch (...) {}
+        }
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+private:
+    Dracon::AbstractStream &m_stream;
+    Upstream &m_upstream;
+    int m_fd = -1;
+    bool m_reused = false;
+    bool m_keepAlive = false;
+    bool m_released = false;
+};
+
+/*!
+ * \brief The StaleConnection struct
+ *
+ * Thrown when a pooled connection was closed by the upstream before it answered
+ */
+struct StaleConnection {};
+
+/*!
+ * \brief The ResponseRelay class
+ *
+ * Parses the upstream response and streams it to the client
+ */
+class ResponseRelay
+{
+public:
+    ResponseRelay(Dracon::AbstractStream &stream, UpstreamConnection &connection, bool head)
+        : m_stream(stream)
+        , m_connection(connection)
+        , m_head(head)
+    {
+        memset(&m_settings, 0, sizeof(m_settings));
+        m_settings.on_header_field = &ResponseRelay::headerField;
+        m_settings.on_header_value = &ResponseRelay::headerValue;
+        m_settings.on_headers_complete = &ResponseRelay::headersComplete;
+        m_settings.on_body = &ResponseRelay::body;
+        m_settings.on_message_complete = &ResponseRelay::messageComplete;
+        http_parser_init(&m_parser, HTTP_RESPONSE);
+        m_parser.data = this;
+    }
+
+    void run()
+    {
+        auto buffer = std::make_unique<char[]>(ReadBufferSize);
+        bool received = false;
+        while (!m_completed) {
+            size_t size;
+            try {
+                size = m_connection.readSome(buffer.get(), ReadBufferSize);
+            } catch (const std::error_code &ec) {
+                // the request was written to a connection which was closed by the upstream meanwhile
+                if (!received && m_connection.reused() && ec == std::errc::connection_reset)
+                    throw StaleConnection{};
+                throw;
+            }
+            if (!size && !received) {
+                if (m_connection.reused())
+                    throw StaleConnection{};
+                throw Dracon::Response{502}; // the upstream closed the connection
+            }
+            received = true;
+            http_parser_execute(&m_parser, &m_settings, buffer.get(), size);
+            if (m_error)
+                std::rethrow_exception(m_error);
+            if (m_parser.http_errno) {
+                WARNING(logger) << "Invalid upstream response " << http_errno_name(http_errno(m_parser.http_errno));
+                throw Dracon::Response{502};
+            }
+            if (!size && !m_completed)
+                throw std::make_error_code(std::errc::connection_aborted);
+            if (m_relayBody && !m_completed) {
+                // the rest of the body goes straight from the upstream to the client
+                const size_t remaining = m_parser.content_length;
+                if (m_stream.relay(m_connection.fd(), Dracon::RelayDirection::ToStream, remaining) != remaining)
+                    throw std::make_error_code(std::errc::connection_aborted);
+                m_completed = true;
+                m_keepAlive = http_should_keep_alive(&m_parser);
+            }
+        }
+        m_chunkedStream.reset();
+        m_connection.setKeepAlive(m_keepAlive);
+    }
+
+private:
+    static int headerField(http_parser *parser, const char *at, size_t length)
+    {
+        auto self = reinterpret_cast<ResponseRelay *>(parser->data);
+        return self->call([&]{
+            if (!self->m_lastWasField)
+                self->m_fields.emplace_back();
+            self->m_fields.back().first.append(at, length);
+            self->m_lastWasField = true;
+        });
+    }
+
+    static int headerValue(http_parser *parser, const char *at, size_t length)
+    {
+        auto self = reinterpret_cast<ResponseRelay *>(parser->data);
+        return self->call([&]{
+            self->m_fields.back().second.append(at, length);
+            self->m_lastWasField = false;
+        });
+    }
+
+    static int headersComplete(http_parser *parser)
+    {
+        auto self = reinterpret_cast<ResponseRelay *>(parser->data);
+        if (self->call([&]{ self->sendHeaders(); }))
+            return -1;
+        // Tell the parser that the response to a HEAD request has no body
+        return self->m_head ? 1 : 0;
+    }
+
+    static int body(http_parser *parser, const char *at, size_t length)
+    {
+        auto self = reinterpret_cast<ResponseRelay *>(parser->data);
+        return self->call([&]{
+            if (self->m_chunkedStream)
+                self->m_chunkedStream->write({at, length});
+            else
+                self->m_stream.write({at, length});
+        });
+    }
+
+    static int messageComplete(http_parser *parser)
+    {
+        auto self = reinterpret_cast<ResponseRelay *>(parser->data);
+        self->m_completed = true;
+        self->m_keepAlive = http_should_keep_alive(parser);
+        return 0;
+    }
+
+    template <typename F>
+    int call(F function) noexcept
+    {
+        try {
+            function();
+            return 0;
+        } catch (...) {
+            m_error = std::current_exception();
+        }
+        return -1;
+    }
+
+    void sendHeaders()
+    {
+        const uint16_t status = m_parser.status_code;
+        Dracon::Response res{status};
+        std::vector<std::string> hopByHop;
+        for (const auto &kv : m_fields) {
+            if (boost::iequals(kv.first, "Connection")) {
+                for (auto field : Dracon::split(kv.second, ','))
+                    hopByHop.emplace_back(boost::trim_copy(std::string{field}));
+            }
+        }
+        bool chunked = false;
+        std::optional<size_t> contentLength;
+        for (auto &kv : m_fields) {
+            if (boost::iequals(kv.first, "Transfer-Encoding")) {
+                chunked = true;
+            } else if (boost::iequals(kv.first, "Content-Length")) {
+                contentLength = std::strtoull(kv.second.c_str(), nullptr, 10);
+            } else if (!isHopByHop(kv.first, hopByHop)) {
+                res[std::move(kv.first)] = std::move(kv.second);
+            }
+        }
+        m_fields.clear();
+        if (m_head || status < 200 || status == 204 || status == 304) {
+            res.setContentLength(contentLength && m_head ? *contentLength : 0);
+            m_stream << res;
+        } else if (contentLength && !chunked) {
+            res.setContentLength(*contentLength);
+            m_stream << res;
+            m_relayBody = true;
+        } else {
+            // chunked or close delimited responses are sent chunked to the client
+            res.setContentLength(Dracon::ChunkedData);
+            m_stream << res;
+            m_chunkedStream.emplace(m_stream);
+        }
+    }
+
+private:
+    Dracon::AbstractStream &m_stream;
+    UpstreamConnection &m_connection;
+    bool m_head;
+    http_parser m_parser;
+    http_parser_settings m_settings;
+    std::vector<std::pair<std::string, std::string>> m_fields;
+    bool m_lastWasField = false;
+    bool m_completed = false;
+    bool m_keepAlive = false;
+    bool m_relayBody = false;
+    std::exception_ptr m_error;
+    std::optional<Dracon::ChunkedStream> m_chunkedStream;
+};
+
+std::string requestHead(const Dracon::AbstractStream &stream, const Dracon::Request &req, const std::string &url, bool chunked)
+{
+    std::string head;
+    head.reserve(1024);
+    head.append(req.method()).append(" ").append(url).append(" HTTP/1.1\r\n");
+    const auto hopByHop = connectionFields(req);
+    std::string forwardedFor;
+    for (const auto &kv : req) {
+        if (isHopByHop(kv.first, hopByHop) || boost::iequals(kv.first, "Expect"))
+            continue;
+        if (boost::iequals(kv.first, "X-Forwarded-For")) {
+            forwardedFor = kv.second;
+            continue;
+        }
+        head.append(kv.first).append(": ").append(kv.second).append(Dracon::CrlfString);
+    }
+    if (!forwardedFor.empty())
+        forwardedFor.append(", ");
+    forwardedFor.append(stream.peerAddress());
+    head.append("X-Forwarded-For: ").append(forwardedFor).append(Dracon::CrlfString);
+    head.append("X-Forwarded-Proto: ").append(stream.isSecuredConnection() ? "https" : "http").append(Dracon::CrlfString);
+    if (chunked)
+        head.append("Transfer-Encoding: chunked\r\n");
+    head.append("Connection: keep-alive\r\n\r\n");
+    return head;
+}
+
+bool isIdempotent(std::string_view method)
+{
+    return method == "GET" || method == "HEAD" || method == "OPTIONS" ||
+            method == "PUT" || method == "DELETE" || method == "TRACE";
+}
+
+/*!
+ * \brief relayResponse
+ *
+ * Relays the upstream response. If the pooled connection turns out to be stale and
+ * the request can be \a retried, the \a head is resent on a new connection.
+ */
+void relayResponse(Dracon::AbstractStream &stream, UpstreamConnection &connection, const Dracon::Request &req, const std::string &head, bool retry)
+{
+    const bool isHead = req.method() == "HEAD";
+    try {
+        ResponseRelay{stream, connection, isHead}.run();
+    } catch (const StaleConnection &) {
+        if (!retry)
+            throw Dracon::Response{502};
+        connection.reconnect();
+        connection.write({head});
+        try {
+            ResponseRelay{stream, connection, isHead}.run();
+        } catch (const StaleConnection &) {
+            throw Dracon::Response{502};
+        }
+    }
+}
+
+void proxySession(const Route &route, const std::string &url, Dracon::AbstractStream &stream, Dracon::Request &req)
+{
+    stream.setSessionTimeout(s_timeout);
+    auto transferEncoding = findField(req, "Transfer-Encoding");
+    const bool chunked = transferEncoding && boost::icontains(*transferEncoding, "chunked");
+
+    UpstreamConnection connection{stream, route.pickUpstream()};
+    const auto head = requestHead(stream, req, url, chunked);
+    try {
+        connection.write({head});
+    } catch (...) {
+        // a pooled connection might be closed by the upstream meanwhile
+        if (!connection.reused())
+            throw;
+        connection.reconnect();
+        connection.write({head});
+    }
+
+    const size_t contentLength = req.contentLength();
+    const bool hasBody = chunked || (contentLength != Dracon::ChunkedData && contentLength);
+    if (!chunked && contentLength != Dracon::ChunkedData && contentLength) {
+        // Relay the body as it is, without parsing it
+        auto expect = findField(req, "Expect");
+        const bool continueExpected = expect && boost::iequals(*expect, "100-continue");
+        if (contentLength > s_maxBodySize)
+            throw continueExpected ? 417 : 413;
+        if (continueExpected)
+            stream << Dracon::Response{100};
+        if (stream.relay(connection.fd(), Dracon::RelayDirection::FromStream, contentLength) != contentLength)
+            throw std::make_error_code(std::errc::connection_aborted);
+        req.setState(Dracon::Request::State::Completed);
+        relayResponse(stream, connection, req, head, false);
+        return;
+    }
+
+    // Stream the request body as it arrives
+    req.appendBodyCallback([&](std::string_view data) {
+        if (data.empty())
+            return;
+        if (!chunked) {
+            connection.write({data});
+            return;
+        }
+        std::ostringstream chunkHeader;
+        chunkHeader << std::hex << data.size() << Dracon::CrlfString;
+        connection.write({chunkHeader.str(), data, Dracon::CrlfString});
+    }, s_maxBodySize);
+    stream >> req;
+    if (chunked)
+        connection.write({Dracon::EndOfChunckedStream});
+
+    relayResponse(stream, connection, req, head, !hasBody && isIdempotent(req.method()));
+}
+
+std::unique_ptr<Upstream> resolveUpstream(const std::string &name)
+{
+    auto pos = name.rfind(':');
+    if (pos == std::string::npos)
+        throw std::runtime_error{"Invalid upstream \"" + name + "\", the port is missing"};
+    auto host = name.substr(0, pos);
+    auto port = name.substr(pos + 1);
+    if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *result = nullptr;
+    if (int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &result))
+        throw std::runtime_error{"Can't resolve \"" + name + "\" : " + gai_strerror(err)};
+    auto upstream = std::make_unique<Upstream>();
+    upstream->name = name;
+    memcpy(&upstream->address, result->ai_addr, result->ai_addrlen);
+    upstream->addressLength = result->ai_addrlen;
+    freeaddrinfo(result);
+    return upstream;
+}
+
+} // namespace
+
+PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
+{
+    const auto &url = req.url();
+    for (const auto &route : s_routes) {
+        if (boost::starts_with(url, route->prefix)) {
+            auto upstreamUrl = route->rewrite ? *route->rewrite + url.substr(route->prefix.size()) : url;
+            return [route = route.get(), upstreamUrl = std::move(upstreamUrl)](Dracon::AbstractStream &stream, Dracon::Request &req) {
+                proxySession(*route, upstreamUrl, stream, req);
+            };
+        }
+    }
+    return {};
+}
+
+PLUGIN_EXPORT bool init_plugin(const std::string &confDir)
+{
+    INFO(logger) << "Initializing plugin";
+    namespace pt = boost::property_tree;
+    pt::ptree properties;
+    pt::read_info(std::filesystem::path(confDir).append("proxy.conf").string(), properties);
+    s_maxIdleConnections = properties.get("max_idle_connections", s_maxIdleConnections);
+    s_idleTimeout = std::chrono::seconds{properties.get("idle_timeout", s_idleTimeout.count())};
+    s_timeout = std::chrono::seconds{properties.get("timeout", s_timeout.count())};
+    s_maxBodySize = properties.get("max_body_size", s_maxBodySize);
+
+    if (properties.find("routes") == properties.not_found())
+        return false;
+    for (const auto &p : properties.get_child("routes")) {
+        auto route = std::make_unique<Route>();
+        route->prefix = p.first;
+        if (auto rewrite = p.second.get_optional<std::string>("rewrite"))
+            route->rewrite = *rewrite;
+        for (const auto &u : p.second.get_child("upstreams")) {
+            try {
+                route->upstreams.emplace_back(resolveUpstream(u.first));
+                DEBUG(logger) << "Proxy \"" << route->prefix << "\" to \"" << u.first << "\"";
+            } catch (const std::exception &e) {
+                ERROR(logger) << e.what();
+            }
+        }
+        if (route->upstreams.empty()) {
+            ERROR(logger) << "No upstreams for \"" << route->prefix << "\"";
+            continue;
+        }
+        s_routes.emplace_back(std::move(route));
+    }
+    return !s_routes.empty();
+}
+
+PLUGIN_EXPORT uint32_t plugin_order()
+{
+    // before the static content plugin
+    return UINT32_MAX - 1;
+}
+
+PLUGIN_EXPORT Dracon::PluginRoutes plugin_routes()
+{
+    Dracon::PluginRoutes routes;
+    for (const auto &route : s_routes)
+        routes.push_back({route->prefix});
+    return routes;
+}
+
+PLUGIN_EXPORT void destory_plugin()
+{
+}
+
+DRACON_REGISTER_PLUGIN(proxy, init_plugin, create_session, plugin_order, destory_plugin, plugin_routes);
@@ -0,0 +1,210 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Shared by the static content plugin and the bundle tool
+namespace StaticContent {
+
+inline std::string_view mimeType(std::string_view ext)
+{
+    if (ext == ".htm")  return "text/html";
+    if (ext == ".html") return "text/html";
+    if (ext == ".php")  return "text/html";
+    if (ext == ".css")  return "text/css";
+    if (ext == ".js")   return "application/javascript";
+    if (ext == ".json") return "application/json";
+    if (ext == ".xml")  return "application/xml";
+    if (ext == ".png")  return "image/png";
+    if (ext == ".jpe")  return "image/jpeg";
+    if (ext == ".jpeg") return "image/jpeg";
+    if (ext == ".jpg")  return "image/jpeg";
+    if (ext == ".gif")  return "image/gif";
+    if (ext == ".bmp")  return "image/bmp";
+    if (ext == ".tiff") return "image/tiff";
+    if (ext == ".tif")  return "image/tiff";
+    if (ext == ".svg")  return "image/svg+xml";
+    if (ext == ".svgz") return "image/svg+xml";
+    if (ext == ".txt")  return "text/plain";
+    if (ext == ".webp")  return "image/webp";
+    if (ext == ".webm")  return "video/webmx";
+    if (ext == ".weba")  return "audio/webm";
+    if (ext == ".swf")  return "application/x-shockwave-flash";
+    if (ext == ".flv")  return "video/x-flv";
+    return "application/octet-stream";
+}
+
+/*!
+ * The bundle file format:
+ *  - Header
+ *  - Entry[Header::count], sorted by path
+ *  - the strings and the files data
+ * All the offsets are from the beginning of the file, the integers are in host byte order.
+ */
+namespace Bundle {
+constexpr char Magic[8] = {'G', 'E', 'T', 'B', 'N', 'D', 'L', '\0'};
+constexpr uint32_t Version = 1;
+
+struct Header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t entriesOffset;
+    uint64_t size;
+};
+
+struct Blob
+{
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct Entry
+{
+    Blob path; // relative to the bundle root, without the leading '/'
+    Blob mimeType;
+    Blob etag;
+    Blob data;
+    Blob gzip; // empty if the file has no gzip variant
+    int64_t lastModified; // seconds since epoch
+};
+} // namespace Bundle
+
+/*!
+ * \brief The MappedBundle class
+ *
+ * The whole bundle is mapped once, the lookups are binary searches in the entries.
+ * All the entries are validated when it's loaded, so the lookups don't need any check.
+ */
+class MappedBundle
+{
+public:
+    explicit MappedBundle(const std::string &path)
+        : m_path(path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            throw std::runtime_error{"Can't open " + path + " : " + strerror(errno)};
+        struct stat st;
+        if (fstat(fd, &st)) {
+            ::close(fd);
+            throw std::runtime_error{"Can't stat " + path};
+        }
+        m_inode = st.st_ino;
+        m_lastWriteTime = st.st_mtim;
+        m_size = st.st_size;
+        if (m_size < sizeof(Bundle::Header)) {
+            ::close(fd);
+            throw std::runtime_error{path + " is not a bundle"};
+        }
+        auto data = ::mmap(nullptr, m_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            throw std::runtime_error{"Can't map " + path};
+        m_data = static_cast<const char *>(data);
+        try {
+            validate();
+        } catch (...) {
+            ::munmap(const_cast<char *>(m_data), m_size);
+            throw;
+        }
+    }
+
+    ~MappedBundle()
+    {
+        ::munmap(const_cast<char *>(m_data), m_size);
+    }
+
+    MappedBundle(const MappedBundle &) = delete;
+    MappedBundle &operator=(const MappedBundle &) = delete;
+
+    const Bundle::Entry *find(std::string_view path) const
+    {
+        auto begin = m_entries, end = m_entries + m_header->count;
+        while (begin < end) {
+            auto middle = begin + (end - begin) / 2;
+            auto cmp = view(middle->path).compare(path);
+            if (!cmp)
+                return middle;
+            if (cmp < 0)
+                begin = middle + 1;
+            else
+                end = middle;
+        }
+        return nullptr;
+    }
+
+    std::string_view view(const Bundle::Blob &blob) const
+    {
+        return {m_data + blob.offset, blob.size};
+    }
+
+    const std::string &path() const { return m_path; }
+    size_t size() const { return m_header->count; }
+
+    /// true if \a st describes a different file than the mapped one
+    bool changed(const struct stat &st) const
+    {
+        return st.st_ino != m_inode || size_t(st.st_size) != m_size ||
+                st.st_mtim.tv_sec != m_lastWriteTime.tv_sec || st.st_mtim.tv_nsec != m_lastWriteTime.tv_nsec;
+    }
+
+private:
+    void validate()
+    {
+        m_header = reinterpret_cast<const Bundle::Header *>(m_data);
+        if (memcmp(m_header->magic, Bundle::Magic, sizeof(Bundle::Magic)) || m_header->version != Bundle::Version ||
+                m_header->size != m_size || m_header->entriesOffset % alignof(Bundle::Entry) ||
+                m_header->entriesOffset > m_size ||
+                (m_size - m_header->entriesOffset) / sizeof(Bundle::Entry) < m_header->count)
+            throw std::runtime_error{m_path + " is not a valid bundle"};
+        m_entries = reinterpret_cast<const Bundle::Entry *>(m_data + m_header->entriesOffset);
+        auto valid = [this](const Bundle::Blob &blob) {
+            return blob.offset <= m_size && blob.size <= m_size - blob.offset;
+        };
+        for (uint32_t i = 0; i < m_header->count; ++i) {
+            const auto &entry = m_entries[i];
+            if (!valid(entry.path) || !valid(entry.mimeType) || !valid(entry.etag) ||
+                    !valid(entry.data) || !valid(entry.gzip) ||
+                    (i && view(m_entries[i - 1].path) >= view(entry.path)))
+                throw std::runtime_error{m_path + " is not a valid bundle"};
+        }
+    }
+
+private:
+    std::string m_path;
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    ino_t m_inode = 0;
+    timespec m_lastWriteTime{};
+    const Bundle::Header *m_header = nullptr;
+    const Bundle::Entry *m_entries = nullptr;
+};
+
+} // namespace StaticContent
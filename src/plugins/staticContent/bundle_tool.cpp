@@ -0,0 +1,196 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dracon/compression.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "bundle.h"
+
+namespace {
+using namespace StaticContent;
+
+struct File
+{
+    std::string path;
+    std::string data;
+    std::string gzip;
+    std::string etag;
+    std::string_view mimeType;
+    int64_t lastModified;
+};
+
+std::string readFile(const std::filesystem::path &path)
+{
+    std::ifstream in{path, std::ios::binary};
+    std::ostringstream res;
+    res << in.rdbuf();
+    if (!in)
+        throw std::runtime_error{"Can't read " + path.string()};
+    return res.str();
+}
+
+// the ETag depends only on the content, so it's the same for all the deployments of a file
+std::string contentEtag(const std::string &data)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (auto ch : data) {
+        hash ^= uint8_t(ch);
+        hash *= 0x100000001b3ULL;
+    }
+    std::ostringstream res;
+    res << '"' << std::hex << hash << '-' << data.size() << '"';
+    return res.str();
+}
+
+class BundleWriter
+{
+public:
+    explicit BundleWriter(std::vector<File> files)
+        : m_files(std::move(files))
+    {
+        std::sort(m_files.begin(), m_files.end(), [](const File &a, const File &b) {
+            return a.path < b.path;
+        });
+    }
+
+    void write(const std::filesystem::path &path)
+    {
+        Bundle::Header header{};
+        memcpy(header.magic, Bundle::Magic, sizeof(Bundle::Magic));
+        header.version = Bundle::Version;
+        header.count = uint32_t(m_files.size());
+        header.entriesOffset = sizeof(Bundle::Header);
+        uint64_t offset = header.entriesOffset + m_files.size() * sizeof(Bundle::Entry);
+
+        std::vector<Bundle::Entry> entries;
+        entries.reserve(m_files.size());
+        std::vector<std::string_view> blobs;
+        auto blob = [&](std::string_view data) {
+            Bundle::Blob res{offset, data.size()};
+            blobs.push_back(data);
+            offset += data.size();
+            return res;
+        };
+        for (const auto &file : m_files) {
+            Bundle::Entry entry{};
+            entry.path = blob(file.path);
+            entry.mimeType = blob(file.mimeType);
+            entry.etag = blob(file.etag);
+            entry.data = blob(file.data);
+            if (!file.gzip.empty())
+                entry.gzip = blob(file.gzip);
+            entry.lastModified = file.lastModified;
+            entries.push_back(entry);
+        }
+        header.size = offset;
+
+        // the new bundle replaces the old one atomically
+        auto tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            std::ofstream out{tmpPath, std::ios::binary | std::ios::trunc};
+            out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            out.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(Bundle::Entry));
+            for (auto data : blobs)
+                out.write(data.data(), data.size());
+            out.flush();
+            if (!out)
+                throw std::runtime_error{"Can't write " + tmpPath.string()};
+        }
+        std::filesystem::rename(tmpPath, path);
+    }
+
+private:
+    std::vector<File> m_files;
+};
+
+int64_t lastModified(const std::filesystem::path &path)
+{
+    struct stat st;
+    if (::stat(path.c_str(), &st))
+        throw std::runtime_error{"Can't stat " + path.string()};
+    return st.st_mtim.tv_sec;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    bool gzip = true;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i] == std::string{"--no-gzip"})
+            gzip = false;
+        else
+            args.emplace_back(argv[i]);
+    }
+    if (args.size() != 2) {
+        std::cerr << "Usage: " << argv[0] << " [--no-gzip] <assets folder> <bundle file>" << std::endl
+                  << "Packs all the files from <assets folder> into <bundle file>." << std::endl
+                  << "The compressible files get a gzip variant, their \".gz\" siblings are used if they exist." << std::endl;
+        return 1;
+    }
+
+    try {
+        const std::filesystem::path root = std::filesystem::canonical(args[0]);
+        std::vector<File> files;
+        for (const auto &it : std::filesystem::recursive_directory_iterator{root}) {
+            if (!it.is_regular_file())
+                continue;
+            const auto &path = it.path();
+            auto gzPath = path;
+            gzPath += ".gz";
+            // the ".gz" siblings are the gzip variants of their files
+            if (path.extension() == ".gz") {
+                auto original = path;
+                original.replace_extension();
+                if (std::filesystem::is_regular_file(original))
+                    continue;
+            }
+            File file;
+            file.path = path.lexically_relative(root).generic_string();
+            file.data = readFile(path);
+            file.mimeType = mimeType(path.extension().string());
+            file.etag = contentEtag(file.data);
+            file.lastModified = lastModified(path);
+            if (gzip && file.data.size() >= Dracon::DefaultCompressionThreshold &&
+                    Dracon::isCompressibleType(file.mimeType)) {
+                if (std::filesystem::is_regular_file(gzPath))
+                    file.gzip = readFile(gzPath);
+                else
+                    file.gzip = Dracon::compress(file.data);
+                // don't waste space on the files which don't compress well
+                if (file.gzip.size() >= file.data.size() - file.data.size() / 10)
+                    file.gzip.clear();
+            }
+            files.push_back(std::move(file));
+        }
+        auto count = files.size();
+        BundleWriter{std::move(files)}.write(args[1]);
+        std::cout << "Packed " << count << " files into " << args[1] << std::endl;
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -14,112 +14,1145 @@
     You should have received a copy of the GNU Affero General Public License
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
+#include <dracon/compression.h>
 #include <dracon/http.h>
 #include <dracon/logging.h>
 #include <dracon/plugin.h>
+#include <dracon/thread_worker.h>
 #include <dracon/utils.h>
 
+#include <algorithm>
+#include <atomic>
+#include <ctime>
 #include <filesystem>
+#include <iomanip>
+#include <list>
+#include <map>
+#include <shared_mutex>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/property_tree/info_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
 
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bundle.h"
+
 namespace {
+using StaticContent::mimeType;
+
+std::string httpDate(time_t time)
+{
+    tm t;
+    gmtime_r(&time, &t);
+    char buff[64];
+    return {buff, strftime(buff, sizeof(buff), "%a, %d %b %Y %H:%M:%S GMT", &t)};
+}
+
+time_t parseHttpDate(const std::string &date)
+{
+    tm t{};
+    auto end = strptime(date.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &t);
+    if (!end || *end)
+        return -1;
+    return timegm(&t);
+}
+
 class FileMap
 {
 public:
     FileMap(const std::filesystem::path &path, std::filesystem::file_time_type lastWriteTime)
         : m_lastWriteTime(lastWriteTime)
     {
-        if (std::filesystem::file_size(path)) {
+        struct stat st;
+        if (::stat(path.c_str(), &st))
+            throw std::filesystem::filesystem_error{"Can't stat", path, std::error_code{errno, std::system_category()}};
+        if (st.st_size) {
             m_mappedFile = std::make_unique<boost::iostreams::mapped_file_source>(path);
             m_size = m_mappedFile->size();
             m_data = m_mappedFile->data();
         }
+        // "mtime-size" in hex, like nginx does, computed only once per mapping
+        std::ostringstream etag;
+        etag << '"' << std::hex << st.st_mtim.tv_sec << '-' << st.st_mtim.tv_nsec << '-' << st.st_size << '"';
+        m_etag = etag.str();
+        m_lastModifiedTime = st.st_mtim.tv_sec;
+        m_lastModified = httpDate(m_lastModifiedTime);
     }
     ~FileMap() { if (m_mappedFile) m_mappedFile->close(); }
 
     inline size_t size() const { return m_size; }
     inline const char* data() const { return m_data; }
     inline std::filesystem::file_time_type lastWriteTime() const { return m_lastWriteTime; }
+    inline const std::string &etag() const { return m_etag; }
+    inline const std::string &lastModified() const { return m_lastModified; }
+    inline time_t lastModifiedTime() const { return m_lastModifiedTime; }
 
 private:
     size_t m_size = 0;
     const char* m_data = nullptr;
     std::filesystem::file_time_type m_lastWriteTime;
     std::unique_ptr<boost::iostreams::mapped_file_source> m_mappedFile;
+    std::string m_etag;
+    std::string m_lastModified;
+    time_t m_lastModifiedTime;
 };
 using FileMapPtr = std::shared_ptr<FileMap>;
-Dracon::LruCache<std::string, FileMapPtr> s_filesCache{100};
+using CompressedDataPtr = std::shared_ptr<const std::string>;
+
+/*!
+ * \brief The CompressedFilesCache class
+ *
+ * Keeps the on the fly gzipped files in memory. The entries are keyed by the file path
+ * and its last write time and the LRU ones are evicted when the compressed bytes exceed the budget.
+ * A null data entry marks a file which doesn't compress well, so it isn't compressed again.
+ */
+class CompressedFilesCache
+{
+public:
+    void setBudget(size_t bytes)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_budget = bytes;
+        evict();
+    }
+    size_t budget() const { return m_budget; }
+
+    /*!
+     * \brief value
+     * \return true if the \a path with \a lastWriteTime was compressed, \a data is null if it's not worth it
+     */
+    bool value(const std::string &path, std::filesystem::file_time_type lastWriteTime, CompressedDataPtr &data)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        auto it = m_index.find(path);
+        if (it == m_index.end() || it->second->lastWriteTime != lastWriteTime)
+            return false;
+        m_items.splice(m_items.begin(), m_items, it->second);
+        data = it->second->data;
+        return true;
+    }
+
+    /*!
+     * \brief schedule
+     * \return true if the caller must compress the file, false if it's already being compressed
+     */
+    bool schedule(const std::string &path)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        return m_pending.insert(path).second;
+    }
+
+    void put(const std::string &path, std::filesystem::file_time_type lastWriteTime, CompressedDataPtr data)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_pending.erase(path);
+        auto it = m_index.find(path);
+        if (it != m_index.end())
+            erase(it);
+        m_items.push_front({path, lastWriteTime, std::move(data)});
+        m_index[path] = m_items.begin();
+        m_bytes += cost(m_items.front());
+        evict();
+    }
+
+    void cancel(const std::string &path)
+    {
+        std::unique_lock<std::mutex> lock{m_mutex};
+        m_pending.erase(path);
+    }
+
+private:
+    struct Item
+    {
+        std::string path;
+        std::filesystem::file_time_type lastWriteTime;
+        CompressedDataPtr data;
+    };
+    using Iterator = std::list<Item>::iterator;
+
+    static size_t cost(const Item &item)
+    {
+        return item.path.size() + (item.data ? item.data->size() : 0);
+    }
+
+    void erase(std::unordered_map<std::string, Iterator>::iterator it)
+    {
+        m_bytes -= cost(*it->second);
+        m_items.erase(it->second);
+        m_index.erase(it);
+    }
+
+    void evict()
+    {
+        while (m_bytes > m_budget && !m_items.empty())
+            erase(m_index.find(m_items.back().path));
+    }
+
+private:
+    std::mutex m_mutex;
+    std::list<Item> m_items;
+    std::unordered_map<std::string, Iterator> m_index;
+    std::unordered_set<std::string> m_pending;
+    size_t m_bytes = 0;
+    size_t m_budget = 64 * 1024 * 1024;
+};
+
+// the mapped files, limited by the mapped bytes
+std::unique_ptr<Dracon::ShardedCache<std::string, FileMapPtr>> s_filesCache;
+CompressedFilesCache s_compressedFiles;
+std::unique_ptr<Dracon::ThreadWorker> s_compressionWorker;
+bool s_compression = true;
+size_t s_compressionMinSize = Dracon::DefaultCompressionThreshold;
+size_t s_compressionMaxFileSize = 8 * 1024 * 1024;
 
-std::mutex s_filesCacheMutex;
 std::string s_default_file;
-std::vector<std::pair<std::string, std::string>> s_urls;
+using Urls = std::vector<std::pair<std::string, std::string>>;
+Urls s_urls;
+// the paths of the virtual hosts, keyed on their names from the server configuration
+std::map<std::string, Urls, std::less<>> s_virtualHostsUrls;
 bool s_allow_symlinks = false;
 TaggedLogger<> logger{"staticContent"};
-std::unique_ptr<Dracon::SimpleTimer> g_timer;
 Dracon::Fields s_customFields;
 
-inline std::string mimeType(boost::string_view ext)
-{
-    if (ext == ".htm")  return "text/html";
-    if (ext == ".html") return "text/html";
-    if (ext == ".php")  return "text/html";
-    if (ext == ".css")  return "text/css";
-    if (ext == ".js")   return "application/javascript";
-    if (ext == ".json") return "application/json";
-    if (ext == ".xml")  return "application/xml";
-    if (ext == ".png")  return "image/png";
-    if (ext == ".jpe")  return "image/jpeg";
-    if (ext == ".jpeg") return "image/jpeg";
-    if (ext == ".jpg")  return "image/jpeg";
-    if (ext == ".gif")  return "image/gif";
-    if (ext == ".bmp")  return "image/bmp";
-    if (ext == ".tiff") return "image/tiff";
-    if (ext == ".tif")  return "image/tiff";
-    if (ext == ".svg")  return "image/svg+xml";
-    if (ext == ".svgz") return "image/svg+xml";
-    if (ext == ".txt")  return "text/plain";
-    if (ext == ".webp")  return "image/webp";
-    if (ext == ".webm")  return "video/webmx";
-    if (ext == ".weba")  return "audio/webm";
-    if (ext == ".swf")  return "application/x-shockwave-flash";
-    if (ext == ".flv")  return "video/x-flv";
-    return "application/octet-stream";
+FileMapPtr mappedFile(const std::filesystem::path &path, std::filesystem::file_time_type lastWriteTime)
+{
+    auto key = path.string();
+    auto file = s_filesCache->value(key);
+    if (!file || file->lastWriteTime() != lastWriteTime) {
+        file = std::make_shared<FileMap>(path, lastWriteTime);
+        // if it's not admitted it's unmapped when this request is done
+        s_filesCache->put(key, file, sizeof(FileMap) + key.size() + file->size());
+    }
+    return file;
 }
 
-void static_content_session(const std::filesystem::path &root, const std::filesystem::path &path, bool head, Dracon::AbstractStream& stream, Dracon::Request& req)
+struct ResolvedPath
 {
-    stream >> req;
-    auto p = (root / path).lexically_normal();
-    if (!s_allow_symlinks)
-        p = std::filesystem::canonical(p);
-    if (!boost::starts_with(p, root)) { // make sure we don't server files outside the root
-        WARNING(logger) << "path \"" << p << "\" is outside the root \"" << root << "\"";
-        throw Dracon::Response{400};
-    }
-    if (std::filesystem::is_directory(p))
+    std::filesystem::path path;
+    std::filesystem::file_time_type lastWriteTime;
+    bool hasGzipSibling = false;
+    std::filesystem::file_time_type gzipLastWriteTime;
+    // the path doesn't exist
+    bool missing = false;
+
+    bool operator ==(const ResolvedPath &other) const
+    {
+        return path == other.path && lastWriteTime == other.lastWriteTime && missing == other.missing &&
+                hasGzipSibling == other.hasGzipSibling && gzipLastWriteTime == other.gzipLastWriteTime;
+    }
+};
+using ResolvedPathPtr = std::shared_ptr<const ResolvedPath>;
+
+ResolvedPathPtr resolvePath(const std::filesystem::path &root, const std::filesystem::path &path)
+{
+    auto res = std::make_shared<ResolvedPath>();
+    auto &p = res->path;
+    p = (root / path).lexically_normal();
+    auto checkRoot = [&]{
+        if (!boost::starts_with(p, root)) { // make sure we don't server files outside the root
+            WARNING(logger) << "path \"" << p << "\" is outside the root \"" << root << "\"";
+            throw Dracon::Response{400};
+        }
+    };
+    checkRoot();
+    // the missing files are common (bots), they must not throw
+    auto isMissing = [](const std::error_code &ec) {
+        return ec == std::errc::no_such_file_or_directory || ec == std::errc::not_a_directory;
+    };
+    std::error_code ec;
+    if (!s_allow_symlinks) {
+        auto canonical = std::filesystem::canonical(p, ec);
+        if (ec) {
+            if (!isMissing(ec))
+                throw std::filesystem::filesystem_error{"Can't resolve", p, ec};
+            res->missing = true;
+            return res;
+        }
+        p = std::move(canonical);
+        checkRoot();
+    }
+    if (std::filesystem::is_directory(p, ec))
         p /= s_default_file;
-    TRACE(logger) << "Serving " << p.string();
-    std::unique_lock<std::mutex> lock{s_filesCacheMutex};
-    auto file = s_filesCache.value(p.string());
-    auto lastWriteTime = std::filesystem::last_write_time(p);
-    if (!file || file->lastWriteTime() != lastWriteTime) {
-        file = std::make_shared<FileMap>(p, lastWriteTime);
-        s_filesCache.put(p.string(), file);
+    res->lastWriteTime = std::filesystem::last_write_time(p, ec);
+    if (ec) {
+        if (!isMissing(ec))
+            throw std::filesystem::filesystem_error{"Can't stat", p, ec};
+        res->missing = true;
+        return res;
     }
+    if (s_compression) {
+        // The ".gz" sibling is used only if it's not older than the file itself
+        auto gzPath = p;
+        gzPath += ".gz";
+        std::error_code ec;
+        res->gzipLastWriteTime = std::filesystem::last_write_time(gzPath, ec);
+        res->hasGzipSibling = !ec && res->gzipLastWriteTime >= res->lastWriteTime;
+    }
+    return res;
+}
+
+FileMapPtr gzipSibling(const ResolvedPath &resolved)
+{
+    if (!resolved.hasGzipSibling)
+        return {};
+    auto gzPath = resolved.path;
+    gzPath += ".gz";
+    return mappedFile(gzPath, resolved.gzipLastWriteTime);
+}
+
+/*!
+ * \brief The ResolvedPaths class
+ *
+ * Maps the requested paths to their resolved files, so a hit makes no filesystem syscalls.
+ * Every directory crossed by a cached path (the requested one and the canonical one)
+ * is watched with inotify, the entries which depend on a changed directory entry are dropped.
+ * If the watches can't be set the paths are resolved on every request, as before.
+ */
+class ResolvedPaths
+{
+    static constexpr uint32_t WatchMask = IN_ATTRIB | IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE | IN_DELETE |
+            IN_DELETE_SELF | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    // a directory watch and the name of the entry in that directory
+    using Dependencies = std::vector<std::pair<int, std::string>>;
 
+public:
+    ~ResolvedPaths()
     {
-        Dracon::Response res{200};
-        static_cast<Dracon::Fields&>(res) = s_customFields;
-        res["Content-Type"] = mimeType(p.extension().string());
-        res.setContentLength(file->size());
-        stream << res;
+        stop();
+    }
+
+    void setMissingLimits(size_t maxEntries, std::chrono::seconds ttl)
+    {
+        m_maxMissing = maxEntries;
+        m_missingTtl = ttl;
+    }
+
+    bool start(size_t maxEntries)
+    {
+        m_maxEntries = maxEntries;
+        m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_inotifyFd == -1)
+            return false;
+        m_quitFd = eventfd(0, EFD_CLOEXEC);
+        if (m_quitFd == -1) {
+            ::close(m_inotifyFd);
+            m_inotifyFd = -1;
+            return false;
+        }
+        m_thread = std::thread{[this]{ run(); }};
+        return true;
+    }
+
+    void stop()
+    {
+        if (m_thread.joinable()) {
+            uint64_t quit = 1;
+            if (::write(m_quitFd, &quit, sizeof(quit)) == sizeof(quit))
+                m_thread.join();
+            else
+                m_thread.detach();
+        }
+        if (m_quitFd != -1)
+            ::close(m_quitFd);
+        if (m_inotifyFd != -1)
+            ::close(m_inotifyFd);
+        m_quitFd = m_inotifyFd = -1;
+    }
+
+    ResolvedPathPtr value(const std::string &key) const
+    {
+        std::shared_lock<std::shared_mutex> lock{m_mutex};
+        auto it = m_entries.find(key);
+        if (it != m_entries.end())
+            return it->second.resolved;
+        auto missing = m_missing.find(key);
+        if (missing != m_missing.end() && missing->second.expires > std::chrono::steady_clock::now())
+            return missing->second.resolved;
+        return {};
+    }
+
+    ResolvedPathPtr resolve(const std::filesystem::path &root, const std::filesystem::path &path, const std::string &key)
+    {
+        auto resolved = resolvePath(root, path);
+        if (resolved->missing && (m_inotifyFd == -1 || !m_missingTtl.count())) {
+            // without watches the missing paths are cached only for a while
+            if (m_missingTtl.count()) {
+                std::unique_lock<std::shared_mutex> lock{m_mutex};
+                addMissing(key, resolved, {});
+            }
+            return resolved;
+        }
+        if (m_inotifyFd == -1)
+            return resolved;
+
+        Dependencies dependencies;
+        if (resolved->missing) {
+            // the path depends on the first entry which doesn't exist
+            if (!addDependencies(root, resolved->path, dependencies, true))
+                return resolved;
+        } else {
+            if (!addDependencies(root, (root / path).lexically_normal(), dependencies) ||
+                    !addDependencies(root, resolved->path, dependencies))
+                return resolved;
+            dependencies.emplace_back(dependencies.back().first, dependencies.back().second + ".gz");
+        }
+
+        // the changes made before the watches were set didn't trigger any event,
+        // resolve it again now that everything it depends on is watched
+        auto generation = m_generation.load();
+        auto again = resolvePath(root, path);
+        if (!(*again == *resolved))
+            return again;
+
+        std::unique_lock<std::shared_mutex> lock{m_mutex};
+        if (generation != m_generation)
+            return again;
+        if (again->missing) {
+            addMissing(key, again, std::move(dependencies));
+            return again;
+        }
+        eraseEntry(key);
+        // evict the oldest entry
+        while (m_entries.size() >= m_maxEntries && !m_order.empty())
+            eraseEntry(m_order.front());
+        addDependents(key, dependencies);
+        m_order.push_back(key);
+        m_entries[key] = {again, std::move(dependencies), std::prev(m_order.end())};
+        return again;
+    }
+
+private:
+    struct Entry
+    {
+        ResolvedPathPtr resolved;
+        Dependencies dependencies;
+        std::list<std::string>::iterator order;
+    };
+
+    struct Missing
+    {
+        ResolvedPathPtr resolved;
+        std::chrono::steady_clock::time_point expires;
+        Dependencies dependencies;
+    };
+
+    // must be called with m_mutex locked
+    void addMissing(const std::string &key, const ResolvedPathPtr &resolved, Dependencies dependencies)
+    {
+        // the TTL is a safety net, the watched ones are dropped as soon as they are created
+        eraseMissing(key);
+        if (m_missing.size() >= m_maxMissing) {
+            auto now = std::chrono::steady_clock::now();
+            for (auto it = m_missing.begin(); it != m_missing.end();) {
+                if (it->second.expires <= now) {
+                    removeDependents(it->first, it->second.dependencies);
+                    it = m_missing.erase(it);
+                } else {
+                    ++it;
+                }
+            }
+            if (m_missing.size() >= m_maxMissing) {
+                removeDependents(m_missing.begin()->first, m_missing.begin()->second.dependencies);
+                m_missing.erase(m_missing.begin());
+            }
+        }
+        addDependents(key, dependencies);
+        m_missing[key] = {resolved, std::chrono::steady_clock::now() + m_missingTtl, std::move(dependencies)};
+    }
+
+    // must be called with m_mutex locked
+    void eraseEntry(const std::string &key)
+    {
+        auto it = m_entries.find(key);
+        if (it == m_entries.end())
+            return;
+        removeDependents(key, it->second.dependencies);
+        m_order.erase(it->second.order);
+        m_entries.erase(it);
+    }
+
+    void eraseMissing(const std::string &key)
+    {
+        auto it = m_missing.find(key);
+        if (it == m_missing.end())
+            return;
+        removeDependents(key, it->second.dependencies);
+        m_missing.erase(it);
+    }
+
+    void addDependents(const std::string &key, const Dependencies &dependencies)
+    {
+        for (const auto &dependency : dependencies)
+            m_dependents[dependency.first][dependency.second].insert(key);
+    }
+
+    void removeDependents(const std::string &key, const Dependencies &dependencies)
+    {
+        for (const auto &dependency : dependencies) {
+            auto dir = m_dependents.find(dependency.first);
+            if (dir == m_dependents.end())
+                continue;
+            auto name = dir->second.find(dependency.second);
+            if (name == dir->second.end())
+                continue;
+            name->second.erase(key);
+            if (name->second.empty()) {
+                dir->second.erase(name);
+                if (dir->second.empty())
+                    m_dependents.erase(dir);
+            }
+        }
+    }
+
+    /*!
+     * \brief addDependencies
+     * Watches all the directories crossed by \a path,
+     * if \a missing is true it stops at the first one which doesn't exist.
+     */
+    bool addDependencies(const std::filesystem::path &root, const std::filesystem::path &path,
+                         Dependencies &dependencies, bool missing = false)
+    {
+        auto relative = path.lexically_relative(root);
+        if (relative.empty() || *relative.begin() == "..")
+            return false;
+        auto dir = root;
+        for (const auto &name : relative) {
+            auto wd = watch(dir);
+            if (wd == -1)
+                return missing && !dependencies.empty() && (errno == ENOENT || errno == ENOTDIR);
+            dependencies.emplace_back(wd, name.string());
+            dir /= name;
+        }
+        return true;
+    }
+
+    int watch(const std::filesystem::path &dir)
+    {
+        std::unique_lock<std::mutex> lock{m_watchesMutex};
+        auto it = m_watches.find(dir.string());
+        if (it != m_watches.end())
+            return it->second;
+        auto wd = inotify_add_watch(m_inotifyFd, dir.c_str(), WatchMask);
+        if (wd == -1) {
+            if (errno != ENOENT && errno != ENOTDIR) {
+                auto error = errno;
+                WARNING(logger) << "Can't watch " << dir << " : " << strerror(error);
+                errno = error;
+            }
+            return -1;
+        }
+        m_watches[dir.string()] = wd;
+        m_watchedDirs[wd] = dir.string();
+        return wd;
+    }
+
+    void invalidate(const std::unordered_set<std::string> &keys)
+    {
+        for (const auto &key : keys) {
+            eraseEntry(key);
+            eraseMissing(key);
+        }
     }
+
+    void run()
+    {
+        alignas(inotify_event) char buffer[64 * 1024];
+        pollfd fds[2] = {{m_inotifyFd, POLLIN, 0}, {m_quitFd, POLLIN, 0}};
+        for (;;) {
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if (fds[1].revents)
+                break;
+            ssize_t size;
+            while ((size = ::read(m_inotifyFd, buffer, sizeof(buffer))) > 0) {
+                std::unique_lock<std::shared_mutex> lock{m_mutex};
+                ++m_generation;
+                for (auto ptr = buffer; ptr < buffer + size;) {
+                    auto event = reinterpret_cast<const inotify_event *>(ptr);
+                    ptr += sizeof(inotify_event) + event->len;
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        m_entries.clear();
+                        m_order.clear();
+                        m_missing.clear();
+                        m_dependents.clear();
+                        continue;
+                    }
+                    auto it = m_dependents.find(event->wd);
+                    if (it != m_dependents.end()) {
+                        // take the keys out first, invalidating them updates m_dependents
+                        if (event->len && !(event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))) {
+                            auto name = it->second.find(event->name);
+                            if (name != it->second.end()) {
+                                auto keys = std::move(name->second);
+                                it->second.erase(name);
+                                if (it->second.empty())
+                                    m_dependents.erase(it);
+                                invalidate(keys);
+                            }
+                        } else {
+                            auto names = std::move(it->second);
+                            m_dependents.erase(it);
+                            for (const auto &name : names)
+                                invalidate(name.second);
+                        }
+                    }
+                    if (event->mask & IN_IGNORED) {
+                        std::unique_lock<std::mutex> lock{m_watchesMutex};
+                        auto dir = m_watchedDirs.find(event->wd);
+                        if (dir != m_watchedDirs.end()) {
+                            m_watches.erase(dir->second);
+                            m_watchedDirs.erase(dir);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+private:
+    int m_inotifyFd = -1;
+    int m_quitFd = -1;
+    size_t m_maxEntries = 0;
+    std::thread m_thread;
+    std::atomic<uint64_t> m_generation{0};
+    mutable std::shared_mutex m_mutex;
+    std::unordered_map<std::string, Entry> m_entries;
+    // the keys of m_entries, the oldest first
+    std::list<std::string> m_order;
+    std::unordered_map<std::string, Missing> m_missing;
+    size_t m_maxMissing = 4096;
+    std::chrono::seconds m_missingTtl{60};
+    // the keys which depend on every name in every watched directory
+    std::unordered_map<int, std::unordered_map<std::string, std::unordered_set<std::string>>> m_dependents;
+    std::mutex m_watchesMutex;
+    std::unordered_map<std::string, int> m_watches;
+    std::unordered_map<int, std::string> m_watchedDirs;
+};
+ResolvedPaths s_resolvedPaths;
+
+void compressInBackground(const std::filesystem::path &path, std::filesystem::file_time_type lastWriteTime)
+{
+    if (!s_compressionWorker || !s_compressedFiles.schedule(path.string()))
+        return;
+    s_compressionWorker->insertTask([path, lastWriteTime]{
+        try {
+            auto file = mappedFile(path, lastWriteTime);
+            auto compressed = Dracon::compress({file->data(), file->size()});
+            CompressedDataPtr data;
+            // don't waste the cache on the files which don't compress well
+            if (compressed.size() < file->size() - file->size() / 10)
+                data = std::make_shared<const std::string>(std::move(compressed));
+            s_compressedFiles.put(path.string(), lastWriteTime, std::move(data));
+        } catch (const std::exception &e) {
+            WARNING(logger) << "Can't compress " << path << " : " << e.what();
+            s_compressedFiles.cancel(path.string());
+        } catch (...) {
+            s_compressedFiles.cancel(path.string());
+        }
+    });
+}
+
+// the mapped data is sent in chunks, each of them is made resident before it's written
+constexpr size_t ResidentChunkSize = 1024 * 1024;
+std::unique_ptr<Dracon::ThreadWorker> s_prefetchWorker;
+
+bool isResident(const char *data, size_t size)
+{
+    static const size_t pageSize = sysconf(_SC_PAGESIZE);
+    static thread_local std::vector<unsigned char> pages;
+    auto begin = reinterpret_cast<uintptr_t>(data) & ~(pageSize - 1);
+    auto end = reinterpret_cast<uintptr_t>(data) + size;
+    pages.resize((end - begin + pageSize - 1) / pageSize);
+    // if we can't tell, let the write fault them in
+    if (mincore(reinterpret_cast<void *>(begin), end - begin, pages.data()))
+        return true;
+    for (auto page : pages)
+        if (!(page & 1))
+            return false;
+    return true;
+}
+
+/*!
+ * \brief ensureResident
+ * Makes sure the mapped \a data is in memory before the session writes it. The pages which are
+ * not resident are faulted in by the prefetch workers while the session yields,
+ * so a slow disk read never blocks the event loop. \a owner keeps the mapping alive
+ * until the workers are done with it, even if the session is gone.
+ */
+void ensureResident(Dracon::AbstractStream& stream, const std::shared_ptr<const void> &owner, const char *data, size_t size)
+{
+    if (!s_prefetchWorker || !owner || !size || isResident(data, size))
+        return;
+    Dracon::offload(stream, *s_prefetchWorker, [owner, data, size]{
+        static const size_t pageSize = sysconf(_SC_PAGESIZE);
+        volatile char touch = 0;
+        for (size_t offset = 0; offset < size; offset += pageSize)
+            touch = data[offset];
+        touch = data[size - 1];
+        (void)touch;
+    });
+}
+
+void writeResident(Dracon::AbstractStream& stream, const std::shared_ptr<const void> &owner, Dracon::ConstBuffer buffer)
+{
+    for (size_t offset = 0; offset < buffer.length; offset += ResidentChunkSize) {
+        auto size = std::min(ResidentChunkSize, buffer.length - offset);
+        ensureResident(stream, owner, buffer.c_ptr + offset, size);
+        // the kernel reads the next chunk while this one is sent
+        if (owner && offset + size < buffer.length) {
+            static const size_t pageSize = sysconf(_SC_PAGESIZE);
+            auto next = reinterpret_cast<uintptr_t>(buffer.c_ptr + offset + size);
+            auto aligned = next & ~(pageSize - 1);
+            madvise(reinterpret_cast<void *>(aligned), std::min(ResidentChunkSize, buffer.length - offset - size) + next - aligned, MADV_WILLNEED);
+        }
+        stream.write({buffer.c_ptr + offset, size});
+    }
+}
+
+/*!
+ * \brief sendResident
+ * Sends \a res followed by the mapped \a body, unless it's a \a head request.
+ * The first chunk is made resident before the head is sent, if that fails the client gets
+ * an error response instead of a truncated body.
+ */
+void sendResident(Dracon::AbstractStream& stream, const Dracon::Response &res, const std::shared_ptr<const void> &owner,
+                  Dracon::ConstBuffer body, bool head)
+{
+    if (!head)
+        ensureResident(stream, owner, body.c_ptr, std::min(ResidentChunkSize, body.length));
+    stream << res;
     if (!head)
-        stream.write({file->data(), file->size()});
+        writeResident(stream, owner, body);
+}
+
+// If-None-Match takes precedence over If-Modified-Since
+bool notModified(const Dracon::Request &req, const std::string &etag, time_t lastModified)
+{
+    auto it = req.find("If-None-Match");
+    if (it != req.end()) {
+        for (auto tag : Dracon::split(it->second, ',')) {
+            std::string t{tag};
+            boost::trim(t);
+            if (t == "*")
+                return true;
+            // weak comparison
+            if (boost::starts_with(t, "W/"))
+                t.erase(0, 2);
+            if (t == etag)
+                return true;
+        }
+        return false;
+    }
+    it = req.find("If-Modified-Since");
+    if (it != req.end()) {
+        auto since = parseHttpDate(it->second);
+        return since != -1 && lastModified <= since;
+    }
+    return false;
+}
+
+struct ByteRange
+{
+    size_t first;
+    size_t last;
+};
+constexpr size_t MaxRanges = 16;
+
+/*!
+ * \brief parseRanges
+ * \return false if the Range header must be ignored (invalid or too many ranges),
+ * if \a ranges is empty none of them is satisfiable. The overlapping and adjacent
+ * ranges are merged, the result is sorted.
+ */
+bool parseRanges(const std::string &range, size_t size, std::vector<ByteRange> &ranges)
+{
+    if (!boost::starts_with(range, "bytes="))
+        return false;
+    auto specs = Dracon::split(std::string_view{range}.substr(6), ',');
+    if (specs.empty() || specs.size() > MaxRanges)
+        return false;
+    for (auto spec : specs) {
+        std::string s{spec};
+        boost::trim(s);
+        auto dash = s.find('-');
+        if (dash == std::string::npos)
+            return false;
+        auto firstStr = s.substr(0, dash);
+        auto lastStr = s.substr(dash + 1);
+        if ((firstStr.empty() && lastStr.empty()) ||
+                firstStr.find_first_not_of("0123456789") != std::string::npos ||
+                lastStr.find_first_not_of("0123456789") != std::string::npos)
+            return false;
+        ByteRange r;
+        try {
+            if (firstStr.empty()) {
+                // suffix range, the last n bytes
+                auto suffix = std::stoull(lastStr);
+                if (!suffix || !size)
+                    continue;
+                r.first = size - std::min<size_t>(suffix, size);
+                r.last = size - 1;
+            } else {
+                r.first = std::stoull(firstStr);
+                r.last = lastStr.empty() ? size - 1 : std::min<size_t>(std::stoull(lastStr), size - 1);
+                if (!lastStr.empty() && std::stoull(lastStr) < r.first)
+                    return false;
+                if (r.first >= size)
+                    continue;
+            }
+        } catch (const std::out_of_range &) {
+            return false;
+        }
+        ranges.push_back(r);
+    }
+
+    // coalesce the overlapping and adjacent ranges, so a few ranges can't make us send the file many times
+    std::sort(ranges.begin(), ranges.end(), [](const ByteRange &a, const ByteRange &b) {
+        return a.first < b.first;
+    });
+    size_t merged = 0;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+        if (ranges[i].first <= ranges[merged].last + 1)
+            ranges[merged].last = std::max(ranges[merged].last, ranges[i].last);
+        else
+            ranges[++merged] = ranges[i];
+    }
+    if (!ranges.empty())
+        ranges.resize(merged + 1);
+    return true;
+}
+
+void sendRanges(Dracon::AbstractStream& stream, Dracon::Response &res, const std::shared_ptr<const void> &owner,
+                std::string_view data, const std::vector<ByteRange> &ranges, bool head)
+{
+    res.setStatusCode(206);
+    if (ranges.size() == 1) {
+        const auto &r = ranges.front();
+        res["Content-Range"] = "bytes " + std::to_string(r.first) + '-' + std::to_string(r.last) + '/' + std::to_string(data.size());
+        res.setContentLength(r.last - r.first + 1);
+        sendResident(stream, res, owner, {data.data() + r.first, r.last - r.first + 1}, head);
+        return;
+    }
+
+    static std::atomic<uint64_t> s_boundary{uint64_t(time(nullptr)) << 20};
+    std::ostringstream boundaryStream;
+    boundaryStream << std::hex << std::setw(20) << std::setfill('0') << ++s_boundary;
+    const auto boundary = boundaryStream.str();
+    const auto contentType = res["Content-Type"];
+    res["Content-Type"] = "multipart/byteranges; boundary=" + boundary;
+
+    std::vector<std::string> partHeaders;
+    partHeaders.reserve(ranges.size() + 1);
+    size_t length = 0;
+    for (const auto &r : ranges) {
+        partHeaders.push_back("\r\n--" + boundary + "\r\nContent-Type: " + contentType +
+                              "\r\nContent-Range: bytes " + std::to_string(r.first) + '-' +
+                              std::to_string(r.last) + '/' + std::to_string(data.size()) + "\r\n\r\n");
+        length += partHeaders.back().size() + r.last - r.first + 1;
+    }
+    partHeaders.push_back("\r\n--" + boundary + "--\r\n");
+    length += partHeaders.back().size();
+    res.setContentLength(length);
+    if (head) {
+        stream << res;
+        return;
+    }
+    std::vector<Dracon::ConstBuffer> buffers;
+    buffers.reserve(ranges.size() * 2 + 1);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        ensureResident(stream, owner, data.data() + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+        buffers.emplace_back(partHeaders[i]);
+        buffers.emplace_back(data.data() + ranges[i].first, ranges[i].last - ranges[i].first + 1);
+    }
+    buffers.emplace_back(partHeaders.back());
+    // all the parts are resident before anything is sent
+    stream << res;
+    stream.write(std::move(buffers));
+}
+
+/*!
+ * \brief sendRequestedRanges
+ * Sends the \a range parts of \a data, \a res must have the ETag and the Last-Modified fields set.
+ * \return false if the Range header must be ignored and the whole \a data sent
+ */
+bool sendRequestedRanges(Dracon::AbstractStream& stream, const Dracon::Request &req, Dracon::Response &res,
+                         const std::string &range, const std::shared_ptr<const void> &owner, std::string_view data, bool head)
+{
+    // If-Range with a different validator asks for the whole (changed) file
+    auto ifRange = req.find("If-Range");
+    if (ifRange != req.end() && ifRange->second != res["ETag"] && ifRange->second != res["Last-Modified"])
+        return false;
+    std::vector<ByteRange> ranges;
+    if (!parseRanges(range, data.size(), ranges))
+        return false;
+    if (ranges.empty()) {
+        res["Content-Range"] = "bytes */" + std::to_string(data.size());
+        res.erase("Content-Type");
+        stream << res.setStatusCode(416);
+        return true;
+    }
+    sendRanges(stream, res, owner, data, ranges, head);
+    return true;
+}
+
+/*!
+ * \brief The SmallFile struct
+ *
+ * A small file kept in memory with its serialized response head, everything except
+ * the keep-alive headers, which depend on the connection.
+ */
+struct SmallFile
+{
+    ResolvedPath resolved;
+    std::string head;
+    std::string body;
+};
+using SmallFilePtr = std::shared_ptr<const SmallFile>;
+std::unique_ptr<Dracon::ShardedCache<std::string, SmallFilePtr>> s_smallFiles;
+size_t s_smallFileMaxSize = 16 * 1024;
+
+std::string responseHead(const Dracon::Response &res)
+{
+    std::string head{"HTTP/1.1 "};
+    head += Dracon::statusCodeString(res.statusCode());
+    for (const auto &kv : res) {
+        head += kv.first;
+        head += ": ";
+        head += kv.second;
+        head += Dracon::CrlfString;
+    }
+    head += "Content-Length: ";
+    head += std::to_string(res.contentLength());
+    head += Dracon::CrlfString;
+    return head;
+}
+
+// The same keep-alive headers as Dracon::Response::toString
+const std::string &keepAliveHeaders(std::chrono::seconds keepAlive)
+{
+    static thread_local std::unordered_map<std::chrono::seconds::rep, std::string> headers;
+    auto &res = headers[std::max<std::chrono::seconds::rep>(keepAlive.count(), 0)];
+    if (res.empty()) {
+        if (keepAlive.count() > 0)
+            res = "Keep-Alive: timeout=" + std::to_string(keepAlive.count()) + "\r\nConnection: keep-alive\r\n\r\n";
+        else
+            res = "Connection: close\r\n\r\n";
+    }
+    return res;
+}
+
+void static_content_session(const std::filesystem::path &root, const std::filesystem::path &path, bool head, Dracon::AbstractStream& stream, Dracon::Request& req)
+{
+    stream >> req;
+    auto key = root.string();
+    key += '\0';
+    key += path.string();
+    auto resolved = s_resolvedPaths.value(key);
+    if (!resolved)
+        resolved = s_resolvedPaths.resolve(root, path, key);
+    if (resolved->missing) {
+        static const Dracon::Response notFound{404};
+        stream << notFound;
+        return;
+    }
+    const auto &p = resolved->path;
+    const auto lastWriteTime = resolved->lastWriteTime;
+    TRACE(logger) << "Serving " << p.string();
+
+    // the small files hits are sent with a single writev
+    std::string smallFileKey;
+    if (s_smallFiles && req.find("Range") == req.end() && req.find("If-None-Match") == req.end() &&
+            req.find("If-Modified-Since") == req.end()) {
+        smallFileKey = p.string();
+        if (s_compression && Dracon::acceptsEncoding(req, Dracon::ContentEncoding::Gzip))
+            smallFileKey.append("\0gzip", 5);
+        auto smallFile = s_smallFiles->value(smallFileKey);
+        if (smallFile && smallFile->resolved == *resolved) {
+            using namespace std::chrono_literals;
+            stream.setSessionTimeout(std::max<std::chrono::seconds>(stream.sessionTimeout(), 10s));
+            if (head)
+                stream.write({smallFile->head, keepAliveHeaders(stream.keepAlive())});
+            else
+                stream.write({smallFile->head, keepAliveHeaders(stream.keepAlive()), smallFile->body});
+            return;
+        }
+    }
+
+    auto file = mappedFile(p, lastWriteTime);
+
+    Dracon::ConstBuffer body{file->data(), file->size()};
+    // the mapping of the body, the compressed data is always in memory
+    std::shared_ptr<const void> bodyMapping = file;
+    // keep the compressed data alive until it's sent
+    FileMapPtr gzFile;
+    CompressedDataPtr compressed;
+
+    Dracon::Response res{200};
+    static_cast<Dracon::Fields&>(res) = s_customFields;
+    auto contentType = mimeType(p.extension().string());
+    auto etag = file->etag();
+    auto range = req.find("Range");
+    if (s_compression && file->size() >= s_compressionMinSize && Dracon::isCompressibleType(contentType)) {
+        // the response depends on Accept-Encoding, even if this one is not compressed
+        res["Vary"] = "Accept-Encoding";
+        // the ranges are served only from the identity representation
+        if (range == req.end() && Dracon::acceptsEncoding(req, Dracon::ContentEncoding::Gzip)) {
+            if ((gzFile = gzipSibling(*resolved))) {
+                body = {gzFile->data(), gzFile->size()};
+                bodyMapping = gzFile;
+                res["Content-Encoding"] = "gzip";
+            } else if (s_compressedFiles.value(p.string(), lastWriteTime, compressed)) {
+                if (compressed) {
+                    body = *compressed;
+                    bodyMapping.reset();
+                    res["Content-Encoding"] = "gzip";
+                }
+            } else if (file->size() <= s_compressionMaxFileSize) {
+                // this one goes out as it is, the next ones will be compressed
+                compressInBackground(p, lastWriteTime);
+                smallFileKey.clear();
+            }
+            // every representation has its own ETag
+            if (res.find("Content-Encoding") != res.end())
+                etag.insert(etag.size() - 1, "-gzip");
+        }
+    }
+    res["ETag"] = etag;
+    res["Last-Modified"] = file->lastModified();
+    if (notModified(req, etag, file->lastModifiedTime())) {
+        res.erase("Content-Encoding");
+        stream << res.setStatusCode(304);
+        return;
+    }
+    res["Content-Type"] = std::string{contentType};
+
+    if (range != req.end() && res.find("Content-Encoding") == res.end()) {
+        res["Accept-Ranges"] = "bytes";
+        if (sendRequestedRanges(stream, req, res, range->second, file, {file->data(), file->size()}, head))
+            return;
+    } else if (res.find("Content-Encoding") == res.end()) {
+        res["Accept-Ranges"] = "bytes";
+    }
+
+    res.setContentLength(body.length);
+    if (!smallFileKey.empty() && body.length <= s_smallFileMaxSize) {
+        auto smallFile = std::make_shared<SmallFile>();
+        smallFile->resolved = *resolved;
+        smallFile->head = responseHead(res);
+        ensureResident(stream, bodyMapping, body.c_ptr, body.length);
+        smallFile->body.assign(body.c_ptr, body.length);
+        auto cost = sizeof(SmallFile) + smallFileKey.size() + smallFile->head.size() + body.length;
+        s_smallFiles->put(smallFileKey, std::move(smallFile), cost);
+    }
+    sendResident(stream, res, bodyMapping, body, head);
+}
+
+/*!
+ * \brief The MountedBundle struct
+ *
+ * A bundle served under \a prefix. The mapping is replaced as a whole when the bundle file changes,
+ * the sessions which still use the old one keep it alive until they are done.
+ */
+using MappedBundlePtr = std::shared_ptr<const StaticContent::MappedBundle>;
+struct MountedBundle
+{
+    std::string prefix;
+    std::string path;
+    MappedBundlePtr bundle;
+};
+std::vector<MountedBundle> s_bundles;
+std::unique_ptr<Dracon::SimpleTimer> s_bundlesWatcher;
+
+void reloadChangedBundles()
+{
+    for (auto &mounted : s_bundles) {
+        struct stat st;
+        auto current = std::atomic_load(&mounted.bundle);
+        if (::stat(mounted.path.c_str(), &st) || !current->changed(st))
+            continue;
+        try {
+            std::atomic_store(&mounted.bundle, MappedBundlePtr{std::make_shared<StaticContent::MappedBundle>(mounted.path)});
+            INFO(logger) << "Reloaded " << mounted.path;
+        } catch (const std::exception &e) {
+            // keep serving the old one, the broken file is checked again next time
+            WARNING(logger) << "Can't reload " << mounted.path << " : " << e.what();
+        }
+    }
+}
+
+void bundle_session(const MappedBundlePtr &bundle, const StaticContent::Bundle::Entry *entry, bool head,
+                    Dracon::AbstractStream& stream, Dracon::Request& req)
+{
+    stream >> req;
+    auto data = bundle->view(entry->data);
+    auto body = data;
+    Dracon::Response res{200};
+    static_cast<Dracon::Fields&>(res) = s_customFields;
+    std::string etag{bundle->view(entry->etag)};
+    auto range = req.find("Range");
+    if (entry->gzip.size) {
+        res["Vary"] = "Accept-Encoding";
+        // the ranges are served only from the identity representation
+        if (range == req.end() && Dracon::acceptsEncoding(req, Dracon::ContentEncoding::Gzip)) {
+            body = bundle->view(entry->gzip);
+            res["Content-Encoding"] = "gzip";
+            etag.insert(etag.size() - 1, "-gzip");
+        }
+    }
+    res["ETag"] = etag;
+    res["Last-Modified"] = httpDate(entry->lastModified);
+    if (notModified(req, etag, entry->lastModified)) {
+        res.erase("Content-Encoding");
+        stream << res.setStatusCode(304);
+        return;
+    }
+    res["Content-Type"] = std::string{bundle->view(entry->mimeType)};
+    if (res.find("Content-Encoding") == res.end()) {
+        res["Accept-Ranges"] = "bytes";
+        if (range != req.end() && sendRequestedRanges(stream, req, res, range->second, bundle, data, head))
+            return;
+    }
+    res.setContentLength(body.size());
+    sendResident(stream, res, bundle, {body.data(), body.size()}, head);
+}
+
+/*!
+ * \brief bundleSession
+ * \return a session if \a url is in one of the bundles, the other ones go to the files
+ */
+Dracon::HttpSession bundleSession(const std::string &url, bool head)
+{
+    for (const auto &mounted : s_bundles) {
+        if (!boost::starts_with(url, mounted.prefix))
+            continue;
+        auto path = url.substr(mounted.prefix.size());
+        path = path.substr(0, path.find('?'));
+        auto relative = std::filesystem::path{Dracon::unescapeUrl(path)}.lexically_normal().generic_string();
+        if (boost::starts_with(relative, "..") || boost::starts_with(relative, "/"))
+            return {};
+        if (relative == ".")
+            relative.clear();
+        if (relative.empty() || relative.back() == '/')
+            relative += s_default_file;
+        auto bundle = std::atomic_load(&mounted.bundle);
+        if (auto entry = bundle->find(relative))
+            return std::bind<void>(bundle_session, bundle, entry, head, std::placeholders::_1, std::placeholders::_2);
+        return {};
+    }
+    return {};
 }
 
 } // namespace
@@ -128,7 +1161,15 @@ PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req) {
     if (req.method() != "GET" && req.method() != "HEAD")
         return {};
     auto &url = req.url();
-    for (const auto &pair : s_urls) {
+    if (auto session = bundleSession(url, req.method() == "HEAD"))
+        return session;
+    const Urls *urls = &s_urls;
+    if (!req.virtualHost().empty()) {
+        auto it = s_virtualHostsUrls.find(req.virtualHost());
+        if (it != s_virtualHostsUrls.end())
+            urls = &it->second;
+    }
+    for (const auto &pair : *urls) {
         if (boost::starts_with(url, pair.first)) {
             if (boost::starts_with(pair.first, "/~")) {
                 auto pos = url.find('/', 1);
@@ -165,7 +1206,6 @@ PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req) {
 
 PLUGIN_EXPORT bool init_plugin(const std::string &confDir)
 {
-    using namespace std::chrono_literals;
     INFO(logger) << "Initializing plugin";
     namespace pt = boost::property_tree;
     pt::ptree properties;
@@ -174,6 +1214,15 @@ PLUGIN_EXPORT bool init_plugin(const std::string &confDir)
         DEBUG(logger) << "Mapping \"" << p.first << "\" to \"" << p.second.get_value<std::string>() << "\"";
         s_urls.emplace_back(std::make_pair(p.first, p.second.get_value<std::string>()));
     }
+    if (auto virtualHosts = properties.get_child_optional("virtual_hosts")) {
+        for (const auto &host : *virtualHosts) {
+            auto &urls = s_virtualHostsUrls[boost::to_lower_copy(host.first)];
+            for (const auto &p : host.second) {
+                DEBUG(logger) << host.first << ": mapping \"" << p.first << "\" to \"" << p.second.get_value<std::string>() << "\"";
+                urls.emplace_back(std::make_pair(p.first, p.second.get_value<std::string>()));
+            }
+        }
+    }
 
     for (const auto &p : properties.get_child("custom_headers")) {
         DEBUG(logger) << "Custom header " << p.first << " : " << p.second.get_value<std::string>();
@@ -181,17 +1230,49 @@ PLUGIN_EXPORT bool init_plugin(const std::string &confDir)
     }
 
     s_default_file = properties.get("default_file", "");
+    if (auto bundles = properties.get_child_optional("bundles")) {
+        for (const auto &p : *bundles) {
+            auto path = p.second.get_value<std::string>();
+            DEBUG(logger) << "Mapping \"" << p.first << "\" to the \"" << path << "\" bundle";
+            s_bundles.push_back({p.first, path, std::make_shared<StaticContent::MappedBundle>(path)});
+        }
+        // the bundles are replaced by renaming the new file over the old one
+        if (!s_bundles.empty()) {
+            auto interval = properties.get<int>("bundle_check_interval", 5);
+            if (interval > 0)
+                s_bundlesWatcher = std::make_unique<Dracon::SimpleTimer>(reloadChangedBundles, std::chrono::seconds{interval});
+        }
+    }
     s_allow_symlinks = properties.get("allow_symlinks", false);
-    g_timer = std::make_unique<Dracon::SimpleTimer>([]{
-        std::unique_lock<std::mutex> lock(s_filesCacheMutex);
-        for (auto it = s_filesCache.begin(); it != s_filesCache.end();) {
-            if (it->second.use_count() == 1)
-                it = s_filesCache.erase(it);
-            else
-                ++it;
+    s_compression = properties.get("compression.enabled", true);
+    if (s_compression) {
+        s_compressionMinSize = properties.get("compression.min_size", Dracon::DefaultCompressionThreshold);
+        s_compressionMaxFileSize = properties.get("compression.max_file_size", s_compressionMaxFileSize);
+        s_compressedFiles.setBudget(properties.get("compression.cache_size", s_compressedFiles.budget()));
+        if (s_compressedFiles.budget())
+            s_compressionWorker = std::make_unique<Dracon::ThreadWorker>();
+    }
+    s_resolvedPaths.setMissingLimits(properties.get<size_t>("resolved_paths.max_missing", 4096),
+                                     std::chrono::seconds{properties.get<int>("resolved_paths.missing_ttl", 60)});
+    if (properties.get("resolved_paths.watch", true) &&
+            !s_resolvedPaths.start(properties.get<size_t>("resolved_paths.max_entries", 65536)))
+        WARNING(logger) << "Can't watch the files, the paths are resolved on every request";
+    s_smallFileMaxSize = properties.get("small_files.max_size", s_smallFileMaxSize);
+    if (auto size = properties.get<size_t>("small_files.cache_size", 16 * 1024 * 1024)) {
+        s_smallFiles = std::make_unique<Dracon::ShardedCache<std::string, SmallFilePtr>>(size);
+        // a bigger file would never be cached
+        if (s_smallFileMaxSize >= s_smallFiles->maxCost()) {
+            s_smallFileMaxSize = s_smallFiles->maxCost() / 2;
+            WARNING(logger) << "small_files.cache_size is too small, small_files.max_size is limited to " << s_smallFileMaxSize;
         }
-    }, 60s);
-    return !s_urls.empty();
+    }
+    if (properties.get("async_reads.enabled", true))
+        s_prefetchWorker = std::make_unique<Dracon::ThreadWorker>(properties.get<uint32_t>("async_reads.threads", 4));
+    s_filesCache = std::make_unique<Dracon::ShardedCache<std::string, FileMapPtr>>(
+                properties.get<size_t>("files_cache.size", 256 * 1024 * 1024),
+                properties.get<size_t>("files_cache.shards", 16));
+    INFO(logger) << "The files bigger than " << s_filesCache->maxCost() << " bytes are mapped on every request";
+    return !s_urls.empty() || !s_virtualHostsUrls.empty() || !s_bundles.empty();
 }
 
 PLUGIN_EXPORT uint32_t plugin_order()
@@ -199,7 +1280,29 @@ PLUGIN_EXPORT uint32_t plugin_order()
     return UINT32_MAX;
 }
 
+PLUGIN_EXPORT Dracon::PluginRoutes plugin_routes()
+{
+    Dracon::PluginRoutes routes;
+    for (const auto &mounted : s_bundles)
+        routes.push_back({mounted.prefix, {"GET", "HEAD"}});
+    for (const auto &pair : s_urls)
+        routes.push_back({pair.first, {"GET", "HEAD"}});
+    for (const auto &host : s_virtualHostsUrls) {
+        for (const auto &pair : host.second)
+            routes.push_back({pair.first, {"GET", "HEAD"}, {host.first}});
+    }
+    return routes;
+}
+
 PLUGIN_EXPORT void destory_plugin()
 {
-    g_timer.reset();
+    s_bundlesWatcher.reset();
+    s_bundles.clear();
+    s_resolvedPaths.stop();
+    s_compressionWorker.reset();
+    s_prefetchWorker.reset();
+    s_smallFiles.reset();
+    s_filesCache.reset();
 }
+
+DRACON_REGISTER_PLUGIN(staticContent, init_plugin, create_session, plugin_order, destory_plugin, plugin_routes);
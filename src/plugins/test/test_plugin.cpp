@@ -15,15 +15,23 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <dracon/compression.h>
 #include <dracon/http.h>
 #include <dracon/logging.h>
 #include <dracon/plugin.h>
 #include <dracon/restful.h>
 #include <dracon/thread_worker.h>
 
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
 #include <cassert>
 #include <iostream>
 #include <mutex>
+#include <thread>
 
 using namespace std::chrono_literals;
 
@@ -34,9 +42,74 @@ std::string test50mresponse;
 
 Dracon::RESTfulRouterType s_testRootRestful("/test/rest/v1/");
 Dracon::ThreadWorker s_threadWorker{10};
+std::atomic<uint32_t> s_eventLoops{0};
+const DraconServer *s_server = nullptr;
 
 TaggedLogger<> logger{"test"};
 
+/*!
+ * \brief The RelayPeer class
+ *
+ * A socket pair watched by the \a stream. The other end reads \a length bytes then it sends back the
+ * first \a replySize of them. If it sends them all, it appends some extra bytes
+ * which must not reach the client.
+ */
+class RelayPeer
+{
+public:
+    RelayPeer(Dracon::AbstractStream &stream, size_t length, size_t replySize)
+        : m_stream(stream)
+    {
+        if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, m_fds))
+            throw std::make_error_code(std::errc(errno));
+        ::fcntl(m_fds[0], F_SETFL, ::fcntl(m_fds[0], F_GETFL) | O_NONBLOCK);
+        try {
+            m_stream.watchDescriptor(m_fds[0], EPOLLIN | EPOLLOUT);
+        } catch (...) {
+            ::close(m_fds[0]);
+            ::close(m_fds[1]);
+            throw;
+        }
+        m_thread = std::thread{[fd = m_fds[1], length, replySize]{
+            std::string data(length, '\0');
+            size_t size = 0;
+            while (size < length) {
+                auto sz = ::read(fd, data.data() + size, length - size);
+                if (sz <= 0)
+                    break;
+                size += sz;
+            }
+            if (replySize >= size) {
+                data.resize(size);
+                data.append("EXTRA");
+            } else {
+                data.resize(replySize);
+            }
+            for (size_t pos = 0; pos < data.size();) {
+                auto sz = ::send(fd, data.data() + pos, data.size() - pos, MSG_NOSIGNAL);
+                if (sz <= 0)
+                    break;
+                pos += sz;
+            }
+            ::close(fd);
+        }};
+    }
+
+    ~RelayPeer()
+    {
+        m_stream.unwatchDescriptor(m_fds[0]);
+        ::close(m_fds[0]);
+        m_thread.join();
+    }
+
+    int fd() const { return m_fds[0]; }
+
+private:
+    Dracon::AbstractStream &m_stream;
+    int m_fds[2];
+    std::thread m_thread;
+};
+
 void TestRESTGET(const Dracon::ParsedRoute& parsed_route, Dracon::AbstractStream& stream, Dracon::Request& req){
     stream >> req;
     stream << Dracon::Response{200, {}, {{"Content-Type","text/plain"}}}.setContentLength(Dracon::ChunkedData);
@@ -54,12 +127,16 @@ void TestRESTGET(const Dracon::ParsedRoute& parsed_route, Dracon::AbstractStream
     }
 }
 
-} // namespace
-
-PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
+Dracon::HttpSession createSession(const Dracon::Request &req)
 {
     using namespace Dracon::Literals;
     auto &url = req.url();
+    if (url == "/testEventLoops")
+        return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
+            stream >> req;
+            auto loops = std::to_string(s_eventLoops);
+            stream << Dracon::Response{200, loops};
+        };
     if (url == "/test0")
         return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
             stream >> req;
@@ -100,33 +177,44 @@ PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
             } while (pos < test50mresponse.size());
         };
 
+    if (url == "/testCompression")
+        return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
+            stream >> req;
+            static const std::string body = []{
+                std::string res;
+                for (int i = 0; i < 10000; ++i)
+                    res += "Compress me " + std::to_string(i) + "\n";
+                return res;
+            }();
+            Dracon::Response res{200, {}, {{"Content-Type", "text/plain"}}};
+            auto encoding = Dracon::prepareCompression(req, res, body.size());
+            if (encoding == Dracon::ContentEncoding::Identity) {
+                stream << res.setBody(body);
+                return;
+            }
+            stream << res;
+            Dracon::ChunkedStream chunkedStream{stream};
+            Dracon::CompressedStream{chunkedStream, encoding}.write(body);
+        };
+
     if (url == "/testWorker")
         return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
             stream >> req;
             stream << Dracon::Response{200}.setContentLength(Dracon::ChunkedData);
-            auto wakeupper = stream.wakeupper();
-            auto wait = std::make_shared<std::atomic_bool>();
-            auto buffer = std::make_shared<std::string>();
             uint32_t size = 0;
             Dracon::ChunkedStream chuncked_stream{stream};
             do {
-                wait->store(true);
-                s_threadWorker.insertTask([=]{
+                auto buffer = Dracon::offload(stream, s_threadWorker, []{
                     // simulate some heavy work
                     std::this_thread::sleep_for(15ms);
                     uint32_t chunkSize = 1000 + (rand() % 4) * 1000;
-                    buffer->resize(chunkSize);
+                    std::string buffer(chunkSize, '\0');
                     for (uint32_t i = 0; i < chunkSize; ++i)
-                        (*buffer)[i] = '0' + i % 10;
-                    wait->store(false);
-                    wakeupper->wakeup();
+                        buffer[i] = '0' + i % 10;
+                    return buffer;
                 });
-                do {
-                    if (auto ec = stream.yield())
-                        throw ec;
-                } while (wait->load());
-                chuncked_stream << *buffer;
-                size += buffer->size();
+                chuncked_stream << buffer;
+                size += buffer.size();
             } while (size < 100000);
         };
 
@@ -167,6 +255,19 @@ PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
             res << "~~~~ Body:\n" << body;
         };
 
+    if (url == "/testPeerAddress")
+        return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
+            stream >> req;
+            stream << Dracon::Response{200, stream.peerAddress()};
+        };
+
+    if (url == "/testPeerCredentials")
+        return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
+            stream >> req;
+            auto credentials = stream.peerCredentials();
+            stream << Dracon::Response{200, credentials ? "uid:" + std::to_string(credentials->uid) : std::string{"none"}};
+        };
+
     if (url == "/secureOnly")
         return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
             if (!stream.isSecuredConnection())
@@ -227,21 +328,34 @@ PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
     if (url == "/testThrowAfterWakeup")
         return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
             stream >> req;
-
-            auto wakeupper = stream.wakeupper();
-            auto wait = std::make_shared<std::atomic_bool>();
-            wait->store(true);
-            s_threadWorker.insertTask([=]{
+            Dracon::offload(stream, s_threadWorker, []{
                 // simulate some heavy work
                 std::this_thread::sleep_for(100ms);
-                wait->store(false);
-                wakeupper->wakeup();
+                throw 404;
             });
-            do {
-                if (auto ec = stream.yield())
-                    throw ec;
-            } while (wait->load());
-            throw 404;
+        };
+
+    // relays the body to a peer socket which sends it back,
+    // X-Reply-Size makes the peer close earlier
+    if (url == "/testRelay")
+        return [&](Dracon::AbstractStream& stream, Dracon::Request& req){
+            const size_t length = req.contentLength();
+            if (length == Dracon::ChunkedData)
+                throw 411;
+            size_t replySize = length;
+            if (!req["X-Reply-Size"].empty())
+                replySize = std::strtoull(req["X-Reply-Size"].data(), nullptr, 10);
+            if (req["Expect"] == "100-continue")
+                stream << Dracon::Response{100};
+            RelayPeer peer{stream, length, replySize};
+            if (stream.relay(peer.fd(), Dracon::RelayDirection::FromStream, length) != length)
+                throw std::make_error_code(std::errc::connection_aborted);
+            req.setState(Dracon::Request::State::Completed);
+            stream << Dracon::Response{200}.setContentLength(length);
+            auto relayed = stream.relay(peer.fd(), Dracon::RelayDirection::ToStream, length);
+            // fill what the peer didn't send
+            if (relayed < length)
+                stream << std::string(length - relayed, '.');
         };
 
     // PPP stands for post, put, patch
@@ -262,7 +376,7 @@ PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
     return s_testRootRestful.createHandler(url, req.method());
 }
 
-PLUGIN_EXPORT bool init_plugin(const std::string &/*confDir*/)
+int initPlugin(void */*context*/, const char */*confDir*/)
 {
     for (int i = 0; i < 50 * 1024 * 1024; ++i)
         test50mresponse += char(33 + (i % 93));
@@ -277,10 +391,61 @@ PLUGIN_EXPORT bool init_plugin(const std::string &/*confDir*/)
     return true;
 }
 
-PLUGIN_EXPORT uint32_t plugin_order()
+void initLoop(void */*context*/, uint32_t /*loop*/)
+{
+    ++s_eventLoops;
+}
+
+void *createHandler(void */*context*/, const DraconRequest *request, void *storage)
+{
+    auto url = s_server->requestUrl(request);
+    if (std::string_view{url.data, url.size} == "/testCApi") {
+        // read through the server functions, like a C plugin does
+        auto method = s_server->requestMethod(request);
+        auto header = s_server->requestHeader(request, "X-Test");
+        std::string reply{method.data, method.size};
+        reply.append(" ").append(url.data, url.size).append(" ");
+        reply.append(header.data ? std::string_view{header.data, header.size} : std::string_view{"none"});
+        return Dracon::PluginHandler<Dracon::HttpSession>::construct(storage, [reply](Dracon::AbstractStream &stream, Dracon::Request &req) {
+            stream >> req;
+            stream << Dracon::Response{200, reply};
+        });
+    }
+    auto session = createSession(Dracon::request(request));
+    if (!session)
+        return nullptr;
+    return Dracon::PluginHandler<Dracon::HttpSession>::construct(storage, std::move(session));
+}
+
+const char *const s_getOnly[] = {"GET", nullptr};
+const DraconRoute s_routes[] = {
+    {"/test", nullptr, nullptr},
+    {"/echoTest", nullptr, nullptr},
+    {"/secureOnly", s_getOnly, nullptr},
+    {nullptr, nullptr, nullptr}
+};
+
+} // namespace
+
+// The test plugin uses the ABI v2, the other plugins the ABI v1 adapter
+PLUGIN_EXPORT const DraconPlugin *dracon_plugin(const DraconServer *server)
 {
-    return 9999999;
+    s_server = server;
+    static const DraconPlugin plugin = {
+        DRACON_PLUGIN_ABI_VERSION, sizeof(DraconPlugin),
+        DRACON_PLUGIN_STREAMING_BODY | DRACON_PLUGIN_ASYNC | DRACON_PLUGIN_PER_LOOP_INIT,
+        9999999,
+        sizeof(Dracon::HttpSession), alignof(Dracon::HttpSession),
+        nullptr,
+        initPlugin,
+        initLoop,
+        createHandler,
+        Dracon::PluginHandler<Dracon::HttpSession>::run,
+        Dracon::PluginHandler<Dracon::HttpSession>::destroy,
+        nullptr,
+        s_routes
+    };
+    return &plugin;
 }
 
-PLUGIN_EXPORT void destory_plugin()
-{}
+DRACON_REGISTER_PLUGIN_V2(serverTestsPlugin, dracon_plugin);
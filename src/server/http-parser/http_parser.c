@@ -0,0 +1,617 @@
+/* Local stand-in for nodejs/http-parser (API compatible subset), used only to build & run tests. */
+#include "http_parser.h"
+#include <string.h>
+#include <ctype.h>
+
+enum state {
+  s_dead = 1, s_start, s_method, s_url, s_req_version, s_req_lf,
+  s_res_version, s_res_status, s_res_reason, s_res_lf,
+  s_header_start, s_headers_lf, s_field, s_value_start, s_value, s_value_lf,
+  s_body_identity, s_body_eof,
+  s_chunk_size, s_chunk_ext, s_chunk_size_lf, s_chunk_data, s_chunk_data_cr, s_chunk_data_lf,
+  s_trailer_start, s_trailer, s_trailer_lf, s_trailers_end_lf
+};
+
+enum flags {
+  F_CHUNKED = 1, F_CONNECTION_KEEP_ALIVE = 2, F_CONNECTION_CLOSE = 4, F_CONNECTION_UPGRADE = 8,
+  F_TRAILING = 16, F_UPGRADE = 32, F_SKIPBODY = 64, F_CONTENTLENGTH = 128
+};
+
+enum header_kind { h_general, h_content_length, h_transfer_encoding, h_connection, h_upgrade };
+
+static const char *method_strings[] = {
+#define XX(num, name, string) #string,
+  HTTP_METHOD_MAP(XX)
+#undef XX
+};
+
+static const struct { const char *name; const char *description; } errno_tab[] = {
+#define XX(n, s) { "HPE_" #n, s },
+  HTTP_ERRNO_MAP(XX)
+#undef XX
+};
+
+void http_parser_init(http_parser *parser, enum http_parser_type type)
+{
+  void *data = parser->data;
+  memset(parser, 0, sizeof(*parser));
+  parser->data = data;
+  parser->type = type;
+  parser->state = s_start;
+  parser->content_length = UINT64_MAX;
+}
+
+void http_parser_settings_init(http_parser_settings *settings)
+{
+  memset(settings, 0, sizeof(*settings));
+}
+
+const char *http_method_str(enum http_method m)
+{
+  if ((unsigned)m < sizeof(method_strings) / sizeof(method_strings[0]))
+    return method_strings[m];
+  return "<unknown>";
+}
+
+const char *http_errno_name(enum http_errno err) { return errno_tab[err].name; }
+const char *http_errno_description(enum http_errno err) { return errno_tab[err].description; }
+
+static int message_needs_eof(const http_parser *parser)
+{
+  if (parser->type == HTTP_REQUEST)
+    return 0;
+  if (parser->status_code / 100 == 1 || parser->status_code == 204 || parser->status_code == 304 ||
+      (parser->flags & F_SKIPBODY))
+    return 0;
+  if ((parser->flags & F_CHUNKED) || parser->content_length != UINT64_MAX)
+    return 0;
+  return 1;
+}
+
+int http_should_keep_alive(const http_parser *parser)
+{
+  if (parser->http_major > 0 && parser->http_minor > 0) {
+    if (parser->flags & F_CONNECTION_CLOSE)
+      return 0;
+  } else {
+    if (!(parser->flags & F_CONNECTION_KEEP_ALIVE))
+      return 0;
+  }
+  return !message_needs_eof(parser);
+}
+
+int http_body_is_final(const http_parser *parser)
+{
+  return parser->state == s_start || parser->state == s_dead;
+}
+
+static int ieq(const char *a, unsigned alen, const char *b)
+{
+  size_t blen = strlen(b);
+  if (alen != blen)
+    return 0;
+  for (size_t i = 0; i < blen; ++i)
+    if (tolower((unsigned char)a[i]) != b[i])
+      return 0;
+  return 1;
+}
+
+static int contains_token(const char *value, unsigned len, const char *token)
+{
+  /* comma separated, case insensitive */
+  unsigned i = 0;
+  while (i < len) {
+    while (i < len && (value[i] == ' ' || value[i] == '\t' || value[i] == ','))
+      ++i;
+    unsigned start = i;
+    while (i < len && value[i] != ',')
+      ++i;
+    unsigned end = i;
+    while (end > start && (value[end - 1] == ' ' || value[end - 1] == '\t'))
+      --end;
+    if (ieq(value + start, end - start, token))
+      return 1;
+  }
+  return 0;
+}
+
+#define SET_ERRNO(e) do { parser->http_errno = (e); } while (0)
+
+#define CALLBACK_NOTIFY(name) \
+  do { \
+    if (settings->on_##name && settings->on_##name(parser) != 0) { \
+      SET_ERRNO(HPE_CB_##name); \
+      return p - data; \
+    } \
+  } while (0)
+
+#define CALLBACK_DATA(name, from, to) \
+  do { \
+    if ((from) && settings->on_##name && (to) > (from)) { \
+      if (settings->on_##name(parser, (from), (to) - (from)) != 0) { \
+        SET_ERRNO(HPE_CB_##name); \
+        return p - data; \
+      } \
+    } \
+  } while (0)
+
+static void finish_header(http_parser *parser)
+{
+  const char *v = parser->value;
+  unsigned len = parser->value_len;
+  switch (parser->header_kind) {
+  case h_content_length: {
+    uint64_t cl = 0;
+    for (unsigned i = 0; i < len; ++i) {
+      if (v[i] == ' ' || v[i] == '\t')
+        continue;
+      if (v[i] < '0' || v[i] > '9') {
+        parser->http_errno = HPE_INVALID_CONTENT_LENGTH;
+        return;
+      }
+      cl = cl * 10 + (v[i] - '0');
+    }
+    if (parser->flags & F_CONTENTLENGTH) {
+      parser->http_errno = HPE_UNEXPECTED_CONTENT_LENGTH;
+      return;
+    }
+    parser->flags |= F_CONTENTLENGTH;
+    parser->content_length = cl;
+    break;
+  }
+  case h_transfer_encoding:
+    if (contains_token(v, len, "chunked"))
+      parser->flags |= F_CHUNKED;
+    break;
+  case h_connection:
+    if (contains_token(v, len, "close"))
+      parser->flags |= F_CONNECTION_CLOSE;
+    if (contains_token(v, len, "keep-alive"))
+      parser->flags |= F_CONNECTION_KEEP_ALIVE;
+    if (contains_token(v, len, "upgrade"))
+      parser->flags |= F_CONNECTION_UPGRADE;
+    break;
+  case h_upgrade:
+    parser->flags |= F_UPGRADE;
+    break;
+  }
+}
+
+static int hexval(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  c = (char)tolower((unsigned char)c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  return -1;
+}
+
+size_t http_parser_execute(http_parser *parser, const http_parser_settings *settings, const char *data, size_t len)
+{
+  const char *p = data;
+  const char *end = data + len;
+  const char *url_mark = NULL, *field_mark = NULL, *value_mark = NULL, *body_mark = NULL;
+
+  if (parser->http_errno != HPE_OK)
+    return 0;
+
+  if (len == 0) {
+    switch (parser->state) {
+    case s_body_eof:
+      parser->state = s_dead;
+      CALLBACK_NOTIFY(message_complete);
+      return 0;
+    case s_dead:
+    case s_start:
+      return 0;
+    default:
+      SET_ERRNO(HPE_INVALID_EOF_STATE);
+      return 1;
+    }
+  }
+
+  if (parser->state == s_url) url_mark = data;
+  if (parser->state == s_field) field_mark = data;
+  if (parser->state == s_value) value_mark = data;
+
+  for (; p < end; ++p) {
+    char ch = *p;
+    if (parser->state != s_dead && parser->state <= s_value_lf) {
+      if (++parser->nread > HTTP_MAX_HEADER_SIZE) {
+        SET_ERRNO(HPE_HEADER_OVERFLOW);
+        return p - data;
+      }
+    }
+reexecute:
+    switch (parser->state) {
+    case s_dead:
+      if (ch == '\r' || ch == '\n')
+        break;
+      SET_ERRNO(HPE_CLOSED_CONNECTION);
+      return p - data;
+
+    case s_start:
+      if (ch == '\r' || ch == '\n')
+        break;
+      parser->flags = 0;
+      parser->content_length = UINT64_MAX;
+      parser->nread = 1;
+      parser->token_len = 0;
+      parser->upgrade = 0;
+      parser->http_major = parser->http_minor = 0;
+      parser->status_code = 0;
+      CALLBACK_NOTIFY(message_begin);
+      parser->state = parser->type == HTTP_REQUEST ? s_method : s_res_version;
+      goto reexecute;
+
+    case s_method:
+      if (ch == ' ') {
+        unsigned i;
+        for (i = 0; i < sizeof(method_strings) / sizeof(method_strings[0]); ++i) {
+          if (strlen(method_strings[i]) == parser->token_len && !memcmp(method_strings[i], parser->token, parser->token_len))
+            break;
+        }
+        if (i == sizeof(method_strings) / sizeof(method_strings[0])) {
+          SET_ERRNO(HPE_INVALID_METHOD);
+          return p - data;
+        }
+        parser->method = i;
+        parser->state = s_url;
+        url_mark = NULL;
+        break;
+      }
+      if (!(ch >= 'A' && ch <= 'Z') && ch != '-') {
+        SET_ERRNO(HPE_INVALID_METHOD);
+        return p - data;
+      }
+      if (parser->token_len >= sizeof(parser->token)) {
+        SET_ERRNO(HPE_INVALID_METHOD);
+        return p - data;
+      }
+      parser->token[parser->token_len++] = ch;
+      break;
+
+    case s_url:
+      if (ch == ' ') {
+        if (!url_mark) {
+          SET_ERRNO(HPE_INVALID_URL);
+          return p - data;
+        }
+        CALLBACK_DATA(url, url_mark, p);
+        url_mark = NULL;
+        parser->state = s_req_version;
+        parser->token_len = 0;
+        break;
+      }
+      if (ch == '\r' || ch == '\n' || ch == '\t' || ch == '\0') {
+        SET_ERRNO(HPE_INVALID_URL);
+        return p - data;
+      }
+      if (!url_mark)
+        url_mark = p;
+      break;
+
+    case s_req_version:
+    case s_res_version:
+      if ((parser->state == s_req_version && ch == '\r') || (parser->state == s_res_version && ch == ' ')) {
+        if (parser->token_len != 8 || memcmp(parser->token, "HTTP/", 5) || !isdigit((unsigned char)parser->token[5]) ||
+            parser->token[6] != '.' || !isdigit((unsigned char)parser->token[7])) {
+          SET_ERRNO(HPE_INVALID_VERSION);
+          return p - data;
+        }
+        parser->http_major = parser->token[5] - '0';
+        parser->http_minor = parser->token[7] - '0';
+        parser->state = parser->state == s_req_version ? s_req_lf : s_res_status;
+        parser->token_len = 0;
+        break;
+      }
+      if (parser->token_len >= 8) {
+        SET_ERRNO(HPE_INVALID_VERSION);
+        return p - data;
+      }
+      parser->token[parser->token_len++] = ch;
+      break;
+
+    case s_req_lf:
+    case s_res_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      parser->state = s_header_start;
+      break;
+
+    case s_res_status:
+      if (ch == ' ' || ch == '\r') {
+        if (parser->token_len != 3) {
+          SET_ERRNO(HPE_INVALID_STATUS);
+          return p - data;
+        }
+        parser->state = ch == ' ' ? s_res_reason : s_res_lf;
+        break;
+      }
+      if (!isdigit((unsigned char)ch) || parser->token_len >= 3) {
+        SET_ERRNO(HPE_INVALID_STATUS);
+        return p - data;
+      }
+      parser->status_code = parser->status_code * 10 + (ch - '0');
+      parser->token_len++;
+      break;
+
+    case s_res_reason:
+      if (ch == '\r')
+        parser->state = s_res_lf;
+      break;
+
+    case s_header_start:
+      if (ch == '\r') {
+        parser->state = s_headers_lf;
+        break;
+      }
+      if (ch == '\n')
+        goto headers_done;
+      parser->state = s_field;
+      parser->token_len = 0;
+      field_mark = p;
+      /* fall through */
+    case s_field:
+      if (ch == ':') {
+        CALLBACK_DATA(header_field, field_mark, p);
+        field_mark = NULL;
+        parser->header_kind = h_general;
+        if (ieq(parser->token, parser->token_len, "content-length"))
+          parser->header_kind = h_content_length;
+        else if (ieq(parser->token, parser->token_len, "transfer-encoding"))
+          parser->header_kind = h_transfer_encoding;
+        else if (ieq(parser->token, parser->token_len, "connection"))
+          parser->header_kind = h_connection;
+        else if (ieq(parser->token, parser->token_len, "upgrade"))
+          parser->header_kind = h_upgrade;
+        parser->value_len = 0;
+        parser->state = s_value_start;
+        break;
+      }
+      if (ch == '\r' || ch == '\n' || ch == ' ' || ch == '\t') {
+        SET_ERRNO(HPE_INVALID_HEADER_TOKEN);
+        return p - data;
+      }
+      if (parser->token_len < sizeof(parser->token))
+        parser->token[parser->token_len] = ch;
+      parser->token_len++;
+      break;
+
+    case s_value_start:
+      if (ch == ' ' || ch == '\t')
+        break;
+      parser->state = s_value;
+      value_mark = p;
+      /* fall through */
+    case s_value:
+      if (ch == '\r' || ch == '\n') {
+        /* strip the trailing white spaces */
+        const char *stop = p;
+        if (value_mark) {
+          while (stop > value_mark && (stop[-1] == ' ' || stop[-1] == '\t'))
+            --stop;
+        }
+        CALLBACK_DATA(header_value, value_mark, stop);
+        value_mark = NULL;
+        finish_header(parser);
+        if (parser->http_errno)
+          return p - data;
+        parser->state = ch == '\r' ? s_value_lf : s_header_start;
+        break;
+      }
+      if (parser->header_kind != h_general && parser->value_len < sizeof(parser->value))
+        parser->value[parser->value_len++] = ch;
+      break;
+
+    case s_value_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      parser->state = s_header_start;
+      break;
+
+    case s_headers_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+headers_done:
+      if (parser->flags & F_TRAILING) {
+        /* never reached, trailers have their own states */
+      }
+      parser->upgrade = (parser->type == HTTP_REQUEST && (parser->flags & (F_UPGRADE | F_CONNECTION_UPGRADE)) == (F_UPGRADE | F_CONNECTION_UPGRADE)) ||
+                        (parser->type == HTTP_REQUEST && parser->method == HTTP_CONNECT) ||
+                        (parser->type == HTTP_RESPONSE && parser->status_code == 101);
+      if (settings->on_headers_complete) {
+        switch (settings->on_headers_complete(parser)) {
+        case 0:
+          break;
+        case 2:
+          parser->upgrade = 1;
+          /* fall through */
+        case 1:
+          parser->flags |= F_SKIPBODY;
+          break;
+        default:
+          SET_ERRNO(HPE_CB_headers_complete);
+          return p - data;
+        }
+      }
+      if (parser->http_errno != HPE_OK)
+        return p - data;
+      if (parser->upgrade) {
+        parser->state = s_start;
+        CALLBACK_NOTIFY(message_complete);
+        return (p - data) + 1;
+      }
+      if (parser->flags & F_SKIPBODY) {
+        goto message_done;
+      } else if (parser->flags & F_CHUNKED) {
+        parser->state = s_chunk_size;
+        parser->content_length = 0;
+        parser->token_len = 0;
+      } else if (parser->content_length != UINT64_MAX) {
+        if (parser->content_length == 0)
+          goto message_done;
+        parser->state = s_body_identity;
+      } else if (!message_needs_eof(parser)) {
+        goto message_done;
+      } else {
+        parser->state = s_body_eof;
+      }
+      break;
+
+    case s_body_identity: {
+      size_t avail = end - p;
+      size_t n = avail < parser->content_length ? avail : (size_t)parser->content_length;
+      body_mark = p;
+      parser->content_length -= n;
+      p += n - 1;
+      CALLBACK_DATA(body, body_mark, body_mark + n);
+      body_mark = NULL;
+      if (parser->content_length == 0)
+        goto message_done;
+      break;
+    }
+
+    case s_body_eof: {
+      body_mark = p;
+      p = end - 1;
+      CALLBACK_DATA(body, body_mark, end);
+      body_mark = NULL;
+      break;
+    }
+
+    case s_chunk_size: {
+      int v;
+      if (ch == '\r') {
+        if (!parser->token_len) {
+          SET_ERRNO(HPE_INVALID_CHUNK_SIZE);
+          return p - data;
+        }
+        parser->state = s_chunk_size_lf;
+        break;
+      }
+      if (ch == ';' || ch == ' ') {
+        parser->state = s_chunk_ext;
+        break;
+      }
+      v = hexval(ch);
+      if (v < 0) {
+        SET_ERRNO(HPE_INVALID_CHUNK_SIZE);
+        return p - data;
+      }
+      parser->content_length = parser->content_length * 16 + v;
+      parser->token_len = 1;
+      break;
+    }
+
+    case s_chunk_ext:
+      if (ch == '\r')
+        parser->state = s_chunk_size_lf;
+      break;
+
+    case s_chunk_size_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      parser->token_len = 0;
+      CALLBACK_NOTIFY(chunk_header);
+      if (parser->content_length == 0) {
+        parser->flags |= F_TRAILING;
+        parser->state = s_trailer_start;
+      } else {
+        parser->state = s_chunk_data;
+      }
+      break;
+
+    case s_chunk_data: {
+      size_t avail = end - p;
+      size_t n = avail < parser->content_length ? avail : (size_t)parser->content_length;
+      body_mark = p;
+      parser->content_length -= n;
+      p += n - 1;
+      CALLBACK_DATA(body, body_mark, body_mark + n);
+      body_mark = NULL;
+      if (parser->content_length == 0)
+        parser->state = s_chunk_data_cr;
+      break;
+    }
+
+    case s_chunk_data_cr:
+      if (ch != '\r') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      parser->state = s_chunk_data_lf;
+      break;
+
+    case s_chunk_data_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      CALLBACK_NOTIFY(chunk_complete);
+      parser->state = s_chunk_size;
+      parser->content_length = 0;
+      parser->token_len = 0;
+      break;
+
+    case s_trailer_start:
+      if (ch == '\r') {
+        parser->state = s_trailers_end_lf;
+        break;
+      }
+      if (ch == '\n') {
+        CALLBACK_NOTIFY(chunk_complete);
+        goto message_done;
+      }
+      parser->state = s_trailer;
+      break;
+
+    case s_trailer:
+      if (ch == '\r')
+        parser->state = s_trailer_lf;
+      break;
+
+    case s_trailer_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      parser->state = s_trailer_start;
+      break;
+
+    case s_trailers_end_lf:
+      if (ch != '\n') {
+        SET_ERRNO(HPE_INVALID_CONSTANT);
+        return p - data;
+      }
+      CALLBACK_NOTIFY(chunk_complete);
+      goto message_done;
+
+    default:
+      SET_ERRNO(HPE_INVALID_INTERNAL_STATE);
+      return p - data;
+    }
+    continue;
+
+message_done:
+    parser->state = http_should_keep_alive(parser) ? s_start : s_dead;
+    if (settings->on_message_complete && settings->on_message_complete(parser) != 0) {
+      SET_ERRNO(HPE_CB_message_complete);
+      return (p - data) + 1;
+    }
+  }
+
+  /* partial data at the end of the buffer */
+  CALLBACK_DATA(url, url_mark, end);
+  CALLBACK_DATA(header_field, field_mark, end);
+  if (parser->state == s_value)
+    CALLBACK_DATA(header_value, value_mark, end);
+  return len;
+}
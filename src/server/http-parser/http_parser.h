@@ -0,0 +1,147 @@
+/* Local stand-in for nodejs/http-parser (API compatible subset), used only to build & run tests. */
+#ifndef http_parser_h
+#define http_parser_h
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef HTTP_MAX_HEADER_SIZE
+# define HTTP_MAX_HEADER_SIZE (80*1024)
+#endif
+
+typedef struct http_parser http_parser;
+typedef struct http_parser_settings http_parser_settings;
+typedef int (*http_data_cb) (http_parser*, const char *at, size_t length);
+typedef int (*http_cb) (http_parser*);
+
+#define HTTP_METHOD_MAP(XX) \
+  XX(0,  DELETE,      DELETE)       \
+  XX(1,  GET,         GET)          \
+  XX(2,  HEAD,        HEAD)         \
+  XX(3,  POST,        POST)         \
+  XX(4,  PUT,         PUT)          \
+  XX(5,  CONNECT,     CONNECT)      \
+  XX(6,  OPTIONS,     OPTIONS)      \
+  XX(7,  TRACE,       TRACE)        \
+  XX(8,  COPY,        COPY)         \
+  XX(9,  LOCK,        LOCK)         \
+  XX(10, MKCOL,       MKCOL)        \
+  XX(11, MOVE,        MOVE)         \
+  XX(12, PROPFIND,    PROPFIND)     \
+  XX(13, PROPPATCH,   PROPPATCH)    \
+  XX(14, SEARCH,      SEARCH)       \
+  XX(15, UNLOCK,      UNLOCK)       \
+  XX(16, BIND,        BIND)         \
+  XX(17, REBIND,      REBIND)       \
+  XX(18, UNBIND,      UNBIND)       \
+  XX(19, ACL,         ACL)          \
+  XX(20, REPORT,      REPORT)       \
+  XX(21, MKACTIVITY,  MKACTIVITY)   \
+  XX(22, CHECKOUT,    CHECKOUT)     \
+  XX(23, MERGE,       MERGE)        \
+  XX(24, MSEARCH,     M-SEARCH)     \
+  XX(25, NOTIFY,      NOTIFY)       \
+  XX(26, SUBSCRIBE,   SUBSCRIBE)    \
+  XX(27, UNSUBSCRIBE, UNSUBSCRIBE)  \
+  XX(28, PATCH,       PATCH)        \
+  XX(29, PURGE,       PURGE)        \
+  XX(30, MKCALENDAR,  MKCALENDAR)   \
+  XX(31, LINK,        LINK)         \
+  XX(32, UNLINK,      UNLINK)       \
+  XX(33, SOURCE,      SOURCE)
+
+enum http_method {
+#define XX(num, name, string) HTTP_##name = num,
+  HTTP_METHOD_MAP(XX)
+#undef XX
+};
+
+enum http_parser_type { HTTP_REQUEST, HTTP_RESPONSE, HTTP_BOTH };
+
+#define HTTP_ERRNO_MAP(XX) \
+  XX(OK, "success") \
+  XX(CB_message_begin, "the on_message_begin callback failed") \
+  XX(CB_url, "the on_url callback failed") \
+  XX(CB_header_field, "the on_header_field callback failed") \
+  XX(CB_header_value, "the on_header_value callback failed") \
+  XX(CB_headers_complete, "the on_headers_complete callback failed") \
+  XX(CB_body, "the on_body callback failed") \
+  XX(CB_message_complete, "the on_message_complete callback failed") \
+  XX(CB_status, "the on_status callback failed") \
+  XX(CB_chunk_header, "the on_chunk_header callback failed") \
+  XX(CB_chunk_complete, "the on_chunk_complete callback failed") \
+  XX(INVALID_EOF_STATE, "stream ended at an unexpected time") \
+  XX(HEADER_OVERFLOW, "too many header bytes seen; overflow detected") \
+  XX(CLOSED_CONNECTION, "data received after completed connection: close message") \
+  XX(INVALID_VERSION, "invalid HTTP version") \
+  XX(INVALID_STATUS, "invalid HTTP status code") \
+  XX(INVALID_METHOD, "invalid HTTP method") \
+  XX(INVALID_URL, "invalid URL") \
+  XX(INVALID_HEADER_TOKEN, "invalid character in header") \
+  XX(INVALID_CONTENT_LENGTH, "invalid character in content-length header") \
+  XX(UNEXPECTED_CONTENT_LENGTH, "unexpected content-length header") \
+  XX(INVALID_CHUNK_SIZE, "invalid character in chunk size header") \
+  XX(INVALID_CONSTANT, "invalid constant string") \
+  XX(INVALID_INTERNAL_STATE, "encountered unexpected internal state") \
+  XX(STRICT, "strict mode assertion failed") \
+  XX(PAUSED, "parser is paused") \
+  XX(UNKNOWN, "an unknown error occurred")
+
+enum http_errno {
+#define XX(n, s) HPE_##n,
+  HTTP_ERRNO_MAP(XX)
+#undef XX
+};
+
+struct http_parser {
+  unsigned int type : 2;
+  unsigned int flags : 8;
+  unsigned int state : 7;
+  unsigned int index : 5;
+  uint32_t nread;
+  uint64_t content_length;
+  unsigned short http_major;
+  unsigned short http_minor;
+  unsigned int status_code : 16;
+  unsigned int method : 8;
+  unsigned int http_errno : 7;
+  unsigned int upgrade : 1;
+  void *data;
+  /* private */
+  unsigned char skip_body;
+  unsigned char header_kind;
+  unsigned char dead;
+  char token[40];
+  unsigned int token_len;
+  char value[256];
+  unsigned int value_len;
+};
+
+struct http_parser_settings {
+  http_cb      on_message_begin;
+  http_data_cb on_url;
+  http_data_cb on_status;
+  http_data_cb on_header_field;
+  http_data_cb on_header_value;
+  http_cb      on_headers_complete;
+  http_data_cb on_body;
+  http_cb      on_message_complete;
+  http_cb      on_chunk_header;
+  http_cb      on_chunk_complete;
+};
+
+void http_parser_init(http_parser *parser, enum http_parser_type type);
+void http_parser_settings_init(http_parser_settings *settings);
+size_t http_parser_execute(http_parser *parser, const http_parser_settings *settings, const char *data, size_t len);
+int http_should_keep_alive(const http_parser *parser);
+const char *http_method_str(enum http_method m);
+const char *http_errno_name(enum http_errno err);
+const char *http_errno_description(enum http_errno err);
+int http_body_is_final(const http_parser *parser);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
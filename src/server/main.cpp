@@ -15,18 +15,50 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdlib>
 #include <exception>
 #include <iostream>
+#include <new>
 
 #include <dracon/logging.h>
 
 #include "server.h"
 #include "serverlogger.h"
+#include "staticplugins.h"
+
+void * operator new(std::size_t n)
+{
+    void *ptr = malloc(n);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void *p) noexcept
+{
+    if (p)
+        free(p);
+}
+
+void operator delete(void *p, std::size_t n) noexcept
+{
+    (void)n;
+    if (p)
+        free(p);
+}
 
 int main(int argc, char*argv[])
 {
     try {
-        return Getodac::Server::instance().exec(argc, argv);
+        auto config = Getodac::ServerConfig::fromCommandLine(argc, argv);
+        if (!config)
+            return 0;
+        config->handleExitSignals = true;
+        config->handleCrashSignals = true;
+        for (auto plugin = Getodac::StaticPlugins; *plugin; ++plugin)
+            config->staticPlugins.push_back(*plugin);
+        Getodac::Server server{std::move(*config)};
+        return server.exec();
     } catch (const std::exception &e) {
         FATAL(Getodac::ServerLogger) << e.what();
         return -1;
@@ -0,0 +1,119 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "pluginsindex.h"
+
+#include <algorithm>
+#include <strings.h>
+
+namespace Getodac {
+
+namespace {
+bool iequals(std::string_view a, std::string_view b)
+{
+    return a.size() == b.size() && !strncasecmp(a.data(), b.data(), a.size());
+}
+} // namespace
+
+std::string_view requestHost(const Dracon::Request &req)
+{
+    auto it = req.find("Host");
+    if (it == req.end()) {
+        it = req.find("host");
+        if (it == req.end())
+            return {};
+    }
+    std::string_view host = it->second;
+    if (!host.empty() && host.front() == '[') { // [IPv6]:port
+        auto end = host.find(']');
+        return end == std::string_view::npos ? host : host.substr(0, end + 1);
+    }
+    return host.substr(0, host.find(':'));
+}
+
+void PluginsIndex::build(const std::vector<ServerPlugin> &plugins, const std::vector<uint8_t> *enabled)
+{
+    m_plugins = plugins.size();
+    m_nodes.assign(1, {});
+    m_routes.clear();
+    m_fallback.clear();
+    for (uint32_t plugin = 0; plugin < plugins.size(); ++plugin) {
+        if (enabled && !(*enabled)[plugin])
+            continue;
+        auto routes = plugins[plugin].routes();
+        if (!routes) {
+            m_fallback.push_back(plugin);
+            continue;
+        }
+        for (const auto &route : *routes) {
+            uint32_t node = 0;
+            for (auto ch : route.prefix) {
+                auto &children = m_nodes[node].children;
+                auto it = std::lower_bound(children.begin(), children.end(), ch,
+                                           [](const auto &child, char ch) { return child.first < ch; });
+                if (it == children.end() || it->first != ch) {
+                    it = children.emplace(it, ch, uint32_t(m_nodes.size()));
+                    node = it->second;
+                    m_nodes.emplace_back();
+                } else {
+                    node = it->second;
+                }
+            }
+            m_nodes[node].routes.push_back(uint32_t(m_routes.size()));
+            m_routes.push_back({plugin, route.methods, route.hosts});
+        }
+    }
+}
+
+void PluginsIndex::candidates(const Dracon::Request &req, std::vector<uint8_t> &candidates) const
+{
+    candidates.assign(m_plugins, 0);
+    for (auto plugin : m_fallback)
+        candidates[plugin] = 1;
+    if (m_nodes.empty())
+        return;
+    const auto &url = req.url();
+    const auto &method = req.method();
+    auto host = requestHost(req);
+    uint32_t node = 0;
+    for (size_t pos = 0;; ++pos) {
+        for (auto route : m_nodes[node].routes)
+            if (matches(m_routes[route], method, req.virtualHost(), host))
+                candidates[m_routes[route].plugin] = 1;
+        if (pos == url.size())
+            break;
+        const auto &children = m_nodes[node].children;
+        auto it = std::lower_bound(children.begin(), children.end(), url[pos],
+                                   [](const auto &child, char ch) { return child.first < ch; });
+        if (it == children.end() || it->first != url[pos])
+            break;
+        node = it->second;
+    }
+}
+
+bool PluginsIndex::matches(const Route &route, std::string_view method, std::string_view virtualHost, std::string_view host) const
+{
+    if (!route.methods.empty() && std::find(route.methods.begin(), route.methods.end(), method) == route.methods.end())
+        return false;
+    if (route.hosts.empty())
+        return true;
+    return std::any_of(route.hosts.begin(), route.hosts.end(), [&](const std::string &h) {
+        return iequals(h, host) || (!virtualHost.empty() && iequals(h, virtualHost));
+    });
+}
+
+} // namespace Getodac
@@ -0,0 +1,79 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include <dracon/http.h>
+
+#include "serverplugin.h"
+
+namespace Getodac {
+
+/// The Host header of \a req, without the port
+std::string_view requestHost(const Dracon::Request &req);
+
+/*!
+ * \brief The PluginsIndex class
+ *
+ * A prefix tree of the routes declared by the plugins, so the server asks only
+ * the plugins which may handle a request. The plugins which declared no routes are always asked.
+ */
+class PluginsIndex
+{
+public:
+    /*!
+     * \brief build
+     * Indexes the \a plugins, if \a enabled is set only the plugins with enabled[i] set are indexed.
+     */
+    void build(const std::vector<ServerPlugin> &plugins, const std::vector<uint8_t> *enabled = nullptr);
+
+    /*!
+     * \brief candidates
+     * Sets candidates[i] for every plugin that may handle \a req, \a candidates is resized to the plugins count.
+     */
+    void candidates(const Dracon::Request &req, std::vector<uint8_t> &candidates) const;
+
+private:
+    struct Route
+    {
+        uint32_t plugin;
+        std::vector<std::string> methods;
+        std::vector<std::string> hosts;
+    };
+
+    struct Node
+    {
+        // sorted by the char
+        std::vector<std::pair<char, uint32_t>> children;
+        // the routes which end here
+        std::vector<uint32_t> routes;
+    };
+
+    bool matches(const Route &route, std::string_view method, std::string_view virtualHost, std::string_view host) const;
+
+private:
+    size_t m_plugins = 0;
+    std::vector<Node> m_nodes;
+    std::vector<Route> m_routes;
+    std::vector<uint32_t> m_fallback;
+};
+
+} // namespace Getodac
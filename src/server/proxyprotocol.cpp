@@ -0,0 +1,151 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "proxyprotocol.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <cstring>
+#include <string>
+
+#include <dracon/utils.h>
+
+namespace Getodac {
+namespace ProxyProtocol {
+
+namespace {
+const std::string_view V1Signature{"PROXY "};
+const std::string_view V2Signature{"\r\n\r\n\0\r\nQUIT\n", 12};
+
+// A v1 header, including the CRLF, is at most 107 bytes long
+const size_t V1MaxSize = 107;
+const size_t V2HeaderSize = 16;
+
+inline bool parsePort(std::string_view text, uint16_t &port)
+{
+    if (text.empty() || text.size() > 5)
+        return false;
+    uint32_t value = 0;
+    for (auto ch : text) {
+        if (ch < '0' || ch > '9')
+            return false;
+        value = value * 10 + (ch - '0');
+    }
+    if (value > 65535)
+        return false;
+    port = htons(uint16_t(value));
+    return true;
+}
+
+ssize_t parseV1(std::string_view data, sockaddr_storage &source)
+{
+    auto end = data.find("\r\n");
+    if (end == std::string_view::npos)
+        return data.size() < V1MaxSize ? 0 : -1;
+    if (end + 2 > V1MaxSize)
+        return -1;
+    auto fields = Dracon::split(data.substr(V1Signature.size(), end - V1Signature.size()), ' ');
+    memset(&source, 0, sizeof(source));
+    source.ss_family = AF_UNSPEC;
+    if (fields.empty())
+        return -1;
+    if (fields[0] == "UNKNOWN")
+        return end + 2;
+    if (fields.size() != 5)
+        return -1;
+    const std::string sourceAddress{fields[1]};
+    if (fields[0] == "TCP4") {
+        auto addr = reinterpret_cast<sockaddr_in *>(&source);
+        if (inet_pton(AF_INET, sourceAddress.c_str(), &addr->sin_addr) != 1 ||
+                !parsePort(fields[3], addr->sin_port)) {
+            return -1;
+        }
+        addr->sin_family = AF_INET;
+    } else if (fields[0] == "TCP6") {
+        auto addr = reinterpret_cast<sockaddr_in6 *>(&source);
+        if (inet_pton(AF_INET6, sourceAddress.c_str(), &addr->sin6_addr) != 1 ||
+                !parsePort(fields[3], addr->sin6_port)) {
+            return -1;
+        }
+        addr->sin6_family = AF_INET6;
+    } else {
+        return -1;
+    }
+    return end + 2;
+}
+
+ssize_t parseV2(std::string_view data, sockaddr_storage &source)
+{
+    if (data.size() < V2HeaderSize)
+        return 0;
+    const auto versionCommand = uint8_t(data[12]);
+    const auto family = uint8_t(data[13]);
+    const size_t length = (uint8_t(data[14]) << 8) | uint8_t(data[15]);
+    if ((versionCommand >> 4) != 2 || (versionCommand & 0xf) > 1)
+        return -1;
+    const size_t size = V2HeaderSize + length;
+    if (size > MaxHeaderSize)
+        return -1;
+    if (data.size() < size)
+        return 0;
+    memset(&source, 0, sizeof(source));
+    source.ss_family = AF_UNSPEC;
+    // LOCAL connections (e.g. the balancer's health checks) keep their address
+    if ((versionCommand & 0xf) == 0)
+        return size;
+    auto addresses = data.data() + V2HeaderSize;
+    switch (family) {
+    case 0x11: { // TCP over IPv4
+        if (length < 12)
+            return -1;
+        auto addr = reinterpret_cast<sockaddr_in *>(&source);
+        addr->sin_family = AF_INET;
+        memcpy(&addr->sin_addr, addresses, 4);
+        memcpy(&addr->sin_port, addresses + 8, 2);
+        break;
+    }
+    case 0x21: { // TCP over IPv6
+        if (length < 36)
+            return -1;
+        auto addr = reinterpret_cast<sockaddr_in6 *>(&source);
+        addr->sin6_family = AF_INET6;
+        memcpy(&addr->sin6_addr, addresses, 16);
+        memcpy(&addr->sin6_port, addresses + 32, 2);
+        break;
+    }
+    default:
+        // unspecified, UDP or unix sockets, keep the connection address
+        break;
+    }
+    return size;
+}
+} // namespace
+
+ssize_t parseHeader(std::string_view data, sockaddr_storage &source) noexcept
+{
+    try {
+        if (data.substr(0, V2Signature.size()) == V2Signature.substr(0, std::min(data.size(), V2Signature.size())))
+            return data.size() < V2Signature.size() ? 0 : parseV2(data, source);
+        if (data.substr(0, V1Signature.size()) == V1Signature.substr(0, std::min(data.size(), V1Signature.size())))
+            return data.size() < V1Signature.size() ? 0 : parseV1(data, source);
+    } catch (...) {}
+    return -1;
+}
+
+} // namespace ProxyProtocol
+} // namespace Getodac
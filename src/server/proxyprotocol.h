@@ -0,0 +1,43 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include <string_view>
+
+namespace Getodac {
+namespace ProxyProtocol {
+
+/// The biggest header we accept, including the v2 TLVs
+constexpr size_t MaxHeaderSize = 1024;
+
+/*!
+ * \brief parseHeader
+ *
+ * Parses a HAProxy PROXY protocol v1 or v2 header from the beginning of \a data.
+ * On success \a source is set to the real client address, or to AF_UNSPEC
+ * when the header doesn't carry one (e.g. LOCAL or UNKNOWN connections).
+ *
+ * \return the header size, 0 if more data is needed or -1 if the header is invalid
+ */
+ssize_t parseHeader(std::string_view data, sockaddr_storage &source) noexcept;
+
+} // namespace ProxyProtocol
+} // namespace Getodac
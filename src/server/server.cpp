@@ -19,8 +19,10 @@
 #include <csignal>
 #include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <memory>
+#include <sstream>
 #include <thread>
 #include <stdexcept>
 
@@ -36,7 +38,10 @@
 #include <arpa/inet.h>
 #include <openssl/err.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 
 #include <boost/algorithm/string.hpp>
@@ -68,27 +73,6 @@
 # error "Only SSL 1.1+ is supported"
 #endif
 
-void * operator new(std::size_t n)
-{
-    void *ptr = malloc(n);
-    if (!ptr)
-        throw std::bad_alloc();
-    return ptr;
-}
-
-void operator delete(void *p) noexcept
-{
-    if (p)
-        free(p);
-}
-
-void operator delete(void *p, std::size_t n) noexcept
-{
-    (void)n;
-    if (p)
-        free(p);
-}
-
 template<typename T>
 using deleted_unique_ptr = std::unique_ptr<T,std::function<void(T*)>>;
 
@@ -97,9 +81,6 @@ namespace Getodac {
 TaggedLogger<> ServerLogger{"Server"};
 
 namespace {
-    uint32_t queuedConnections = 20000;
-    uint32_t eventLoopsSize = std::max(uint32_t(2), std::thread::hardware_concurrency());
-
     std::vector<std::pair<std::string, std::string>> mergedProperties(const boost::property_tree::ptree &node, const std::string &prevNodes = {})
     {
         std::vector<std::pair<std::string, std::string>> res;
@@ -118,6 +99,36 @@ namespace {
         return res;
     }
 
+    /*!
+     * Reads the INFO file \a path with its #include directives expanded. Unlike boost's
+     * read_info, the relative includes are relative to the including file, not to the current dir.
+     */
+    std::string expandedInfo(const std::filesystem::path &path, int depth = 0)
+    {
+        if (depth > 16)
+            throw std::runtime_error{"Too many nested includes in " + path.string()};
+        std::ifstream file{path};
+        if (!file)
+            throw std::runtime_error{"Can't open " + path.string()};
+        std::string res, line;
+        while (std::getline(file, line)) {
+            auto pos = line.find_first_not_of(" \t");
+            if (pos != std::string::npos && !line.compare(pos, 8, "#include")) {
+                auto name = boost::algorithm::trim_copy(line.substr(pos + 8));
+                if (name.size() > 1 && name.front() == '"' && name.back() == '"')
+                    name = name.substr(1, name.size() - 2);
+                if (name.empty())
+                    throw std::runtime_error{"Invalid #include in " + path.string()};
+                std::filesystem::path include{name};
+                res += expandedInfo(include.is_absolute() ? include : path.parent_path() / include, depth + 1);
+            } else {
+                res += line;
+            }
+            res += '\n';
+        }
+        return res;
+    }
+
     static void unblockSignal(int signum)
     {
         sigset_t sigs;
@@ -174,10 +185,12 @@ namespace {
     }
 }
 
+Server *Server::s_instance = nullptr;
 std::chrono::seconds Server::s_headersTimeout{5s};
 std::chrono::seconds Server::s_sslAcceptTimeout{5s};
 std::chrono::seconds Server::s_sslShutdownTimeout{2s};
 std::chrono::seconds Server::s_keepAliveTimeout{10s};
+std::chrono::seconds Server::s_proxyProtocolTimeout{3s};
 
 /*!
  * \brief Server::exitSignalHandler
@@ -188,7 +201,8 @@ void Server::exitSignalHandler()
 {
     // Quit server loop
     INFO(ServerLogger) << "shutting down the server";
-    instance().m_shutdown.store(true);
+    if (s_instance)
+        s_instance->m_shutdown.store(true);
 }
 
 std::chrono::seconds Server::keepAliveTimeout()
@@ -211,6 +225,11 @@ std::chrono::seconds Server::sslShutdownTimeout()
     return s_sslShutdownTimeout;
 }
 
+std::chrono::seconds Server::proxyProtocolTimeout()
+{
+    return s_proxyProtocolTimeout;
+}
+
 /// Makes socket nonblocking
 /*!
  * \brief Server::bind
@@ -225,6 +244,7 @@ int Server::bind(SocketType type, int port)
     int sock = -1;
     if ((sock = ::socket(type == IPV4 ? AF_INET : AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
         throw std::runtime_error{"Can't create the socket"};
+    m_listeners.push_back(sock);
 
     int opt = 1;
     if (::setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt)) < 0)
@@ -252,7 +272,7 @@ int Server::bind(SocketType type, int port)
             throw std::runtime_error{"Can't bind the socket"};
     }
 
-    if (::listen(sock, queuedConnections) == -1)
+    if (::listen(sock, m_config.queuedConnections) == -1)
         throw std::runtime_error{"Can't listen on the socket"};
 
     struct epoll_event event;
@@ -267,6 +287,77 @@ int Server::bind(SocketType type, int port)
     return sock;
 }
 
+/*!
+ * \brief Server::bindUnix
+ *
+ * Binds an unix domain socket listener, used by the local clients
+ * (e.g. sidecars, health checkers) to skip the TCP stack.
+ * A stale socket file left by a previous run is removed.
+ *
+ * \param path the socket file path
+ * \param mode the socket file permissions
+ *
+ * \return the bound socket
+ */
+int Server::bindUnix(const std::string &path, mode_t mode)
+{
+    sockaddr_un saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    if (path.size() >= sizeof(saddr.sun_path))
+        throw std::runtime_error{"The unix socket path \"" + path + "\" is too long"};
+    saddr.sun_family = AF_UNIX;
+    memcpy(saddr.sun_path, path.c_str(), path.size());
+
+    struct stat st;
+    if (!lstat(path.c_str(), &st) && S_ISSOCK(st.st_mode))
+        unlink(path.c_str());
+
+    int sock = -1;
+    if ((sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+        throw std::runtime_error{"Can't create the unix socket"};
+    m_listeners.push_back(sock);
+
+    if (::bind(sock, (struct sockaddr *) &saddr, sizeof(saddr)) < 0)
+        throw std::runtime_error{"Can't bind the unix socket \"" + path + "\""};
+    m_unixSocketsPaths.push_back(path);
+
+    if (chmod(path.c_str(), mode))
+        throw std::runtime_error{"Can't set the unix socket \"" + path + "\" permissions"};
+
+    if (::listen(sock, m_config.queuedConnections) == -1)
+        throw std::runtime_error{"Can't listen on the unix socket"};
+
+    struct epoll_event event;
+    event.data.ptr = nullptr;
+    event.data.fd = sock;
+    event.events = EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLET;
+
+    if (epoll_ctl(m_epollHandler, EPOLL_CTL_ADD, sock, &event))
+        throw std::runtime_error{"Can't  epoll_ctl"};
+
+    ++m_eventsSize;
+    m_unixSocks.insert(sock);
+    return sock;
+}
+
+/*!
+ * \brief Server::closeListeners
+ *
+ * Closes all the listening sockets, the new connections are refused
+ */
+void Server::closeListeners()
+{
+    for (auto sock : m_listeners)
+        ::close(sock);
+    m_listeners.clear();
+    m_sslSocks.clear();
+    m_proxyProtocolSocks.clear();
+    m_unixSocks.clear();
+    for (const auto &path : m_unixSocketsPaths)
+        unlink(path.c_str());
+    m_unixSocketsPaths.clear();
+}
+
 /*!
  * \brief Server::instance
  *
@@ -274,56 +365,40 @@ int Server::bind(SocketType type, int port)
  */
 Server &Server::instance()
 {
-    static Server server;
-    return server;
+    assert(s_instance);
+    return *s_instance;
 }
 
 /*!
- * \brief Server::exec
+ * \brief ServerConfig::fromCommandLine
  *
- * Executes the server loop.
- * The loop is also used to accept incoming connections
+ * The configuration of the GETodac binary
  *
  * \param argc main function argc
  * \param argv main function argc
  *
- * \return the status
+ * \return the configuration, empty if the help was printed
  */
-int Server::exec(int argc, char *argv[])
+std::optional<ServerConfig> ServerConfig::fromCommandLine(int argc, char *argv[])
 {
-    static bool running = false;
-    if (running)
-        throw std::runtime_error{"Already running"};
-
-    boost::log::add_common_attributes();
-    boost::log::register_simple_filter_factory<boost::log::trivial::severity_level, char>("Severity");
-    boost::log::register_simple_formatter_factory<boost::log::trivial::severity_level, char>("Severity");
-
-    // Server start time, will be used by server sessions
-    m_startTime = std::chrono::system_clock::now();
-
     namespace po = boost::program_options;
     namespace fs = std::filesystem;
-    int httpPort = 8080; // Default HTTP port
-    int httpsPort = 8443; // Default HTTPS port
-    uint32_t maxConnectionsPerIp = 500;
-    bool workloadBalancing = true;
+    ServerConfig config;
+    // the ports are set by server.conf
+    config.httpPort = -1;
 
     // Default plugins path
-    std::string pluginsPath = fs::canonical(fs::path(argv[0])).parent_path().parent_path().append("lib/getodac/plugins").string();
-    std::string confDir = fs::canonical(fs::path(argv[0])).parent_path().parent_path().append("etc/GETodac").string();
-    std::string dropUser;
-    std::string dropGroup;
-    bool printPID = false;
+    config.pluginsPath = fs::canonical(fs::path(argv[0])).parent_path().parent_path().append("lib/getodac/plugins").string();
+    config.confDir = fs::canonical(fs::path(argv[0])).parent_path().parent_path().append("etc/GETodac").string();
     // Server arguments
     po::options_description desc{"GETodac options"};
     desc.add_options()
-            ("conf,c", po::value<std::string>(&confDir)->implicit_value(confDir), "configurations path")
-            ("plugins-dir,d", po::value<std::string>(&pluginsPath)->implicit_value(pluginsPath), "plugins dir")
-            ("workers,w", po::value<uint32_t>(&eventLoopsSize)->implicit_value(eventLoopsSize), "workers")
-            ("user,u", po::value<std::string>(&dropUser), "username to drop privileges to")
-            ("group,g", po::value<std::string>(&dropGroup), "optional group to drop privileges to, if missing the main user group will be used")
-            ("pid", po::bool_switch(&printPID), "print GETodac pid")
+            ("conf,c", po::value<std::string>(&config.confDir)->implicit_value(config.confDir), "configurations path")
+            ("plugins-dir,d", po::value<std::string>(&config.pluginsPath)->implicit_value(config.pluginsPath), "plugins dir")
+            ("workers,w", po::value<uint32_t>(&config.workers)->implicit_value(config.workers), "workers")
+            ("user,u", po::value<std::string>(&config.dropUser), "username to drop privileges to")
+            ("group,g", po::value<std::string>(&config.dropGroup), "optional group to drop privileges to, if missing the main user group will be used")
+            ("pid", po::bool_switch(&config.printPid), "print GETodac pid")
             ("help,h", "print this help")
             ;
 
@@ -333,48 +408,140 @@ int Server::exec(int argc, char *argv[])
         po::notify(vm);
         if (vm.count("help")) {
             std::cout << desc << std::endl;
-            exitSignalHandler();
-            return 0;
+            return {};
         }
     } catch (po::error& e) {
         std::cerr << "ERROR: " << e.what() << std::endl << std::endl;
         std::cerr << desc << std::endl;
         throw;
     }
+    return config;
+}
 
-    if (eventLoopsSize < 1)
+/*!
+ * \brief Server::addHandler
+ *
+ * Registers an in-process handler, it's used like a plugin with the same \a name, \a order and \a routes.
+ * The handlers must be added before the server starts.
+ */
+void Server::addHandler(std::string name, SessionFactory factory, uint32_t order, std::optional<Dracon::PluginRoutes> routes)
+{
+    if (m_started)
+        throw std::runtime_error{"The handlers must be added before the server starts"};
+    m_plugins.emplace_back(std::move(name), std::move(factory), order, std::move(routes));
+}
+
+/*!
+ * \brief Server::start
+ *
+ * Starts the server, the connections are accepted by a new thread.
+ * It returns after the server is listening.
+ */
+void Server::start()
+{
+    setup();
+    m_acceptThread = std::thread{[this]{
+        try {
+            run();
+        } catch (const std::exception &e) {
+            FATAL(ServerLogger) << e.what();
+        }
+    }};
+}
+
+/*!
+ * \brief Server::stop
+ *
+ * Stops the server and waits for it
+ */
+void Server::stop()
+{
+    m_shutdown.store(true);
+    uint64_t value = 1;
+    if (::write(m_wakeupFd, &value, sizeof(value)) < 0)
+        WARNING(ServerLogger) << "Can't wake up the server loop";
+    if (m_acceptThread.joinable())
+        m_acceptThread.join();
+}
+
+/*!
+ * \brief Server::exec
+ *
+ * Executes the server loop.
+ * The loop is also used to accept incoming connections
+ *
+ * \return the status
+ */
+int Server::exec()
+{
+    setup();
+    run();
+    return 0;
+}
+
+/*!
+ * \brief Server::setup
+ *
+ * Reads the configuration, loads the plugins, binds the sockets and creates the events loops
+ */
+void Server::setup()
+{
+    if (m_started)
+        throw std::runtime_error{"Already running"};
+    m_started = true;
+
+    boost::log::add_common_attributes();
+    boost::log::register_simple_filter_factory<boost::log::trivial::severity_level, char>("Severity");
+    boost::log::register_simple_formatter_factory<boost::log::trivial::severity_level, char>("Severity");
+
+    // Server start time, will be used by server sessions
+    m_startTime = std::chrono::system_clock::now();
+
+    namespace fs = std::filesystem;
+    if (m_config.workers < 1)
         throw std::runtime_error("Invalid workers count");
 
-    bool enableServerStatus = false;
     gid_t gid = gid_t(-1);
     uid_t uid = uid_t(-1);
     boost::log::settings loggingSettings;
-    if (!confDir.empty()) {
-        auto curPath = std::filesystem::current_path();
-        std::filesystem::current_path(confDir);
+    if (!m_config.confDir.empty()) {
         namespace pt = boost::property_tree;
         pt::ptree properties;
-        pt::read_info("server.conf", properties);
+        std::istringstream conf{expandedInfo(fs::absolute(m_config.confDir) / "server.conf")};
+        pt::read_info(conf, properties);
         auto loggingProperties = mergedProperties(properties.get_child("logging"));
         for (const auto &kv : loggingProperties)
             loggingSettings[kv.first] = kv.second;
 
         s_keepAliveTimeout = std::chrono::seconds{properties.get("keepalive_timeout", s_keepAliveTimeout.count())};
         s_headersTimeout = std::chrono::seconds{properties.get("headers_timeout", s_headersTimeout.count())};
-        enableServerStatus = properties.get("server_status", false);
-        httpPort = properties.get("http_port", -1);
-        queuedConnections = properties.get("queued_connections", queuedConnections);
-        maxConnectionsPerIp = properties.get("max_connections_per_ip", maxConnectionsPerIp);
-        workloadBalancing = properties.get("workload_balancing", workloadBalancing);
-        TRACE(ServerLogger) << "http port:" << httpPort;
+        m_config.serverStatus = properties.get("server_status", false);
+        if (auto virtualHosts = properties.get_child_optional("virtual_hosts"))
+            m_virtualHosts.load(*virtualHosts);
+        m_config.httpPort = properties.get("http_port", m_config.httpPort);
+        m_config.queuedConnections = properties.get("queued_connections", m_config.queuedConnections);
+        m_config.maxConnectionsPerIp = properties.get("max_connections_per_ip", m_config.maxConnectionsPerIp);
+        m_config.workloadBalancing = properties.get("workload_balancing", m_config.workloadBalancing);
+        if (properties.find("proxy_protocol") != properties.not_found()) {
+            m_config.proxyHttpPort = properties.get("proxy_protocol.http_port", m_config.proxyHttpPort);
+            m_config.proxyHttpsPort = properties.get("proxy_protocol.https_port", m_config.proxyHttpsPort);
+            s_proxyProtocolTimeout = std::chrono::seconds{properties.get("proxy_protocol.timeout", s_proxyProtocolTimeout.count())};
+        }
+        if (properties.find("unix_sockets") != properties.not_found()) {
+            for (const auto &p : properties.get_child("unix_sockets")) {
+                auto mode = p.second.get_value<std::string>();
+                m_config.unixSockets.emplace_back(p.first, mode.empty() ? 0660 : std::stoul(mode, nullptr, 8));
+            }
+        }
+        TRACE(ServerLogger) << "http port:" << m_config.httpPort;
         if (properties.find("https") != properties.not_found()) {
             TRACE(ServerLogger) << "https section found in config";
             if (properties.get("https.enabled", false)) {
                 s_sslAcceptTimeout = std::chrono::seconds{properties.get("accept_timeout", s_sslAcceptTimeout.count())};
                 s_sslShutdownTimeout = std::chrono::seconds{properties.get("shutdown_timeout", s_sslShutdownTimeout.count())};
 
-                httpsPort = properties.get("https.port", httpsPort);
-                TRACE(ServerLogger) << "https enabled in configm port=" << httpsPort;
+                m_config.httpsPort = properties.get("https.port", m_config.httpsPort > 0 ? m_config.httpsPort : 8443);
+                TRACE(ServerLogger) << "https enabled in configm port=" << m_config.httpsPort;
 
                 // Init SSL Context
                 SSL_library_init();
@@ -394,7 +561,11 @@ int Server::exec(int argc, char *argv[])
                 SSL_CONF_CTX_set_flags(ctxConf.get(), SSL_CONF_FLAG_FILE | SSL_CONF_FLAG_SERVER | SSL_CONF_FLAG_CERTIFICATE | SSL_CONF_FLAG_REQUIRE_PRIVATE | SSL_CONF_FLAG_SHOW_ERRORS);
 
                 auto cxt_settings = mergedProperties(properties.get_child("https.ssl.cxt_settings"));
-                for (const auto &kv : cxt_settings) {
+                for (auto &kv : cxt_settings) {
+                    // the relative files (e.g. Certificate server.crt) are in the configurations dir
+                    auto type = SSL_CONF_cmd_value_type(ctxConf.get(), kv.first.c_str());
+                    if ((type == SSL_CONF_TYPE_FILE || type == SSL_CONF_TYPE_DIR) && !kv.second.empty() && fs::path{kv.second}.is_relative())
+                        kv.second = (fs::absolute(m_config.confDir) / kv.second).string();
                     DEBUG(ServerLogger) << "SSL_CONF_cmd(" << kv.first << ", " << kv.second << ")";
                     if (SSL_CONF_cmd(ctxConf.get(), kv.first.c_str(), kv.second.empty() ? nullptr : kv.second.c_str()) < 1)
                         throw std::runtime_error{ERR_error_string(ERR_get_error(), nullptr)};
@@ -407,18 +578,19 @@ int Server::exec(int argc, char *argv[])
                 SSL_CTX_set_mode(m_sslContext, SSL_MODE_RELEASE_BUFFERS);
                 SSL_CTX_set_mode(m_sslContext, SSL_MODE_ENABLE_PARTIAL_WRITE);
             } else {
-                httpsPort = -1;
+                m_config.httpsPort = -1;
+                m_config.proxyHttpsPort = -1;
             }
 
-            if (!getuid() && (!dropUser.empty() ||
+            if (!getuid() && (!m_config.dropUser.empty() ||
                     (properties.find("privileges") != properties.not_found() && properties.get("privileges.drop", false)))) {
-                auto usr = dropUser.empty() ? properties.get<std::string>("privileges.user") : dropUser;
+                auto usr = m_config.dropUser.empty() ? properties.get<std::string>("privileges.user") : m_config.dropUser;
                 auto user = getpwnam(usr.c_str());
                 if (!user)
                     throw std::runtime_error("Can't find user \"" + usr + "\"");
                 uid = user->pw_uid;
                 gid = user->pw_gid;
-                auto grp = dropGroup.empty() ? properties.get<std::string>("privileges.group") : dropGroup;
+                auto grp = m_config.dropGroup.empty() ? properties.get<std::string>("privileges.group") : m_config.dropGroup;
                 if (!grp.empty()) {
                     auto group =getgrnam(grp.c_str());
                     if (!group)
@@ -427,48 +599,72 @@ int Server::exec(int argc, char *argv[])
                 }
             }
         }
-        std::filesystem::current_path(curPath);
     }
 
-    if (httpPort < 0 && httpsPort < 0)
+    if (m_config.httpPort < 0 && m_config.httpsPort < 0 && m_config.proxyHttpPort < 0 && m_config.proxyHttpsPort < 0 && m_config.unixSockets.empty())
         throw std::runtime_error{"No HTTP nor HTTPS ports specified"};
 
     // load plugins
-    if (fs::is_directory(pluginsPath)) {
+    if (!m_config.pluginsPath.empty() && fs::is_directory(m_config.pluginsPath)) {
         fs::directory_iterator end_iter;
-        for (fs::directory_iterator dir_itr{pluginsPath}; dir_itr != end_iter; ++dir_itr) {
+        for (fs::directory_iterator dir_itr{m_config.pluginsPath}; dir_itr != end_iter; ++dir_itr) {
             try {
                 if (fs::is_regular_file(dir_itr->status()))
-                    m_plugins.emplace_back(dir_itr->path().string(), confDir);
+                    m_plugins.emplace_back(dir_itr->path().string(), m_config.confDir);
             } catch (const std::exception &e) {
                 ERROR(ServerLogger) << e.what();
             }
         }
     }
 
-    // at the end add the server sessions
-    if (enableServerStatus)
-        m_plugins.emplace_back(&ServerSessions::createSession, UINT32_MAX / 2);
-    std::sort(m_plugins.begin(), m_plugins.end(), [](const ServerPlugin &a, const ServerPlugin &b){return a.order() < b.order();});
+    // the plugins linked into the server
+    for (auto plugin : m_config.staticPlugins) {
+        try {
+            m_plugins.emplace_back(*plugin(), m_config.confDir);
+        } catch (const std::exception &e) {
+            ERROR(ServerLogger) << e.what();
+        }
+    }
 
-    // accept thread must have insane priority to be able to accept connections
-    // as fast as possible
-    sched_param sch;
-    sch.sched_priority = sched_get_priority_max(SCHED_RR);
-    pthread_setschedparam(pthread_self(), SCHED_RR, &sch);
+    // at the end add the server sessions
+    if (m_config.serverStatus)
+        m_plugins.emplace_back("server_status", &ServerSessions::createSession, UINT32_MAX / 2, Dracon::PluginRoutes{{"/server_status", {"GET"}}});
+    std::stable_sort(m_plugins.begin(), m_plugins.end(), [](const ServerPlugin &a, const ServerPlugin &b){return a.order() < b.order();});
+    m_pluginsIndex.build(m_plugins);
+    m_virtualHosts.build(m_plugins);
 
     // Bind IPv4 & IPv6 http ports
-    if (httpPort > 0) {
-        bind(IPV4, httpPort);
-        bind(IPV6, httpPort);
-        INFO(ServerLogger) << "listen on :"<< httpPort << " port";
+    if (m_config.httpPort > 0) {
+        bind(IPV4, m_config.httpPort);
+        bind(IPV6, m_config.httpPort);
+        INFO(ServerLogger) << "listen on :"<< m_config.httpPort << " port";
     }
 
-    if (httpsPort > 0) {
+    if (m_config.httpsPort > 0) {
         // Bind IPv4 & IPv6 https ports
-        m_https4Sock = bind(IPV4, httpsPort);
-        m_https6Sock = bind(IPV6, httpsPort);
-        INFO(ServerLogger) << "listen on :"<< httpsPort << " port";
+        m_sslSocks.insert(bind(IPV4, m_config.httpsPort));
+        m_sslSocks.insert(bind(IPV6, m_config.httpsPort));
+        INFO(ServerLogger) << "listen on :"<< m_config.httpsPort << " port";
+    }
+
+    // Bind the ports behind a load balancer, their connections start with a PROXY protocol header
+    if (m_config.proxyHttpPort > 0) {
+        m_proxyProtocolSocks.insert(bind(IPV4, m_config.proxyHttpPort));
+        m_proxyProtocolSocks.insert(bind(IPV6, m_config.proxyHttpPort));
+        INFO(ServerLogger) << "listen on :"<< m_config.proxyHttpPort << " port using PROXY protocol";
+    }
+    if (m_config.proxyHttpsPort > 0) {
+        for (auto sock : {bind(IPV4, m_config.proxyHttpsPort), bind(IPV6, m_config.proxyHttpsPort)}) {
+            m_sslSocks.insert(sock);
+            m_proxyProtocolSocks.insert(sock);
+        }
+        INFO(ServerLogger) << "listen on :"<< m_config.proxyHttpsPort << " port using PROXY protocol";
+    }
+
+    // Bind unix domain sockets
+    for (const auto &unixSocket : m_config.unixSockets) {
+        bindUnix(unixSocket.first, unixSocket.second);
+        INFO(ServerLogger) << "listen on unix:"<< unixSocket.first;
     }
 
     if (!getuid() && gid != gid_t(-1) && uid != uid_t(-1)) {
@@ -477,23 +673,40 @@ int Server::exec(int argc, char *argv[])
         INFO(ServerLogger) << "Droping privileges";
     }
 
-    boost::log::init_from_settings(loggingSettings);
-    INFO(ServerLogger) << "Logging setup succeeded";
+    if (!m_config.confDir.empty()) {
+        boost::log::init_from_settings(loggingSettings);
+        INFO(ServerLogger) << "Logging setup succeeded";
+    }
 
-    auto eventLoops = std::make_unique<SessionsEventLoop[]>(eventLoopsSize);
-    for (uint32_t i = 0; i < eventLoopsSize; ++i)
-        eventLoops[i].setWorkloadBalancing(workloadBalancing);
+    m_initializedLoops = 0;
+    m_eventLoops = std::make_unique<SessionsEventLoop[]>(m_config.workers);
+    for (uint32_t i = 0; i < m_config.workers; ++i)
+        m_eventLoops[i].setWorkloadBalancing(m_config.workloadBalancing);
 
-    INFO(ServerLogger) << "using " << eventLoopsSize << " worker threads";
+    INFO(ServerLogger) << "using " << m_config.workers << " worker threads";
 
-    INFO(ServerLogger) << "using " << queuedConnections << " queued connections";
+    INFO(ServerLogger) << "using " << m_config.queuedConnections << " queued connections";
+
+    if (m_config.printPid)
+        std::cout << "pid:" << getpid() << std::endl << std::flush;
+}
+
+/*!
+ * \brief Server::run
+ *
+ * The accept loop, it runs until the server is stopped
+ */
+void Server::run()
+{
+    // accept thread must have insane priority to be able to accept connections
+    // as fast as possible
+    sched_param sch;
+    sch.sched_priority = sched_get_priority_max(SCHED_RR);
+    pthread_setschedparam(pthread_self(), SCHED_RR, &sch);
 
     // allocate epoll list
     const auto epollList = std::make_unique<epoll_event[]>(m_eventsSize);
 
-    if (printPID)
-        std::cout << "pid:" << getpid() << std::endl << std::flush;
-
     // Wait for incoming connections
     while (!m_shutdown) {
         int triggeredEvents = epoll_wait(m_epollHandler, epollList.get(), m_eventsSize, 1000);
@@ -509,6 +722,8 @@ int Server::exec(int argc, char *argv[])
 
         for (int i = 0; i < triggeredEvents; ++i)
         {
+            if (epollList[i].data.fd == m_wakeupFd)
+                continue; // stop() was called
             auto events = epollList[i].events;
             if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
                 throw std::runtime_error{"listen socket error"};
@@ -516,41 +731,51 @@ int Server::exec(int argc, char *argv[])
             if (events & (EPOLLIN | EPOLLPRI)) {
                 // It's time to accept all connections
                 struct sockaddr_storage in_addr;
-                socklen_t in_len = sizeof(struct sockaddr_storage);
+                socklen_t in_len;
                 while (!m_shutdown) {
+                    in_len = sizeof(struct sockaddr_storage);
                     int fd = epollList[i].data.fd;
-                    bool ssl = fd == m_https4Sock || fd == m_https6Sock;
+                    bool ssl = m_sslSocks.count(fd);
+                    bool proxyProtocol = m_proxyProtocolSocks.count(fd);
                     int sock = ::accept4(fd, (struct sockaddr *)&in_addr, &in_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
                     if (-1 == sock)
                         break;
 
                     uint32_t order;
-                    auto addr = Dracon::addressText(in_addr);
-                    {
-                        std::unique_lock<std::mutex> lock{m_connectionsPerIpMutex};
-                        if (m_connectionsPerIp[addr] > maxConnectionsPerIp) {
-                            ::close(sock);
-                            continue;
-                        }
-                        order = m_connectionsPerIp[addr]++;
+                    std::string addr;
+                    if (m_unixSocks.count(fd)) {
+                        // the local peers are identified (and limited) by their process
+                        ucred cred;
+                        socklen_t len = sizeof(cred);
+                        addr = "unix:";
+                        if (!getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+                            addr += std::to_string(cred.pid);
+                    } else {
+                        addr = Dracon::addressText(in_addr);
+                    }
+                    try {
+                        order = acquirePeerAddress(addr);
+                    } catch (...) {
+                        ::close(sock);
+                        continue;
                     }
 
                     //TODO: here we can check if sock address is banned
                     //and we can drop the connection
 
                     // Find the least used session
-                    SessionsEventLoop *bestLoop = eventLoops.get();
-                    for (uint32_t i = 1; i < eventLoopsSize; ++i) {
-                        SessionsEventLoop &loop = eventLoops[i];
+                    SessionsEventLoop *bestLoop = m_eventLoops.get();
+                    for (uint32_t i = 1; i < m_config.workers; ++i) {
+                        SessionsEventLoop &loop = m_eventLoops[i];
                         if (bestLoop->activeSessions() > loop.activeSessions())
                             bestLoop = &loop;
                     }
                     try {
                         // Let's try to create a new session
                         if (ssl)
-                            (new ServerSession<SslSocketSession>(bestLoop, sock, std::move(addr), order))->initSession();
+                            (new ServerSession<SslSocketSession>(bestLoop, sock, std::move(addr), order, proxyProtocol))->initSession();
                         else
-                            (new ServerSession<SocketSession>(bestLoop, sock, std::move(addr), order))->initSession();
+                            (new ServerSession<SocketSession>(bestLoop, sock, std::move(addr), order, proxyProtocol))->initSession();
                     } catch (const std::exception &e) {
                         WARNING(ServerLogger) << " Can't create session, reason: " << e.what();
                         ::close(sock);
@@ -566,17 +791,20 @@ int Server::exec(int argc, char *argv[])
     }
 
     // Shutdown event loops
-    for (uint32_t i = 0; i < eventLoopsSize; ++i)
-        eventLoops[i].shutdown();
+    for (uint32_t i = 0; i < m_config.workers; ++i)
+        m_eventLoops[i].shutdown();
 
-    eventLoops.reset();
+    m_eventLoops.reset();
 
     // Delete all active sessions
     for (auto &session : m_activeSessions)
         delete session;
 
     m_plugins.clear();
-    return 0;
+    m_pluginsIndex.build(m_plugins);
+    m_virtualHosts.build(m_plugins);
+
+    closeListeners();
 }
 
 void Server::serverSessionCreated(BasicServerSession *session)
@@ -598,25 +826,97 @@ void Server::serverSessionDeleted(BasicServerSession *session)
         m_activeSessions.erase(session);
     }
 
-    {
-        const auto addr = session->peerAddress();
-        std::unique_lock<std::mutex> lock{m_connectionsPerIpMutex};
-        auto it = m_connectionsPerIp.find(addr);
-        assert(it != m_connectionsPerIp.end());
-        if (--(it->second) == 0)
-            m_connectionsPerIp.erase(it);
+    releasePeerAddress(session->peerAddress());
+}
+
+/*!
+ * \brief Server::updatePeerAddress
+ *
+ * Called by the sessions when they find out the real peer address
+ * (e.g. from a PROXY protocol header). Moves the connection from
+ * \a from to \a to per address counters.
+ *
+ * Throws an exception if \a to exceeded max_connections_per_ip.
+ *
+ * \return the session order for the new address
+ */
+uint32_t Server::updatePeerAddress(const std::string &from, const std::string &to)
+{
+    auto order = acquirePeerAddress(to);
+    releasePeerAddress(from);
+    return order;
+}
+
+/*!
+ * \brief Server::acquirePeerAddress
+ *
+ * Counts a new connection from \a address.
+ * Throws an exception if \a address has too many connections.
+ *
+ * \return the connection order for this address
+ */
+uint32_t Server::acquirePeerAddress(const std::string &address)
+{
+    std::unique_lock<std::mutex> lock{m_connectionsPerIpMutex};
+    auto &connections = m_connectionsPerIp[address];
+    if (connections >= m_config.maxConnectionsPerIp) {
+        if (!connections)
+            m_connectionsPerIp.erase(address);
+        throw std::runtime_error{"Too many connections from " + address};
     }
+    return connections++;
+}
+
+void Server::releasePeerAddress(const std::string &address)
+{
+    std::unique_lock<std::mutex> lock{m_connectionsPerIpMutex};
+    auto it = m_connectionsPerIp.find(address);
+    assert(it != m_connectionsPerIp.end());
+    if (--(it->second) == 0)
+        m_connectionsPerIp.erase(it);
 }
 
-std::function<void (Dracon::AbstractStream &, Dracon::Request &)> Server::create_session(const Dracon::Request &request)
+RequestHandler Server::create_session(Dracon::Request &request, HandlerStorage &storage)
 {
-    for (const auto &plugin : m_plugins) {
-        if (auto service = plugin.createSession(request))
-            return service;
+    const PluginsIndex *index = &m_pluginsIndex;
+    if (!m_virtualHosts.empty()) {
+        if (auto site = m_virtualHosts.find(requestHost(request))) {
+            request.setVirtualHost(site->name);
+            index = &site->index;
+        }
+    }
+    thread_local std::vector<uint8_t> candidates;
+    index->candidates(request, candidates);
+    // the plugins which can't read the body get only the requests without one
+    bool hasBody = request.find("Transfer-Encoding") != request.end();
+    if (!hasBody) {
+        auto contentLength = request.contentLength();
+        hasBody = contentLength != Dracon::ChunkedData && contentLength;
+    }
+    for (size_t i = 0; i < m_plugins.size(); ++i) {
+        if (!candidates[i])
+            continue;
+        const auto &plugin = m_plugins[i];
+        if (hasBody && !(plugin.capabilities() & DRACON_PLUGIN_STREAMING_BODY))
+            continue;
+        if (auto handler = plugin.createHandler(request, storage))
+            return handler;
     }
     return {};
 }
 
+/*!
+ * \brief Server::initEventLoop
+ *
+ * Called by every event loop from its thread, before it serves any request
+ */
+void Server::initEventLoop()
+{
+    auto loop = m_initializedLoops++;
+    for (const auto &plugin : m_plugins)
+        plugin.initLoop(loop);
+}
+
 /*!
  * \brief Server::peakSessions
  * \return the peak of simulatneous connections since the beginning
@@ -653,11 +953,13 @@ SSL_CTX *Getodac::Server::sslContext() const
 /*!
  * \brief Server::Server
  *
- * Creates the server object & the server events loop
+ * Creates the server object, only one server can exist at a time
  */
-Server::Server()
+Server::Server(ServerConfig config)
+    : m_config(std::move(config))
 {
-    m_epollHandler = epoll_create1(EPOLL_CLOEXEC);
+    if (s_instance)
+        throw std::runtime_error{"Only one server instance is allowed"};
 
     // register signal handlers
     struct sigaction sa;
@@ -666,23 +968,44 @@ Server::Server()
     sigemptyset(&sa.sa_mask);
     sa.sa_flags = SA_SIGINFO | SA_NODEFER;
 
-    if (sigaction(SIGFPE, &sa, nullptr) != 0)
-        throw std::runtime_error{"Can't register SIGFPE signal callback"};
+    // the embedding application might want to handle them
+    if (m_config.handleCrashSignals) {
+        if (sigaction(SIGFPE, &sa, nullptr) != 0)
+            throw std::runtime_error{"Can't register SIGFPE signal callback"};
 
-    if (sigaction(SIGILL, &sa, nullptr) != 0)
-        throw std::runtime_error{"Can't register SIGILL signal callback"};
+        if (sigaction(SIGILL, &sa, nullptr) != 0)
+            throw std::runtime_error{"Can't register SIGILL signal callback"};
 
-    if (sigaction(SIGINT, &sa, nullptr) != 0)
-        throw std::runtime_error{"Can't register SIGINT signal callback"};
+        if (sigaction(SIGSEGV, &sa, nullptr) != 0)
+            throw std::runtime_error{"Can't register SIGSEGV signal callback"};
+    }
 
-    if (sigaction(SIGSEGV, &sa, nullptr) != 0)
-        throw std::runtime_error{"Can't register SIGSEGV signal callback"};
+    if (m_config.handleExitSignals) {
+        if (sigaction(SIGINT, &sa, nullptr) != 0)
+            throw std::runtime_error{"Can't register SIGINT signal callback"};
 
-    if (sigaction(SIGTERM, &sa, nullptr) != 0)
-        throw std::runtime_error{"Can't register SIGTERM signal callback"};
+        if (sigaction(SIGTERM, &sa, nullptr) != 0)
+            throw std::runtime_error{"Can't register SIGTERM signal callback"};
+    }
 
     // Ignore sigpipe
     signal(SIGPIPE, SIG_IGN);
+
+    // created last, so they don't leak when the signals registration throws
+    m_epollHandler = epoll_create1(EPOLL_CLOEXEC);
+    m_wakeupFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    struct epoll_event event;
+    event.data.fd = m_wakeupFd;
+    event.events = EPOLLIN;
+    if (m_epollHandler == -1 || m_wakeupFd == -1 || epoll_ctl(m_epollHandler, EPOLL_CTL_ADD, m_wakeupFd, &event)) {
+        if (m_wakeupFd != -1)
+            ::close(m_wakeupFd);
+        if (m_epollHandler != -1)
+            ::close(m_epollHandler);
+        throw std::runtime_error{"Can't create the server loop"};
+    }
+    ++m_eventsSize;
+    s_instance = this;
 }
 
 /*!
@@ -692,11 +1015,16 @@ Server::Server()
  */
 Server::~Server()
 {
+    stop();
+    s_instance = nullptr;
     try {
         if (m_sslContext)
             SSL_CTX_free(m_sslContext);
         CRYPTO_set_locking_callback(nullptr);
         CRYPTO_set_id_callback(nullptr);
+        closeListeners();
+        ::close(m_wakeupFd);
+        ::close(m_epollHandler);
     } catch (...) {}
 }
 
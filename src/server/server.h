@@ -18,13 +18,19 @@
 #pragma once
 
 #include <netdb.h>
+#include <sys/types.h>
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include <openssl/ssl.h>
@@ -32,7 +38,9 @@
 #include <dracon/logging.h>
 #include <dracon/utils.h>
 
+#include "pluginsindex.h"
 #include "serverplugin.h"
+#include "virtualhosts.h"
 
 namespace Dracon {
 class AbstractStream;
@@ -44,14 +52,68 @@ namespace Getodac {
 class BasicServerSession;
 class SessionsEventLoop;
 
+/*!
+ * \brief The ServerConfig struct
+ *
+ * The server configuration, the values found in confDir/server.conf replace these ones.
+ * The https ports need the https section from server.conf.
+ */
+using StaticPluginEntry = const Dracon::StaticPlugin *(*)();
+
+struct ServerConfig
+{
+    /// server.conf & the plugins configurations dir, if empty server.conf is not used
+    std::string confDir;
+    /// the plugins dir, if empty no plugin is loaded from disk
+    std::string pluginsPath;
+    uint32_t workers = std::max(uint32_t(2), std::thread::hardware_concurrency());
+    int httpPort = 8080;
+    int httpsPort = -1;
+    int proxyHttpPort = -1;
+    int proxyHttpsPort = -1;
+    std::vector<std::pair<std::string, mode_t>> unixSockets;
+    uint32_t queuedConnections = 20000;
+    uint32_t maxConnectionsPerIp = 500;
+    bool workloadBalancing = true;
+    bool serverStatus = false;
+    std::string dropUser;
+    std::string dropGroup;
+    bool printPid = false;
+    /// SIGINT & SIGTERM stop the server
+    bool handleExitSignals = false;
+    /// SIGSEGV, SIGILL & SIGFPE are thrown as exceptions by the thread which caused them
+    bool handleCrashSignals = false;
+    /// the plugins linked into the executable, loaded after the pluginsPath ones
+    std::vector<StaticPluginEntry> staticPlugins;
+
+    static std::optional<ServerConfig> fromCommandLine(int argc, char *argv[]);
+};
+
+/*!
+ * \brief The Server class
+ *
+ * Only one server can exist at a time, the sessions use Server::instance().
+ */
 class Server
 {
 public:
+    explicit Server(ServerConfig config = {});
+    ~Server();
+    Server(const Server &) = delete;
+    Server &operator=(const Server &) = delete;
+
     static Server &instance();
-    int exec(int argc, char *argv[]);
+    void addHandler(std::string name, SessionFactory factory, uint32_t order = 0,
+                    std::optional<Dracon::PluginRoutes> routes = {});
+    void start();
+    void stop();
+    int exec();
+    const ServerConfig &config() const { return m_config; }
+
     void serverSessionCreated(BasicServerSession *session);
     void serverSessionDeleted(BasicServerSession *session);
-    std::function<void(Dracon::AbstractStream &, Dracon::Request &)> create_session(const Dracon::Request &request);
+    RequestHandler create_session(Dracon::Request &request, HandlerStorage &storage);
+    void initEventLoop();
     size_t peakSessions() const;
     size_t activeSessions() const;
     std::chrono::seconds uptime() const;
@@ -63,36 +125,56 @@ public:
     static std::chrono::seconds headersTimeout();
     static std::chrono::seconds sslAcceptTimeout();
     static std::chrono::seconds sslShutdownTimeout();
+    static std::chrono::seconds proxyProtocolTimeout();
+    uint32_t updatePeerAddress(const std::string &from, const std::string &to);
 
 private:
-    Server();
-    ~Server();
+    void setup();
+    void run();
 
     enum SocketType {
         IPV4,
         IPV6
     };
     int bind(SocketType type, int port);
+    uint32_t acquirePeerAddress(const std::string &address);
+    void releasePeerAddress(const std::string &address);
+    int bindUnix(const std::string &path, mode_t mode);
+    void closeListeners();
 
 private:
+    static Server *s_instance;
+    ServerConfig m_config;
+    bool m_started = false;
+    std::thread m_acceptThread;
+    std::unique_ptr<SessionsEventLoop[]> m_eventLoops;
+    std::atomic<uint32_t> m_initializedLoops{0};
+    int m_wakeupFd = -1;
     std::atomic_bool m_shutdown{false};
     std::atomic<size_t> m_peakSessions{0};
     std::atomic<size_t> m_servedSessions{0};
     int m_eventsSize = 0;
-    int m_epollHandler;
+    int m_epollHandler = -1;
     mutable std::mutex m_activeSessionsMutex;
     std::unordered_set<BasicServerSession*> m_activeSessions;
     std::vector<ServerPlugin> m_plugins;
+    PluginsIndex m_pluginsIndex;
+    VirtualHosts m_virtualHosts;
     std::chrono::system_clock::time_point m_startTime;
     SSL_CTX *m_sslContext = nullptr;
     std::mutex m_connectionsPerIpMutex;
     std::map<std::string, uint32_t> m_connectionsPerIp;
-    int m_https4Sock = -1;
-    int m_https6Sock = -1;
+    // all the listening sockets, closed when the server stops
+    std::vector<int> m_listeners;
+    std::unordered_set<int> m_sslSocks;
+    std::unordered_set<int> m_proxyProtocolSocks;
+    std::unordered_set<int> m_unixSocks;
+    std::vector<std::string> m_unixSocketsPaths;
     static std::chrono::seconds s_headersTimeout;
     static std::chrono::seconds s_sslAcceptTimeout;
     static std::chrono::seconds s_sslShutdownTimeout;
     static std::chrono::seconds s_keepAliveTimeout;
+    static std::chrono::seconds s_proxyProtocolTimeout;
 };
 
 } // namespace Getodac
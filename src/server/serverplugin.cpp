@@ -18,12 +18,86 @@
 #include "serverplugin.h"
 #include "serverlogger.h"
 
+#include <dracon/http.h>
+
 #include <dlfcn.h>
 
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
 #include <memory>
+#include <new>
 #include <stdexcept>
 
 namespace Getodac {
+
+namespace {
+// The ABI v1 adapter, the context is the plugin create_session function
+void *createV1Handler(void *context, const DraconRequest *request, void *storage)
+{
+    auto createSession = reinterpret_cast<Dracon::CreateSessionType>(context);
+    auto session = createSession(Dracon::request(request));
+    if (!session)
+        return nullptr;
+    return Dracon::PluginHandler<Dracon::HttpSession>::construct(storage, std::move(session));
+}
+
+// The in-process handlers adapter, the context is the SessionFactory
+void *createFactoryHandler(void *context, const DraconRequest *request, void *storage)
+{
+    auto &factory = *reinterpret_cast<SessionFactory *>(context);
+    auto session = factory(Dracon::request(request));
+    if (!session)
+        return nullptr;
+    return Dracon::PluginHandler<Dracon::HttpSession>::construct(storage, std::move(session));
+}
+
+DraconString requestUrl(const DraconRequest *request)
+{
+    const auto &url = Dracon::request(request).url();
+    return {url.data(), url.size()};
+}
+
+DraconString requestMethod(const DraconRequest *request)
+{
+    const auto &method = Dracon::request(request).method();
+    return {method.data(), method.size()};
+}
+
+DraconString requestHeader(const DraconRequest *request, const char *name)
+{
+    const auto &req = Dracon::request(request);
+    auto it = req.find(name);
+    if (it == req.end())
+        return {nullptr, 0};
+    return {it->second.data(), it->second.size()};
+}
+
+// The functions given to the ABI v2 plugins
+const DraconServer ServerTable = {
+    DRACON_PLUGIN_ABI_VERSION, sizeof(DraconServer),
+    requestUrl,
+    requestMethod,
+    requestHeader
+};
+
+// The first ABI v2 tables end with destroy
+constexpr size_t MinPluginTableSize = offsetof(DraconPlugin, routes);
+} // namespace
+
+void RequestHandler::reset() noexcept
+{
+    if (m_handler) {
+        m_plugin->destroyHandler(m_handler);
+        m_handler = nullptr;
+    }
+    if (m_allocated) {
+        ::operator delete(m_allocated, std::align_val_t(m_plugin->handlerAlign));
+        m_allocated = nullptr;
+    }
+}
+
 /*!
  * \brief ServerPlugin::ServerPlugin
  *
@@ -32,6 +106,7 @@ namespace Getodac {
  * \param path to plugin
  */
 ServerPlugin::ServerPlugin(const std::string &path, const std::string &confDir)
+ : m_name(std::filesystem::path{path}.filename().string())
 {
     TRACE(server_logger) << "ServerPlugin loading: " << path << " confDir:" << confDir;
     int flags = RTLD_NOW | RTLD_LOCAL;
@@ -39,39 +114,171 @@ ServerPlugin::ServerPlugin(const std::string &path, const std::string &confDir)
     flags |= RTLD_DEEPBIND;
 #endif
     m_handler = std::shared_ptr<void>(dlopen(path.c_str(), flags), [](void *ptr) {
-        if (ptr) {
-            auto destroy = Dracon::DestoryPluginType(dlsym(ptr, "destory_plugin"));
-            if (destroy)
-                destroy();
+        if (ptr)
             dlclose(ptr);
-        }
     });
 
     if (!m_handler)
         throw std::runtime_error{dlerror()};
 
-    auto init = Dracon::InitPluginType(dlsym(m_handler.get(), "init_plugin"));
-    if (init && !init(confDir))
-        throw std::runtime_error{"initPlugin failed"};
-
-    createSession = Dracon::CreateSessionType(dlsym(m_handler.get(), "create_session"));
-    if (!createSession)
-        throw std::runtime_error{"Can't find create_session function"};
+    auto symbol = [this](const char *name) { return dlsym(m_handler.get(), name); };
+    load(Dracon::StaticPlugin{nullptr,
+                              Dracon::InitPluginType(symbol("init_plugin")),
+                              Dracon::CreateSessionType(symbol("create_session")),
+                              Dracon::PluginOrder(symbol("plugin_order")),
+                              Dracon::DestoryPluginType(symbol("destory_plugin")),
+                              Dracon::PluginRoutesType(symbol("plugin_routes")),
+                              DraconPluginEntry(symbol("dracon_plugin"))}, confDir);
+}
 
-    auto order = Dracon::PluginOrder(dlsym(m_handler.get(), "plugin_order"));
-    if (!order)
-        throw std::runtime_error{"Can't find plugin_order function"};
-    m_order = order();
+/*!
+ * \brief ServerPlugin::ServerPlugin
+ *
+ * Initializes a plugin linked into the server
+ */
+ServerPlugin::ServerPlugin(const Dracon::StaticPlugin &plugin, const std::string &confDir)
+ : m_name(plugin.name)
+{
+    TRACE(server_logger) << "ServerPlugin initializing the static plugin: " << m_name << " confDir:" << confDir;
+    load(plugin, confDir);
 }
 
 /*!
  * \brief ServerPlugin::ServerPlugin
  *
+ * \param name the plugin name
  * \param createSession function pointer
+ * \param routes the requests it handles, all of them if it's not set
  */
-ServerPlugin::ServerPlugin(Dracon::CreateSessionType funcPtr, uint32_t order)
- : createSession(funcPtr)
+ServerPlugin::ServerPlugin(std::string name, Dracon::CreateSessionType funcPtr, uint32_t order, std::optional<Dracon::PluginRoutes> routes)
+ : m_order(order)
+ , m_name(std::move(name))
+ , m_routes(std::move(routes))
+{
+    setAdapter(funcPtr);
+}
+
+/*!
+ * \brief ServerPlugin::ServerPlugin
+ *
+ * An in-process handler
+ *
+ * \param name the handler name
+ * \param factory creates the sessions
+ * \param routes the requests it handles, all of them if it's not set
+ */
+ServerPlugin::ServerPlugin(std::string name, SessionFactory factory, uint32_t order, std::optional<Dracon::PluginRoutes> routes)
+ : m_factory(std::make_shared<SessionFactory>(std::move(factory)))
  , m_order(order)
-{}
+ , m_name(std::move(name))
+ , m_routes(std::move(routes))
+{
+    if (!*m_factory)
+        throw std::runtime_error{"Invalid session factory"};
+    setAdapter(nullptr);
+    m_table.context = m_factory.get();
+    m_table.createHandler = createFactoryHandler;
+}
+
+/*!
+ * \brief ServerPlugin::createHandler
+ *
+ * The handler is constructed in \a storage if it fits, otherwise it's allocated
+ */
+RequestHandler ServerPlugin::createHandler(const Dracon::Request &req, HandlerStorage &storage) const
+{
+    const auto &table = plugin();
+    void *allocated = nullptr;
+    void *memory = &storage;
+    if (table.handlerSize > sizeof(HandlerStorage) || table.handlerAlign > alignof(HandlerStorage))
+        memory = allocated = ::operator new(table.handlerSize, std::align_val_t(table.handlerAlign));
+    void *handler = nullptr;
+    try {
+        handler = table.createHandler(table.context, reinterpret_cast<const DraconRequest *>(&req), memory);
+    } catch (...) {
+        if (allocated)
+            ::operator delete(allocated, std::align_val_t(table.handlerAlign));
+        throw;
+    }
+    if (!handler) {
+        if (allocated)
+            ::operator delete(allocated, std::align_val_t(table.handlerAlign));
+        return {};
+    }
+    return {&table, handler, allocated};
+}
+
+void ServerPlugin::initLoop(uint32_t loop) const
+{
+    const auto &table = plugin();
+    if ((table.capabilities & DRACON_PLUGIN_PER_LOOP_INIT) && table.initLoop)
+        table.initLoop(table.context, loop);
+}
+
+void ServerPlugin::load(const Dracon::StaticPlugin &plugin, const std::string &confDir)
+{
+    // the plugin is destroyed before its library is unloaded, even if its initialization fails
+    if (plugin.entry) {
+        // the table size is the only compatibility check, the members it doesn't have stay null
+        auto table = plugin.entry(&ServerTable);
+        if (!table || table->size < MinPluginTableSize)
+            throw std::runtime_error{"Unsupported plugin ABI"};
+        std::memcpy(&m_table, table, std::min<size_t>(table->size, sizeof(DraconPlugin)));
+        if (m_table.destroy) {
+            m_destroy = std::shared_ptr<void>(nullptr, [library = m_handler, destroy = m_table.destroy, context = m_table.context](void *) {
+                destroy(context);
+            });
+        }
+        if (!m_table.createHandler || !m_table.runHandler || !m_table.destroyHandler)
+            throw std::runtime_error{"Incomplete plugin table"};
+        if (m_table.init && !m_table.init(m_table.context, confDir.c_str()))
+            throw std::runtime_error{"initPlugin failed"};
+        m_order = m_table.order;
+        if (m_table.routes) {
+            m_routes.emplace();
+            for (auto route = m_table.routes; route->prefix; ++route) {
+                auto &res = m_routes->emplace_back(Dracon::PluginRoute{route->prefix});
+                for (auto method = route->methods; method && *method; ++method)
+                    res.methods.emplace_back(*method);
+                for (auto host = route->hosts; host && *host; ++host)
+                    res.hosts.emplace_back(*host);
+            }
+        }
+    } else {
+        if (plugin.destroy) {
+            m_destroy = std::shared_ptr<void>(nullptr, [library = m_handler, destroy = plugin.destroy](void *) {
+                destroy();
+            });
+        }
+        if (plugin.init && !plugin.init(confDir))
+            throw std::runtime_error{"initPlugin failed"};
+
+        if (!plugin.createSession)
+            throw std::runtime_error{"Can't find create_session function"};
+
+        if (!plugin.order)
+            throw std::runtime_error{"Can't find plugin_order function"};
+        m_order = plugin.order();
+        setAdapter(plugin.createSession);
+    }
+
+    // the older v2 tables don't have the routes, their plugins may still export plugin_routes
+    if (!m_routes && plugin.routes)
+        m_routes = plugin.routes();
+}
+
+void ServerPlugin::setAdapter(Dracon::CreateSessionType createSession)
+{
+    m_table.abiVersion = DRACON_PLUGIN_ABI_VERSION;
+    m_table.size = sizeof(DraconPlugin);
+    m_table.capabilities = DRACON_PLUGIN_STREAMING_BODY | DRACON_PLUGIN_ASYNC;
+    m_table.order = m_order;
+    m_table.handlerSize = sizeof(Dracon::HttpSession);
+    m_table.handlerAlign = alignof(Dracon::HttpSession);
+    m_table.context = reinterpret_cast<void *>(createSession);
+    m_table.createHandler = createV1Handler;
+    m_table.runHandler = Dracon::PluginHandler<Dracon::HttpSession>::run;
+    m_table.destroyHandler = Dracon::PluginHandler<Dracon::HttpSession>::destroy;
+}
 
 } // namespace Getodac
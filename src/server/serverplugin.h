@@ -17,27 +17,114 @@
 
 #pragma once
 
+#include <cstddef>
+#include <functional>
 #include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+
 #include <dracon/plugin.h>
 
 namespace Getodac {
 
+/// The handlers up to this size are constructed on the session stack, the bigger ones are allocated
+constexpr size_t HandlerStorageSize = 512;
+struct alignas(std::max_align_t) HandlerStorage
+{
+    unsigned char data[HandlerStorageSize];
+};
+
+/*!
+ * \brief The RequestHandler class
+ *
+ * A handler created by a plugin, it's destroyed by the plugin when this object goes away
+ */
+class RequestHandler
+{
+public:
+    RequestHandler() = default;
+    RequestHandler(const DraconPlugin *plugin, void *handler, void *allocated) noexcept
+        : m_plugin(plugin)
+        , m_handler(handler)
+        , m_allocated(allocated)
+    {}
+    RequestHandler(RequestHandler &&other) noexcept
+        : m_plugin(other.m_plugin)
+        , m_handler(std::exchange(other.m_handler, nullptr))
+        , m_allocated(std::exchange(other.m_allocated, nullptr))
+    {}
+    RequestHandler &operator=(RequestHandler &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            m_plugin = other.m_plugin;
+            m_handler = std::exchange(other.m_handler, nullptr);
+            m_allocated = std::exchange(other.m_allocated, nullptr);
+        }
+        return *this;
+    }
+    ~RequestHandler() { reset(); }
+
+    explicit operator bool() const noexcept { return m_handler; }
+    void operator()(Dracon::AbstractStream &stream, Dracon::Request &req) const
+    {
+        m_plugin->runHandler(m_handler, reinterpret_cast<DraconStream *>(&stream), reinterpret_cast<DraconRequest *>(&req));
+    }
+
+private:
+    void reset() noexcept;
+
+private:
+    const DraconPlugin *m_plugin = nullptr;
+    void *m_handler = nullptr;
+    void *m_allocated = nullptr;
+};
+
+/// Creates the in-process handlers sessions
+using SessionFactory = std::function<Dracon::HttpSession(const Dracon::Request &)>;
+
 /*!
  * \brief The ServerPlugin class
  *
- * This class is used to load plugins
+ * This class is used to load plugins. The ABI v2 plugins are used as they are,
+ * the older ones through an adapter which constructs their HttpSession in the handler storage.
  */
 class ServerPlugin
 {
 public:
     explicit ServerPlugin(const std::string &path, const std::string &confDir);
-    explicit ServerPlugin(Dracon::CreateSessionType funcPtr, uint32_t order);
-    Dracon::CreateSessionType createSession;
+    explicit ServerPlugin(const Dracon::StaticPlugin &plugin, const std::string &confDir);
+    explicit ServerPlugin(std::string name, Dracon::CreateSessionType funcPtr, uint32_t order, std::optional<Dracon::PluginRoutes> routes = {});
+    explicit ServerPlugin(std::string name, SessionFactory factory, uint32_t order, std::optional<Dracon::PluginRoutes> routes = {});
+
+    /// Creates the handler for \a req in \a storage, an empty handler if the plugin doesn't handle it
+    RequestHandler createHandler(const Dracon::Request &req, HandlerStorage &storage) const;
+    /// Called from every event loop thread, before it serves any request
+    void initLoop(uint32_t loop) const;
+
     uint32_t order() const { return m_order; }
+    uint32_t capabilities() const { return plugin().capabilities; }
+    /// The plugin file name, used by the virtual hosts to select their plugins
+    const std::string &name() const { return m_name; }
+    /// The routes declared by the plugin, null if it wants all the requests
+    const Dracon::PluginRoutes *routes() const { return m_routes ? &*m_routes : nullptr; }
+
+private:
+    const DraconPlugin &plugin() const { return m_table; }
+    void load(const Dracon::StaticPlugin &plugin, const std::string &confDir);
+    void setAdapter(Dracon::CreateSessionType createSession);
 
 private:
     std::shared_ptr<void> m_handler;
+    // calls the plugin destroy function, it keeps the library loaded
+    std::shared_ptr<void> m_destroy;
+    // the ABI v2 plugin table (the members it doesn't have stay null) or the adapter of the other plugins
+    DraconPlugin m_table{};
+    std::shared_ptr<SessionFactory> m_factory;
     uint32_t m_order = 0;
+    std::string m_name;
+    std::optional<Dracon::PluginRoutes> m_routes;
 };
 
 } // namespace Getodac
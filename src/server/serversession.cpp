@@ -16,14 +16,18 @@
 */
 
 #include "serversession.h"
+#include "proxyprotocol.h"
+
+#include <array>
 
 namespace Getodac {
 
-BasicServerSession::BasicServerSession(Getodac::SessionsEventLoop *event_loop, int sock, std::string peerAddr, uint32_t order)
+BasicServerSession::BasicServerSession(Getodac::SessionsEventLoop *event_loop, int sock, std::string peerAddr, uint32_t order, bool proxyProtocol)
     : m_sock(sock)
     , m_order(order)
     , m_peerAddr(std::move(peerAddr))
     , m_eventLoop(event_loop)
+    , m_proxyProtocol(proxyProtocol)
 {
     Server::instance().serverSessionCreated(this);
 }
@@ -39,6 +43,52 @@ void BasicServerSession::initSession()
     m_eventLoop->registerSession(this, EPOLLOUT | EPOLLIN | EPOLLPRI | EPOLLRDHUP | EPOLLET | EPOLLERR);
 }
 
+/*!
+ * \brief BasicServerSession::readProxyHeader
+ *
+ * Reads the PROXY protocol header which precedes the HTTP (or TLS) data on the
+ * connections coming from a load balancer. The header is peeked until it's complete,
+ * then only its bytes are consumed. The session's peer address, its per
+ * address limits and order are updated to the real client address.
+ */
+void BasicServerSession::readProxyHeader(YieldType &yield)
+{
+    std::array<char, ProxyProtocol::MaxHeaderSize> buffer;
+    for (;;) {
+        auto size = ::recv(m_sock, buffer.data(), buffer.size(), MSG_PEEK);
+        if (size < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN)
+                throw std::make_error_code(std::errc(errno));
+            if (auto ec = yield().get())
+                throw ec;
+            continue;
+        }
+        if (!size)
+            throw std::make_error_code(std::errc::connection_aborted);
+        sockaddr_storage source;
+        auto headerSize = ProxyProtocol::parseHeader({buffer.data(), size_t(size)}, source);
+        if (headerSize < 0) {
+            INFO(ServerLogger) << m_peerAddr << " invalid PROXY protocol header";
+            throw std::make_error_code(std::errc::protocol_error);
+        }
+        if (!headerSize) {
+            if (auto ec = yield().get())
+                throw ec;
+            continue;
+        }
+        if (::recv(m_sock, buffer.data(), headerSize, 0) != headerSize)
+            throw std::make_error_code(std::errc::io_error);
+        if (source.ss_family != AF_UNSPEC) {
+            auto address = Dracon::addressText(source);
+            m_order = Server::instance().updatePeerAddress(m_peerAddr, address);
+            m_peerAddr = std::move(address);
+        }
+        return;
+    }
+}
+
 const std::string &BasicServerSession::peerAddress() const noexcept
 {
     return m_peerAddr;
@@ -43,25 +43,48 @@ namespace Getodac {
 using Clock = std::chrono::high_resolution_clock;
 using TimePoint = std::chrono::time_point<Clock>;
 
+class BasicServerSession;
+
 struct Wakeupper : Dracon::AbstractStream::AbstractWakeupper
 {
-    Wakeupper(int fd, uint64_t ptr)
-        : m_fd(fd)
-        , m_ptr(ptr)
+    Wakeupper(SessionsEventLoop *eventLoop, BasicServerSession *session)
+        : m_eventLoop(eventLoop)
+        , m_session(session)
     {}
     // abstract_wakeupper interface
     void wakeup() noexcept override
     {
-        eventfd_write(m_fd, m_ptr);
+        m_eventLoop->wakeupSession(m_session);
+    }
+
+    const void *eventLoop() const noexcept override
+    {
+        return m_eventLoop;
     }
-    int m_fd;
-    uint64_t m_ptr;
+
+    void wakeupAll(const std::vector<AbstractWakeupper *> &wakeuppers) noexcept override
+    {
+        std::vector<BasicServerSession *> sessions;
+        try {
+            sessions.reserve(wakeuppers.size());
+            for (auto wakeupper : wakeuppers) {
+                if (wakeupper->eventLoop() == m_eventLoop)
+                    sessions.push_back(static_cast<Wakeupper *>(wakeupper)->m_session);
+                else
+                    wakeupper->wakeup();
+            }
+        } catch (...) {}
+        m_eventLoop->wakeupSessions(sessions);
+    }
+
+    SessionsEventLoop *m_eventLoop;
+    BasicServerSession *m_session;
 };
 
 class BasicServerSession
 {
 public:
-    BasicServerSession(SessionsEventLoop *event_loop, int sock, std::string sock_addr, uint32_t order);
+    BasicServerSession(SessionsEventLoop *event_loop, int sock, std::string sock_addr, uint32_t order, bool proxyProtocol = false);
     virtual ~BasicServerSession();
     void initSession();
 
@@ -86,6 +109,9 @@ public:
     virtual void timeout() noexcept = 0;
     virtual void wakeup() noexcept = 0;
 
+protected:
+    void readProxyHeader(YieldType &yield);
+
 protected:
     int m_sock;
     uint32_t m_order;
@@ -94,6 +120,7 @@ protected:
     mutable std::mutex m_streamMutex;
     TimePoint m_nextTimeout;
     std::unique_ptr<BasicHttpSession> m_stream;
+    bool m_proxyProtocol;
 };
 
 template <typename SocketStream>
@@ -101,17 +128,18 @@ class ServerSession : public BasicServerSession
 {
     static_assert(std::is_base_of<BasicHttpSession, SocketStream>::value, "SocketStream must subclass basic_http_session");
 public:
-    ServerSession(SessionsEventLoop *eventLoop, int sock, std::string &&sockAddr, uint32_t order)
-        : BasicServerSession(eventLoop, sock, std::move(sockAddr), order)
+    ServerSession(SessionsEventLoop *eventLoop, int sock, std::string &&sockAddr, uint32_t order, bool proxyProtocol = false)
+        : BasicServerSession(eventLoop, sock, std::move(sockAddr), order, proxyProtocol)
         , m_ioYield(std::bind(&ServerSession::ioLoop, this, std::placeholders::_1))
     {
         TRACE(Getodac::ServerLogger) << (void*)this
                                      << " eventLoop: " << eventLoop
                                      << " socket:" << sock;
         int opt = 1;
-        if (setsockopt(m_sock, SOL_TCP, TCP_NODELAY, &opt, sizeof(int)))
+        // unix domain sockets don't support TCP_NODELAY
+        if (setsockopt(m_sock, SOL_TCP, TCP_NODELAY, &opt, sizeof(int)) && errno != EOPNOTSUPP)
             throw std::runtime_error{"Can't set socket option TCP_NODELAY"};
-        setNextTimeout(Server::headersTimeout());
+        setNextTimeout(m_proxyProtocol ? Server::proxyProtocolTimeout() : Server::headersTimeout());
     }
 
     ~ServerSession() override
@@ -187,10 +215,13 @@ protected:
     void ioLoop(YieldType &yield)
     {
         try {
+            if (m_proxyProtocol) {
+                readProxyHeader(yield);
+                setNextTimeout(Server::headersTimeout());
+            }
             {
-                auto wu = std::make_shared<Wakeupper>(m_eventLoop->eventFd(),
-                                                      uint64_t(static_cast<BasicServerSession*>(this)));
-                auto stream = std::make_unique<SocketStream>(m_eventLoop, m_sock,
+                auto wu = std::make_shared<Wakeupper>(m_eventLoop, this);
+                auto stream = std::make_unique<SocketStream>(m_eventLoop, this, m_sock,
                                                              yield, m_peerAddr,
                                                              wu);
                 std::unique_lock<std::mutex> lock{m_streamMutex};
@@ -15,6 +15,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <sys/epoll.h>
@@ -25,6 +26,7 @@
 #include <cstdio>
 #include <iostream>
 
+#include "server.h"
 #include "serverlogger.h"
 #include "serversession.h"
 #include "sessionseventloop.h"
@@ -35,6 +37,23 @@ namespace Getodac {
 
 namespace {
 const uint32_t EventsSize = 10000;
+const size_t MaxPooledPipes = 16;
+
+// The descriptors watched on behalf of a session are tagged using the lowest pointer bit
+const uintptr_t WatchedDescriptorTag = 1;
+
+inline BasicServerSession *eventSession(const epoll_event &event)
+{
+    return reinterpret_cast<BasicServerSession *>(uintptr_t(event.data.ptr) & ~WatchedDescriptorTag);
+}
+
+inline void processEvent(const epoll_event &event)
+{
+    if (uintptr_t(event.data.ptr) & WatchedDescriptorTag)
+        eventSession(event)->wakeup();
+    else
+        eventSession(event)->processEvents(event.events);
+}
 }
 
 /*!
@@ -101,6 +120,10 @@ SessionsEventLoop::~SessionsEventLoop()
             lock.lock();
         }
         close(m_eventFd);
+        for (const auto &pipe : m_pipes) {
+            close(pipe.readFd);
+            close(pipe.writeFd);
+        }
     } catch (...) {}
     TRACE(ServerLogger) << this;
 }
@@ -166,6 +189,34 @@ void SessionsEventLoop::unregisterSession(BasicServerSession *session)
     --m_activeSessions;
 }
 
+/*!
+ * \brief SessionsEventLoop::watchDescriptor
+ *
+ * Watches \a fd on behalf of \a session. The session is woken up
+ * when any of the \a events occurs.
+ */
+void SessionsEventLoop::watchDescriptor(int fd, uint32_t events, BasicServerSession *session)
+{
+    TRACE(ServerLogger) << session << " fd:" << fd << " events:" << events;
+    epoll_event event;
+    event.data.ptr = reinterpret_cast<void *>(uintptr_t(session) | WatchedDescriptorTag);
+    event.events = events;
+    if (epoll_ctl(m_epollHandler, EPOLL_CTL_ADD, fd, &event)) {
+        if (errno != EEXIST || epoll_ctl(m_epollHandler, EPOLL_CTL_MOD, fd, &event))
+            throw std::runtime_error{"Can't watch the descriptor"};
+    }
+}
+
+/*!
+ * \brief SessionsEventLoop::unwatchDescriptor
+ *
+ * \param fd to unwatch
+ */
+void SessionsEventLoop::unwatchDescriptor(int fd) noexcept
+{
+    epoll_ctl(m_epollHandler, EPOLL_CTL_DEL, fd, nullptr);
+}
+
 /*!
  * \brief SessionsEventLoop::deleteLater
  *
@@ -185,6 +236,41 @@ void SessionsEventLoop::deleteLater(BasicServerSession *session) noexcept
     } catch (...) {}
 }
 
+/*!
+ * \brief SessionsEventLoop::wakeupSession
+ *
+ * Queues \a session to be woken up by the loop thread
+ */
+void SessionsEventLoop::wakeupSession(BasicServerSession *session) noexcept
+{
+    {
+        std::unique_lock<Dracon::SpinLock> lock{m_wakeupMutex};
+        try {
+            m_wakeupSessions.insert(session);
+        } catch (...) {}
+    }
+    eventfd_write(m_eventFd, 1);
+}
+
+/*!
+ * \brief SessionsEventLoop::wakeupSessions
+ *
+ * Queues all \a sessions to be woken up by the loop thread
+ * using a single eventfd notification.
+ */
+void SessionsEventLoop::wakeupSessions(const std::vector<BasicServerSession *> &sessions) noexcept
+{
+    if (sessions.empty())
+        return;
+    {
+        std::unique_lock<Dracon::SpinLock> lock{m_wakeupMutex};
+        try {
+            m_wakeupSessions.insert(sessions.begin(), sessions.end());
+        } catch (...) {}
+    }
+    eventfd_write(m_eventFd, 1);
+}
+
 void SessionsEventLoop::shutdown() noexcept
 {
     m_quit.store(true);
@@ -203,6 +289,46 @@ void SessionsEventLoop::setWorkloadBalancing(bool on)
     m_workloadBalancing = on;
 }
 
+/*!
+ * \brief SessionsEventLoop::acquirePipe
+ *
+ * Used by the sessions to splice the data between two sockets.
+ * It must be called only from the event loop thread, therefore
+ * the pool doesn't need any locking.
+ *
+ * \return a non-blocking pipe
+ */
+SessionsEventLoop::Pipe SessionsEventLoop::acquirePipe()
+{
+    if (!m_pipes.empty()) {
+        auto pipe = m_pipes.back();
+        m_pipes.pop_back();
+        return pipe;
+    }
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC))
+        throw std::make_error_code(std::errc(errno));
+    return {fds[0], fds[1]};
+}
+
+/*!
+ * \brief SessionsEventLoop::releasePipe
+ *
+ * Gives back a \a pipe acquired with \l acquirePipe.
+ * Only the \a empty pipes are reused, the others are closed.
+ */
+void SessionsEventLoop::releasePipe(Pipe pipe, bool empty) noexcept
+{
+    if (empty && m_pipes.size() < MaxPooledPipes) {
+        try {
+            m_pipes.push_back(pipe);
+            return;
+        } catch (...) {}
+    }
+    close(pipe.readFd);
+    close(pipe.writeFd);
+}
+
 /*!
  * \brief SessionsEventLoop::sharedReadBuffer
  *
@@ -229,6 +355,11 @@ void SessionsEventLoop::loop()
     using Clock = std::chrono::high_resolution_clock;
     using TimePoint = std::chrono::time_point<Clock>;
     auto events = std::make_unique<epoll_event[]>(EventsSize);
+    try {
+        Server::instance().initEventLoop();
+    } catch (const std::exception &e) {
+        ERROR(ServerLogger) << "Can't init the plugins for this loop: " << e.what();
+    }
     Ms timeout(-1ms); // Initial timeout
     while (!m_quit) {
         bool wokeup = false;
@@ -240,41 +371,39 @@ void SessionsEventLoop::loop()
             for (int i = 0 ; i < triggeredEvents; ++i) {
                 auto &event = events[i];
                 if (event.data.fd != m_eventFd)
-                    reinterpret_cast<BasicServerSession *>(event.data.ptr)->processEvents(event.events);
+                    processEvent(event);
                 else
                     wokeup = true;
             }
         } else {
-            std::vector<std::pair<BasicServerSession *, uint32_t>> sessionEvents;
+            std::vector<epoll_event> sessionEvents;
             sessionEvents.reserve(triggeredEvents);
             for (int i = 0 ; i < triggeredEvents; ++i) {
                 auto &event = events[i];
                 if (event.data.fd != m_eventFd) {
-                    auto ptr = reinterpret_cast<BasicServerSession *>(event.data.ptr);
-                    auto evs = event.events;
-                    std::pair<BasicServerSession *, uint32_t> ev{ptr, evs};
                     sessionEvents.insert(std::upper_bound(sessionEvents.begin(),
                                                           sessionEvents.end(),
-                                                          ev,
-                                                          [](auto a, auto b) {
-                                                                return a.first->order() < b.first->order();
+                                                          event,
+                                                          [](const auto &a, const auto &b) {
+                                                                return eventSession(a)->order() < eventSession(b)->order();
                                                           }),
-                                         ev);
+                                         event);
                 } else {
                     wokeup = true;
                 }
             }
-            for (auto event : sessionEvents)
-                event.first->processEvents(event.second);
+            for (const auto &event : sessionEvents)
+                processEvent(event);
         }
 
         std::unordered_set<BasicServerSession *> wokeup_sessions;
         if (wokeup) {
             uint64_t data;
-            while(eventfd_read(m_eventFd, &data) == 0) {
-                if (data != 1)
-                    wokeup_sessions.insert(reinterpret_cast<BasicServerSession *>(data));
-            }
+            while(eventfd_read(m_eventFd, &data) == 0)
+                ;
+            std::unique_lock<Dracon::SpinLock> lock{m_wakeupMutex};
+            wokeup_sessions.swap(m_wakeupSessions);
+            wokeup = !wokeup_sessions.empty();
         }
         // Some session(s) have timeout
         timeout = -1ms; // maximum timeout
@@ -38,6 +38,13 @@ class BasicServerSession;
  */
 class SessionsEventLoop
 {
+public:
+    struct Pipe
+    {
+        int readFd = -1;
+        int writeFd = -1;
+    };
+
 public:
     SessionsEventLoop();
     ~SessionsEventLoop();
@@ -46,8 +53,14 @@ public:
     void updateSession(BasicServerSession *session, uint32_t events);
     void unregisterSession(BasicServerSession *session);
 
+    void watchDescriptor(int fd, uint32_t events, BasicServerSession *session);
+    void unwatchDescriptor(int fd) noexcept;
+
     void deleteLater(BasicServerSession *session) noexcept;
 
+    void wakeupSession(BasicServerSession *session) noexcept;
+    void wakeupSessions(const std::vector<BasicServerSession *> &sessions) noexcept;
+
     inline uint32_t activeSessions() const noexcept { return m_activeSessions.load(); }
     void shutdown() noexcept;
 
@@ -55,12 +68,16 @@ public:
     std::shared_ptr<Dracon::CharBuffer> sharedWriteBuffer(size_t size) const;
     void setWorkloadBalancing(bool on);
 
+    Pipe acquirePipe();
+    void releasePipe(Pipe pipe, bool empty) noexcept;
+
     inline int eventFd() const { return m_eventFd; }
 private:
     void loop();
 
 private:
     std::shared_ptr<Dracon::CharBuffer> m_sharedWriteBuffer;
+    std::vector<Pipe> m_pipes;
     int m_epollHandler;
     bool m_workloadBalancing = false;
     int m_eventFd;
@@ -71,6 +88,8 @@ private:
     std::set<BasicServerSession *> m_sessions;
     Dracon::SpinLock m_deleteLaterMutex;
     std::unordered_set<BasicServerSession *> m_deleteLaterObjects;
+    Dracon::SpinLock m_wakeupMutex;
+    std::unordered_set<BasicServerSession *> m_wakeupSessions;
 };
 
 } // namespace Getodac
@@ -25,8 +25,13 @@
 
 #include "streams.h"
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
 #include <sys/uio.h>
 
+#include <algorithm>
+
 #include <dracon/http.h>
 #include <dracon/logging.h>
 
@@ -49,10 +54,11 @@ struct http_parser_data
 };
 
 
-BasicHttpSession::BasicHttpSession(SessionsEventLoop *eventLoop, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper)
+BasicHttpSession::BasicHttpSession(SessionsEventLoop *eventLoop, BasicServerSession *session, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper)
     : m_yield(yield)
     , m_socket(socket)
     , m_eventLoop(eventLoop)
+    , m_session(session)
     , m_wakeupper(wakeupper)
     , m_peerAddress(peerAddress)
 {
@@ -67,7 +73,11 @@ BasicHttpSession::BasicHttpSession(SessionsEventLoop *eventLoop, int socket, Yie
     http_parser_init(&m_parser, HTTP_REQUEST);
 }
 
-BasicHttpSession::~BasicHttpSession() = default;
+BasicHttpSession::~BasicHttpSession()
+{
+    for (auto fd : m_watchedDescriptors)
+        m_eventLoop->unwatchDescriptor(fd);
+}
 
 void BasicHttpSession::read(Dracon::Request &req) noexcept(false)
 {
@@ -178,6 +188,192 @@ std::shared_ptr<Dracon::AbstractStream::AbstractWakeupper> BasicHttpSession::wak
     return m_wakeupper;
 }
 
+void BasicHttpSession::watchDescriptor(int fd, uint32_t events) noexcept(false)
+{
+    m_eventLoop->watchDescriptor(fd, events | EPOLLET, m_session);
+    if (std::find(m_watchedDescriptors.begin(), m_watchedDescriptors.end(), fd) == m_watchedDescriptors.end())
+        m_watchedDescriptors.push_back(fd);
+}
+
+void BasicHttpSession::unwatchDescriptor(int fd) noexcept
+{
+    auto it = std::find(m_watchedDescriptors.begin(), m_watchedDescriptors.end(), fd);
+    if (it == m_watchedDescriptors.end())
+        return;
+    m_watchedDescriptors.erase(it);
+    m_eventLoop->unwatchDescriptor(fd);
+}
+
+namespace {
+const size_t RelayChunkSize = 64 * 1024;
+}
+
+/*!
+ * \brief The BasicHttpSession::RelayChannel struct
+ *
+ * The state of one relay direction. The spliced bytes wait in a pipe from the loop's pool,
+ * the buffered copy (and the bytes already read by the http parser) wait in \a pending.
+ */
+struct BasicHttpSession::RelayChannel
+{
+    RelayChannel(SessionsEventLoop *eventLoop, Dracon::RelayDirection direction, size_t length, bool splice)
+        : eventLoop(eventLoop)
+        , direction(direction)
+        , remaining(length)
+    {
+        if (splice)
+            pipe = eventLoop->acquirePipe();
+    }
+
+    ~RelayChannel()
+    {
+        if (pipe.readFd != -1)
+            eventLoop->releasePipe(pipe, !inPipe);
+    }
+
+    inline bool done() const noexcept
+    {
+        return (sourceEnd || !remaining) && !inPipe && !pending.length;
+    }
+
+    SessionsEventLoop *eventLoop;
+    Dracon::RelayDirection direction;
+    size_t remaining;
+    SessionsEventLoop::Pipe pipe;
+    size_t inPipe = 0;
+    std::string buffer;
+    Dracon::ConstBuffer pending;
+    bool sourceEnd = false;
+};
+
+size_t BasicHttpSession::relay(int fd, Dracon::RelayDirection direction, size_t length) noexcept(false)
+{
+    RelayChannel channel{m_eventLoop, direction, length, canSplice()};
+    if (direction == Dracon::RelayDirection::FromStream && m_httpParserBuffer.currentSize()) {
+        // the bytes already read by the http parser
+        auto size = std::min(length, m_httpParserBuffer.currentSize());
+        channel.buffer.assign(m_httpParserBuffer.currentData(), size);
+        channel.pending = channel.buffer;
+        channel.remaining -= size;
+        m_httpParserBuffer.advance(size);
+        if (!m_httpParserBuffer.currentSize())
+            m_httpParserBuffer.clear();
+    }
+    while (!channel.done()) {
+        if (!relaySome(channel, fd)) {
+            if (auto ec = m_yield().get())
+                throw ec;
+        }
+    }
+    return length - channel.remaining;
+}
+
+/*!
+ * \brief BasicHttpSession::relaySome
+ *
+ * Moves as many bytes as possible without blocking.
+ *
+ * \return true if any progress was made, false if both sides would block
+ */
+bool BasicHttpSession::relaySome(RelayChannel &channel, int fd) noexcept(false)
+{
+    const bool toStream = channel.direction == Dracon::RelayDirection::ToStream;
+    const int source = toStream ? fd : m_socket;
+    const int destination = toStream ? m_socket : fd;
+    bool progress = false;
+    for (;;) {
+        if (channel.pending.length) {
+            ssize_t written;
+            if (toStream) {
+                std::error_code ec;
+                written = writeSome(channel.pending, ec);
+                if (ec)
+                    throw ec;
+            } else {
+                written = ::send(fd, channel.pending.ptr, channel.pending.length, MSG_NOSIGNAL);
+                if (written < 0) {
+                    if (errno == EINTR)
+                        continue;
+                    if (errno != EAGAIN)
+                        throw std::make_error_code(std::errc(errno));
+                    written = 0;
+                }
+            }
+            if (!written)
+                return progress;
+            channel.pending.c_ptr += written;
+            channel.pending.length -= written;
+            progress = true;
+            continue;
+        }
+
+        if (channel.inPipe) {
+            auto spliced = ::splice(channel.pipe.readFd, nullptr, destination, nullptr,
+                                    channel.inPipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (spliced < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    return progress;
+                throw std::make_error_code(std::errc(errno));
+            }
+            if (toStream)
+                m_can_write_errror = false;
+            channel.inPipe -= spliced;
+            progress = true;
+            continue;
+        }
+
+        if (channel.sourceEnd || !channel.remaining)
+            return progress;
+
+        const auto size = std::min(channel.remaining, RelayChunkSize);
+        if (channel.pipe.writeFd != -1) {
+            auto spliced = ::splice(source, nullptr, channel.pipe.writeFd, nullptr,
+                                    size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK | SPLICE_F_MORE);
+            if (spliced < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    return progress;
+                throw std::make_error_code(std::errc(errno));
+            }
+            if (!spliced)
+                channel.sourceEnd = true;
+            channel.inPipe += spliced;
+            channel.remaining -= spliced;
+            progress = true;
+            continue;
+        }
+
+        // buffered copy, used by the secured connections
+        channel.buffer.resize(size);
+        ssize_t sz;
+        if (toStream) {
+            sz = ::read(fd, channel.buffer.data(), size);
+            if (sz < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN)
+                    return progress;
+                throw std::make_error_code(std::errc(errno));
+            }
+            if (!sz)
+                channel.sourceEnd = true;
+        } else {
+            std::error_code ec;
+            sz = readSome({channel.buffer.data(), size}, ec);
+            if (ec)
+                throw ec;
+            if (!sz)
+                return progress;
+        }
+        channel.pending = Dracon::ConstBuffer{channel.buffer.data(), size_t(sz)};
+        channel.remaining -= sz;
+        progress = true;
+    }
+}
+
 void BasicHttpSession::setKeepAlive(std::chrono::seconds seconds) noexcept
 {
     m_keepAlive = seconds;
@@ -193,6 +389,19 @@ const std::string &BasicHttpSession::peerAddress() const noexcept
     return m_peerAddress;
 }
 
+std::optional<Dracon::PeerCredentials> BasicHttpSession::peerCredentials() const noexcept
+{
+    sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(m_socket, reinterpret_cast<sockaddr *>(&addr), &len) || addr.ss_family != AF_UNIX)
+        return {};
+    ucred cred;
+    len = sizeof(cred);
+    if (getsockopt(m_socket, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+        return {};
+    return Dracon::PeerCredentials{cred.pid, cred.uid, cred.gid};
+}
+
 int BasicHttpSession::socketWriteSize() const noexcept(false)
 {
     int optval = 0;
@@ -244,10 +453,11 @@ void BasicHttpSession::ioLoop()
 {
     try {
         setSessionTimeout(Server::headersTimeout());
+        HandlerStorage storage;
         do {
             Dracon::Request req = readHeaders();
             setKeepAlive(req.keepAlive() * Server::keepAliveTimeout());
-            auto session = Server::instance().create_session(req);
+            auto session = Server::instance().create_session(req, storage);
             if (!session) {
                 INFO(Getodac::ServerLogger) << peerAddress() << " invalid url " << req.method() << " " << req.url();
                 write(Dracon::Response{503}.toString());
@@ -337,6 +547,7 @@ int BasicHttpSession::body(http_parser *parser, const char *at, size_t length)
 int BasicHttpSession::messageComplete(http_parser *parser)
 {
     auto data = reinterpret_cast<http_parser_data*>(parser->data);
+    data->req.bodyCompleted();
     data->req.setState(Dracon::Request::State::Completed);
     return 0;
 }
@@ -396,8 +607,8 @@ Dracon::Request BasicHttpSession::readHeaders()
 }
 
 
-SocketSession::SocketSession(SessionsEventLoop *eventLoop, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper)
-    : BasicHttpSession(eventLoop, socket, yield, peerAddress, wakeupper)
+SocketSession::SocketSession(SessionsEventLoop *eventLoop, BasicServerSession *session, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper)
+    : BasicHttpSession(eventLoop, session, socket, yield, peerAddress, wakeupper)
 {}
 
 void SocketSession::shutdown() noexcept
@@ -455,8 +666,8 @@ ssize_t SocketSession::writeSome(std::vector<Dracon::ConstBuffer> buff, std::err
     return res;
 }
 
-SslSocketSession::SslSocketSession(SessionsEventLoop *eventLoop, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper)
-    : BasicHttpSession(eventLoop, socket, yield, peerAddress, wakeupper)
+SslSocketSession::SslSocketSession(SessionsEventLoop *eventLoop, BasicServerSession *session, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper)
+    : BasicHttpSession(eventLoop, session, socket, yield, peerAddress, wakeupper)
     , m_SSL(std::unique_ptr<SSL, void (*)(SSL *)>(SSL_new(Server::instance().sslContext()), SSL_free))
 {
     if (!m_SSL)
@@ -40,6 +40,7 @@ using Clock = std::chrono::high_resolution_clock;
 using TimePoint = std::chrono::time_point<Clock>;
 using namespace std::chrono_literals;
 
+class BasicServerSession;
 class SessionsEventLoop;
 
 struct MutableBuffer
@@ -60,7 +61,7 @@ struct MutableBuffer
 class BasicHttpSession : public Dracon::AbstractStream
 {
 public:
-    BasicHttpSession(SessionsEventLoop *eventLoop, int socket, YieldType &yield, const std::string& peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper);
+    BasicHttpSession(SessionsEventLoop *eventLoop, BasicServerSession *session, int socket, YieldType &yield, const std::string& peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper);
     ~BasicHttpSession() override;
 
     // abstract_stream interface
@@ -71,10 +72,16 @@ public:
     std::error_code yield() noexcept override;
     std::shared_ptr<AbstractWakeupper> wakeupper() const noexcept override;
 
+    void watchDescriptor(int fd, uint32_t events) noexcept(false) override;
+    void unwatchDescriptor(int fd) noexcept override;
+
+    size_t relay(int fd, Dracon::RelayDirection direction, size_t length) noexcept(false) override;
+
     void setKeepAlive(std::chrono::seconds seconds) noexcept override;
     std::chrono::seconds keepAlive() const noexcept override;
 
     const std::string& peerAddress() const noexcept override;
+    std::optional<Dracon::PeerCredentials> peerCredentials() const noexcept override;
 
     int socketWriteSize() const noexcept(false) override;
     void setSocketWriteSize(int size) noexcept(false) override;
@@ -102,8 +109,14 @@ protected:
     virtual ssize_t writeSome(Dracon::ConstBuffer buff, std::error_code &ec) noexcept = 0;
     virtual ssize_t writeSome(std::vector<Dracon::ConstBuffer> buff, std::error_code &ec) noexcept = 0;
 
+    /// \return true if the bytes can be spliced directly from/to the socket
+    virtual bool canSplice() const noexcept { return false; }
+
     Dracon::Request readHeaders();
 
+    struct RelayChannel;
+    bool relaySome(RelayChannel &channel, int fd) noexcept(false);
+
 protected:
     YieldType &m_yield;
     int m_socket;
@@ -111,6 +124,8 @@ protected:
     std::chrono::seconds m_sessionTimeout{0};
     TimePoint m_sessionTimeoutTimePoint;
     SessionsEventLoop *m_eventLoop;
+    BasicServerSession *m_session;
+    std::vector<int> m_watchedDescriptors;
 
     http_parser m_parser;
     http_parser_settings m_settings;
@@ -123,7 +138,7 @@ protected:
 class SocketSession final: public BasicHttpSession
 {
 public:
-    SocketSession(Getodac::SessionsEventLoop *eventLoop, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper);
+    SocketSession(Getodac::SessionsEventLoop *eventLoop, BasicServerSession *session, int socket, YieldType &yield, const std::string &peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper);
 
 protected:
     // basic_http_session interface
@@ -131,12 +146,13 @@ protected:
     ssize_t readSome(MutableBuffer buff, std::error_code &ec) noexcept final;
     ssize_t writeSome(Dracon::ConstBuffer buff, std::error_code &ec) noexcept final;
     ssize_t writeSome(std::vector<Dracon::ConstBuffer> buff, std::error_code &ec) noexcept final;
+    bool canSplice() const noexcept final { return true; }
 };
 
 class SslSocketSession final: public BasicHttpSession
 {
 public:
-    SslSocketSession(Getodac::SessionsEventLoop *eventLoop, int socket, YieldType &yield, const std::string& peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper);
+    SslSocketSession(Getodac::SessionsEventLoop *eventLoop, BasicServerSession *session, int socket, YieldType &yield, const std::string& peerAddress, const std::shared_ptr<AbstractWakeupper> &wakeupper);
 
 protected:
     // basic_http_session interface
@@ -0,0 +1,82 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "virtualhosts.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+
+namespace Getodac {
+
+void VirtualHosts::load(const boost::property_tree::ptree &properties)
+{
+    m_sites.clear();
+    m_names.clear();
+    m_wildcards.clear();
+    for (const auto &p : properties) {
+        auto site = std::make_unique<Site>();
+        site->name = p.first;
+        std::transform(site->name.begin(), site->name.end(), site->name.begin(), [](unsigned char ch) { return std::tolower(ch); });
+        if (auto plugins = p.second.get_child_optional("plugins")) {
+            for (const auto &plugin : *plugins)
+                site->plugins.push_back(plugin.first);
+        }
+        std::string_view name = site->name;
+        bool wildcard = name.size() > 2 && name.substr(0, 2) == "*.";
+        auto &names = wildcard ? m_wildcards : m_names;
+        if (!names.emplace(wildcard ? name.substr(1) : name, site.get()).second)
+            throw std::runtime_error{"Duplicated virtual host " + site->name};
+        m_sites.push_back(std::move(site));
+    }
+}
+
+void VirtualHosts::build(const std::vector<ServerPlugin> &plugins)
+{
+    for (auto &site : m_sites) {
+        std::vector<uint8_t> enabled(plugins.size(), site->plugins.empty());
+        for (size_t i = 0; i < plugins.size(); ++i) {
+            if (std::find(site->plugins.begin(), site->plugins.end(), plugins[i].name()) != site->plugins.end())
+                enabled[i] = 1;
+        }
+        site->index.build(plugins, &enabled);
+    }
+}
+
+const VirtualHosts::Site *VirtualHosts::find(std::string_view host) const
+{
+    char buffer[256];
+    if (host.empty() || host.size() > sizeof(buffer))
+        return nullptr;
+    for (size_t i = 0; i < host.size(); ++i)
+        buffer[i] = std::tolower(static_cast<unsigned char>(host[i]));
+    std::string_view name{buffer, host.size()};
+    auto it = m_names.find(name);
+    if (it != m_names.end())
+        return it->second;
+    if (m_wildcards.empty())
+        return nullptr;
+    // the longest matching domain wins
+    for (auto pos = name.find('.'); pos != std::string_view::npos; pos = name.find('.', pos + 1)) {
+        it = m_wildcards.find(name.substr(pos));
+        if (it != m_wildcards.end())
+            return it->second;
+    }
+    return nullptr;
+}
+
+} // namespace Getodac
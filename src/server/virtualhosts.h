@@ -0,0 +1,66 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/property_tree/ptree.hpp>
+
+#include "pluginsindex.h"
+#include "serverplugin.h"
+
+namespace Getodac {
+
+/*!
+ * \brief The VirtualHosts class
+ *
+ * The sites configured in the "virtual_hosts" section of server.conf, each one
+ * with its own plugins. A site named "*.example.com" serves all the subdomains of example.com,
+ * the exact names are preferred.
+ */
+class VirtualHosts
+{
+public:
+    struct Site
+    {
+        std::string name;
+        // the plugins file names, all of them if it's empty
+        std::vector<std::string> plugins;
+        PluginsIndex index;
+    };
+
+public:
+    void load(const boost::property_tree::ptree &properties);
+    void build(const std::vector<ServerPlugin> &plugins);
+    bool empty() const { return m_sites.empty(); }
+
+    /// The site which serves \a host, null if none
+    const Site *find(std::string_view host) const;
+
+private:
+    std::vector<std::unique_ptr<Site>> m_sites;
+    // the keys are views of the sites names, the wildcards are keyed on their ".domain" suffix
+    std::unordered_map<std::string_view, const Site *> m_names;
+    std::unordered_map<std::string_view, const Site *> m_wildcards;
+};
+
+} // namespace Getodac
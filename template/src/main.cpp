@@ -13,6 +13,7 @@
 #include <shared_mutex>
 
 
+#include <dracon/compression.h>
 #include <dracon/http.h>
 #include <dracon/restful.h>
 #include <dracon/stream.h>
@@ -31,39 +32,31 @@ TaggedLogger<> g_logger{"MyCoolProject"};
 
 namespace {
 Dracon::RESTfulRouterType s_restullV1RootNode("/v1/");
-const std::string device_id{"device"};
 std::vector<std::string> s_devices;
 std::shared_mutex s_mutex; // getodac is a highly concurrent HTTP server,
                            // therefore all resources must be protected properly
 }
 
-void getDevices(const Dracon::ParsedRoute &route, Dracon::AbstractStream &stream, Dracon::Request &req)
-{
-    // The request at this point is partial, next line will read the rest of the request
-    stream >> req;
+// the {device} captures are parsed and validated by the router
+using DeviceRoute = Dracon::TypedParsedRoute<Dracon::Capture::Integer<size_t>>;
 
-    json res = json::array();
-    // as this function is use by both device and device/{device} routes
-    // we need to check if we have the {device} resource and return the
-    // appropriate results
-    {
-        std::shared_lock lock{s_mutex};
-        auto it = route.capturedResources.find(device_id);
-        if (it != route.capturedResources.end()) {
-            size_t idx = std::stoul(it->second.c_str());
-            if (idx >= s_devices.size())
-                throw 400; // bad request
-            res.push_back({ {"id:", idx}, {"name", s_devices[idx]}});
-        } else {
-            for (size_t i = 0; i < s_devices.size(); ++i)
-                res.push_back({ {"id:", i}, {"name", s_devices[i]}});
-        }
-    } // don't keep the mutex locked while we're sending the data
+void sendJson(const json &res, Dracon::AbstractStream &stream, Dracon::Request &req)
+{
 #ifndef __USE_CHUNCKED
-    stream << Dracon::Response{200 /* res code */,
-                               res.dump(), /* body */
-                               {{"Content-Type","application/json"}} /* headers */
-                              };
+    Dracon::Response response{200 /* res code */,
+                              {}, /* body */
+                              {{"Content-Type","application/json"}} /* headers */
+                             };
+    auto body = res.dump();
+    // compress the big responses if the client accepts it
+    auto encoding = Dracon::prepareCompression(req, response, body.size());
+    if (encoding == Dracon::ContentEncoding::Identity) {
+        stream << response.setBody(std::move(body));
+    } else {
+        stream << response;
+        Dracon::ChunkedStream chunkedStream{stream};
+        Dracon::CompressedStream{chunkedStream, encoding}.write(body);
+    }
 #else
     // the following code is doing the same as the above one
     // is here only to show how to do Chuncked data transfer
@@ -77,12 +70,43 @@ void getDevices(const Dracon::ParsedRoute &route, Dracon::AbstractStream &stream
 #endif
 }
 
+void getDevices(const Dracon::ParsedRoute &, Dracon::AbstractStream &stream, Dracon::Request &req)
+{
+    // The request at this point is partial, next line will read the rest of the request
+    stream >> req;
+
+    json res = json::array();
+    {
+        std::shared_lock lock{s_mutex};
+        for (size_t i = 0; i < s_devices.size(); ++i)
+            res.push_back({ {"id:", i}, {"name", s_devices[i]}});
+    } // don't keep the mutex locked while we're sending the data
+    sendJson(res, stream, req);
+}
+
+void getDevice(const DeviceRoute &route, Dracon::AbstractStream &stream, Dracon::Request &req)
+{
+    // The request at this point is partial, next line will read the rest of the request
+    stream >> req;
+
+    json res = json::array();
+    {
+        std::shared_lock lock{s_mutex};
+        auto idx = std::get<0>(route.captures);
+        if (idx >= s_devices.size())
+            throw 400; // bad request
+        res.push_back({ {"id:", idx}, {"name", s_devices[idx]}});
+    } // don't keep the mutex locked while we're sending the data
+    sendJson(res, stream, req);
+}
+
 void postDevices(const Dracon::ParsedRoute &, Dracon::AbstractStream &stream, Dracon::Request &req)
 {
     // The request at this point is partial,
     // next lines will read the rest of the request including the body
     std::string body;
-    req.appendBodyCallback([&](std::string_view buff){
+    // the gzip and deflate encoded bodies are decompressed on the fly
+    Dracon::appendDecompressedBodyCallback(req, [&](std::string_view buff){
         body.append(buff);
         if (body.size() > 512 * 1024)
             throw 400; // bad request
@@ -100,25 +124,22 @@ void postDevices(const Dracon::ParsedRoute &, Dracon::AbstractStream &stream, Dr
     stream << Dracon::Response{200};
 }
 
-void patchDevice(const Dracon::ParsedRoute &route, Dracon::AbstractStream &stream, Dracon::Request &req)
+void patchDevice(const DeviceRoute &route, Dracon::AbstractStream &stream, Dracon::Request &req)
 {
     // The request at this point is partial,
     // next lines will read the rest of the request including the body
     std::string body;
-    req.appendBodyCallback([&](std::string_view buff){
+    // the gzip and deflate encoded bodies are decompressed on the fly
+    Dracon::appendDecompressedBodyCallback(req, [&](std::string_view buff){
         body.append(buff);
         if (body.size() > 512 * 1024)
             throw 400; // bad request
     }, 512 * 1024);
     stream >> req;
 
-    auto it = route.capturedResources.find(device_id);
-    if (it == route.capturedResources.end())
-        throw 404; // not found
-
     {
         std::unique_lock lock{s_mutex};
-        size_t idx = std::stoul(it->second.c_str());
+        auto idx = std::get<0>(route.captures);
         if (idx >= s_devices.size())
             throw 400; // bad request
         auto jb = json::parse(body);
@@ -128,16 +149,12 @@ void patchDevice(const Dracon::ParsedRoute &route, Dracon::AbstractStream &strea
     stream << Dracon::Response{200};
 }
 
-void deleteDevice(const Dracon::ParsedRoute &route, Dracon::AbstractStream &stream, Dracon::Request &req)
+void deleteDevice(const DeviceRoute &route, Dracon::AbstractStream &stream, Dracon::Request &req)
 {
     // The request at this point is partial, next line will read the rest of the request
     stream >> req;
 
-    auto it = route.capturedResources.find(device_id);
-    if (it == route.capturedResources.end())
-        throw 404; // not found
-
-    size_t idx = std::stoul(it->second.c_str());
+    auto idx = std::get<0>(route.captures);
     {
         std::unique_lock lock{s_mutex};
         if (idx >= s_devices.size())
@@ -188,9 +205,9 @@ PLUGIN_EXPORT bool init_plugin(const std::string &confDir)
                 ->addMethodHandler("GET", Dracon::sessionHandler(getDevices))
                 .addMethodHandler("POST", Dracon::sessionHandler(postDevices));
 
-        // devices/{device}
-        s_restullV1RootNode.createRoute("devices/{device}")
-                ->addMethodHandler("GET", Dracon::sessionHandler(getDevices))
+        // devices/{device}, the non numeric devices don't match this route
+        s_restullV1RootNode.createTypedRoute<Dracon::Capture::Integer<size_t>>("devices/{device}")
+                .addMethodHandler("GET", Dracon::sessionHandler(getDevice))
                 .addMethodHandler("PATCH", Dracon::sessionHandler(patchDevice))
                 .addMethodHandler("DELETE", Dracon::sessionHandler(deleteDevice));
 
@@ -211,14 +228,22 @@ PLUGIN_EXPORT uint32_t plugin_order()
     return 0;
 }
 
-PLUGIN_EXPORT Dracon::HttpSession create_session(Dracon::Request &req)
+PLUGIN_EXPORT Dracon::HttpSession create_session(const Dracon::Request &req)
 {
     const auto &url = req.url();
     const auto &method = req.method();
     return s_restullV1RootNode.createHandler(url, method);
 }
 
+PLUGIN_EXPORT Dracon::PluginRoutes plugin_routes()
+{
+    // The server calls create_session only for the requests under these prefixes
+    return {{"/v1/"}};
+}
+
 PLUGIN_EXPORT void destory_plugin()
 {
     // This function is called by the server when it closes. The plugin should wait in this function until it finishes the clean up.
 }
+
+DRACON_REGISTER_PLUGIN(restfulTemplate, init_plugin, create_session, plugin_order, destory_plugin, plugin_routes);
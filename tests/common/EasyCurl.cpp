@@ -122,10 +122,12 @@ size_t EasyCurl::header_callback(char *buffer, size_t size, size_t nitems, EasyC
         boost::split(status, header, boost::is_any_of(" "));
         response->status = status.size() > 1 ? status[1] : "unknown";
     } else {
-        std::vector<std::string> kv;
-        boost::split(kv, header, boost::is_any_of(":"));
-        std::string key = kv.empty() ? header : kv[0];
-        std::string value = kv.size() == 2 ? kv[1].substr(1) : std::string{};
+        // the values (e.g. dates) may contain ':' too
+        auto pos = header.find(':');
+        std::string key = header.substr(0, pos);
+        std::string value = pos == std::string::npos ? std::string{} : header.substr(pos + 1);
+        if (!value.empty() && value.front() == ' ')
+            value.erase(0, 1);
         response->headers.emplace(key, value);
     }
     return size * nitems;
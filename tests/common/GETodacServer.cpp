@@ -44,12 +44,12 @@ static pid_t pidof(const char *name)
     return atoi(buff);
 }
 
-void startServer(const std::string &path)
+void startServer(const std::string &path, const std::string &arguments)
 {
     if (pidof("GETodac"))
         return;
 
-    s_getodacHandle = popen((path + " --pid").c_str(), "r");
+    s_getodacHandle = popen((path + " --pid " + arguments).c_str(), "r");
     char buf[1024];
     memset(buf, 0, sizeof(buf));
     using clock = std::chrono::system_clock;
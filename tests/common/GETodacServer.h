@@ -31,7 +31,7 @@
 namespace Getodac {
 namespace Test {
 
-void startServer(const std::string &path);
+void startServer(const std::string &path, const std::string &arguments = {});
 void terminateServer();
 
 } // namespace Test
@@ -0,0 +1,288 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <dracon/compression.h>
+
+#include "TestStream.h"
+
+namespace {
+using namespace Dracon;
+using namespace std;
+using TestStream = Dracon::Test::TestStream;
+
+    std::string inflate(const std::string &data, ContentEncoding encoding)
+    {
+        z_stream stream{};
+        EXPECT_EQ(inflateInit2(&stream, encoding == ContentEncoding::Gzip ? 15 + 16 : 15), Z_OK);
+        stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+        stream.avail_in = uInt(data.size());
+        std::string res;
+        char buffer[4096];
+        int ret;
+        do {
+            stream.next_out = reinterpret_cast<Bytef *>(buffer);
+            stream.avail_out = sizeof(buffer);
+            ret = ::inflate(&stream, Z_NO_FLUSH);
+            res.append(buffer, sizeof(buffer) - stream.avail_out);
+        } while (ret == Z_OK);
+        EXPECT_EQ(ret, Z_STREAM_END);
+        inflateEnd(&stream);
+        return res;
+    }
+
+    Request request(std::string acceptEncoding)
+    {
+        Request req;
+        if (!acceptEncoding.empty())
+            req["Accept-Encoding"] = std::move(acceptEncoding);
+        return req;
+    }
+
+    TEST(Compression, negotiateEncoding)
+    {
+        EXPECT_EQ(negotiateEncoding(request({})), ContentEncoding::Identity);
+        EXPECT_EQ(negotiateEncoding(request("gzip, deflate, br")), ContentEncoding::Gzip);
+        EXPECT_EQ(negotiateEncoding(request("deflate")), ContentEncoding::Deflate);
+        EXPECT_EQ(negotiateEncoding(request("gzip;q=0.5, deflate")), ContentEncoding::Deflate);
+        EXPECT_EQ(negotiateEncoding(request("GZIP;q=0, deflate;q=0")), ContentEncoding::Identity);
+        EXPECT_EQ(negotiateEncoding(request("*")), ContentEncoding::Gzip);
+        EXPECT_EQ(negotiateEncoding(request("gzip;q=0, *")), ContentEncoding::Deflate);
+        EXPECT_EQ(negotiateEncoding(request("br, identity")), ContentEncoding::Identity);
+    }
+
+    TEST(Compression, acceptsEncoding)
+    {
+        EXPECT_TRUE(acceptsEncoding(request("gzip;q=0.5, deflate"), ContentEncoding::Gzip));
+        EXPECT_FALSE(acceptsEncoding(request("deflate"), ContentEncoding::Gzip));
+        EXPECT_FALSE(acceptsEncoding(request("gzip;q=0"), ContentEncoding::Gzip));
+        EXPECT_TRUE(acceptsEncoding(request("*"), ContentEncoding::Deflate));
+        EXPECT_TRUE(acceptsEncoding(request({}), ContentEncoding::Identity));
+    }
+
+    TEST(Compression, isCompressibleType)
+    {
+        EXPECT_TRUE(isCompressibleType("text/html; charset=utf-8"));
+        EXPECT_TRUE(isCompressibleType("application/json"));
+        EXPECT_TRUE(isCompressibleType("application/ld+json"));
+        EXPECT_TRUE(isCompressibleType("image/svg+xml"));
+        EXPECT_TRUE(isCompressibleType("Application/JavaScript"));
+        EXPECT_FALSE(isCompressibleType("image/png"));
+        EXPECT_FALSE(isCompressibleType("application/zip"));
+        EXPECT_FALSE(isCompressibleType("font/woff2"));
+        EXPECT_FALSE(isCompressibleType({}));
+    }
+
+    TEST(Compression, prepareCompression)
+    {
+        {
+            Response res{200, {}, {{"Content-Type", "text/plain"}}};
+            EXPECT_EQ(prepareCompression(request("gzip"), res, 100 * 1024), ContentEncoding::Gzip);
+            EXPECT_EQ(res["Content-Encoding"], "gzip");
+            EXPECT_EQ(res["Vary"], "Accept-Encoding");
+            EXPECT_EQ(res.contentLength(), ChunkedData);
+        }
+        {
+            // too small
+            Response res{200, {}, {{"Content-Type", "text/plain"}, {"Vary", "Origin"}}};
+            EXPECT_EQ(prepareCompression(request("gzip"), res, 100), ContentEncoding::Identity);
+            EXPECT_EQ(res.count("Content-Encoding"), 0);
+            EXPECT_EQ(res["Vary"], "Origin, Accept-Encoding");
+        }
+        {
+            // incompressible
+            Response res{200, {}, {{"Content-Type", "image/jpeg"}}};
+            EXPECT_EQ(prepareCompression(request("gzip"), res), ContentEncoding::Identity);
+            EXPECT_EQ(res.count("Content-Encoding"), 0);
+        }
+        {
+            // not accepted
+            Response res{200, {}, {{"Content-Type", "application/json"}}};
+            EXPECT_EQ(prepareCompression(request({}), res), ContentEncoding::Identity);
+            EXPECT_EQ(res.count("Content-Encoding"), 0);
+        }
+    }
+
+    TEST(Compression, compressedStream)
+    {
+        std::string data;
+        for (int i = 0; i < 10000; ++i)
+            data += "line " + std::to_string(i) + "\n";
+        for (auto encoding : {ContentEncoding::Gzip, ContentEncoding::Deflate}) {
+            TestStream stream;
+            {
+                CompressedStream compressed{stream, encoding};
+                compressed.write(std::string_view{data}.substr(0, 1000));
+                compressed.flush();
+                // Z_SYNC_FLUSH makes everything written so far available to the peer
+                EXPECT_FALSE(stream.written.empty());
+                compressed.write(std::string_view{data}.substr(1000));
+            }
+            EXPECT_LT(stream.written.size(), data.size() / 2);
+            EXPECT_EQ(inflate(stream.written, encoding), data);
+
+            // the pooled zlib state must be reset properly
+            TestStream stream2;
+            CompressedStream{stream2, encoding}.write(std::string{"hello"});
+            EXPECT_EQ(inflate(stream2.written, encoding), "hello");
+        }
+
+        TestStream identity;
+        CompressedStream{identity, ContentEncoding::Identity}.write(std::string{"hello"});
+        EXPECT_EQ(identity.written, "hello");
+    }
+
+    TEST(Compression, compress)
+    {
+        std::string data(100 * 1024, 'z');
+        auto gzip = compress(data);
+        EXPECT_LT(gzip.size(), 1024);
+        EXPECT_EQ(inflate(gzip, ContentEncoding::Gzip), data);
+        EXPECT_EQ(inflate(compress(data, ContentEncoding::Deflate), ContentEncoding::Deflate), data);
+        EXPECT_EQ(inflate(compress({}), ContentEncoding::Gzip), "");
+    }
+
+    TEST(Compression, chunked)
+    {
+        std::string data(64 * 1024, 'a');
+        TestStream stream;
+        {
+            ChunkedStream chunked{stream};
+            CompressedStream{chunked, ContentEncoding::Gzip}.write(data);
+        }
+        std::string_view written{stream.written};
+        EXPECT_EQ(written.substr(written.size() - 5), "0\r\n\r\n");
+        std::string body;
+        while (!written.empty()) {
+            auto pos = written.find("\r\n");
+            auto size = std::stoul(std::string{written.substr(0, pos)}, nullptr, 16);
+            body.append(written.substr(pos + 2, size));
+            written.remove_prefix(pos + 4 + size);
+        }
+        EXPECT_EQ(inflate(body, ContentEncoding::Gzip), data);
+    }
+
+    TEST(Compression, decompressBody)
+    {
+        std::string data;
+        for (int i = 0; i < 10000; ++i)
+            data += "{\"sample\": " + std::to_string(i) + "}\n";
+        for (auto encoding : {"gzip", "deflate"}) {
+            Request req;
+            req["Content-Encoding"] = encoding;
+            std::string body;
+            size_t chunks = 0;
+            appendDecompressedBodyCallback(req, [&](std::string_view buff) {
+                body.append(buff);
+                ++chunks;
+            });
+            auto compressed = compress(data, encoding == std::string{"gzip"} ? ContentEncoding::Gzip
+                                                                             : ContentEncoding::Deflate);
+            // the plain chunks are delivered as the compressed ones arrive
+            for (size_t pos = 0; pos < compressed.size(); pos += 100) {
+                req.appendBody(std::string_view{compressed}.substr(pos, 100));
+                EXPECT_LE(body.size(), data.size());
+            }
+            EXPECT_NO_THROW(req.bodyCompleted());
+            EXPECT_EQ(body, data);
+            EXPECT_GT(chunks, 1);
+        }
+        {
+            // concatenated gzip members, written in two chunks split at and around their boundary
+            auto compressed = compress(data.substr(0, 1000)) + compress(data.substr(1000));
+            auto firstSize = compress(data.substr(0, 1000)).size();
+            for (auto split : {firstSize, firstSize - 1, firstSize + 1, firstSize + 10}) {
+                std::string body;
+                BodyDecompressor members{[&](std::string_view buff) { body.append(buff); }, data.size()};
+                members.write(std::string_view{compressed}.substr(0, split));
+                members.write(std::string_view{compressed}.substr(split));
+                EXPECT_NO_THROW(members.finish());
+                EXPECT_EQ(body, data);
+            }
+        }
+        {
+            // not compressed
+            Request req;
+            std::string body;
+            appendDecompressedBodyCallback(req, [&](std::string_view buff) { body.append(buff); });
+            req.appendBody("plain");
+            EXPECT_NO_THROW(req.bodyCompleted());
+            EXPECT_EQ(body, "plain");
+        }
+    }
+
+    TEST(Compression, decompressBodyErrors)
+    {
+        auto status = [](const std::function<void()> &f) -> uint16_t {
+            try {
+                f();
+            } catch (const Response &res) {
+                return res.statusCode();
+            }
+            return 0;
+        };
+        auto sink = [](std::string_view) {};
+        {
+            Request req;
+            req["Content-Encoding"] = "br";
+            EXPECT_EQ(status([&]{ appendDecompressedBodyCallback(req, sink); }), 415);
+        }
+        {
+            Request req;
+            req["Content-Encoding"] = "gzip";
+            appendDecompressedBodyCallback(req, sink);
+            EXPECT_EQ(status([&]{ req.appendBody("definitely not gzip"); }), 400);
+        }
+        {
+            // truncated
+            Request req;
+            req["Content-Encoding"] = "gzip";
+            appendDecompressedBodyCallback(req, sink);
+            auto compressed = compress(std::string(10000, 'a'));
+            req.appendBody(std::string_view{compressed}.substr(0, compressed.size() / 2));
+            EXPECT_EQ(status([&]{ req.bodyCompleted(); }), 400);
+        }
+        {
+            // trailing garbage after a member, in the same and in the next chunk
+            auto compressed = compress(std::string(10000, 'a'));
+            BodyDecompressor same{sink, 1024 * 1024};
+            EXPECT_EQ(status([&]{ same.write(compressed + "garbage"); }), 400);
+            BodyDecompressor next{sink, 1024 * 1024};
+            next.write(compressed);
+            EXPECT_EQ(status([&]{ next.write("garbage"); }), 400);
+            // ... or a truncated second member
+            BodyDecompressor truncated{sink, 1024 * 1024};
+            truncated.write(compressed);
+            truncated.write(std::string_view{compressed}.substr(0, 20));
+            EXPECT_EQ(status([&]{ truncated.finish(); }), 400);
+        }
+        {
+            // too big
+            Request req;
+            req["Content-Encoding"] = "gzip";
+            appendDecompressedBodyCallback(req, sink, 64 * 1024, 10000);
+            EXPECT_EQ(status([&]{ req.appendBody(compress(std::string(100 * 1024, 'a'))); }), 413);
+        }
+        {
+            // decompression bomb
+            Request req;
+            req["Content-Encoding"] = "gzip";
+            appendDecompressedBodyCallback(req, sink);
+            EXPECT_EQ(status([&]{ req.appendBody(compress(std::string(10 * 1024 * 1024, '\0'))); }), 413);
+        }
+    }
+} // namespace
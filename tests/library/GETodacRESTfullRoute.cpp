@@ -17,8 +17,40 @@
 
 #include <gtest/gtest.h>
 #include <dracon/restful.h>
+#include <cstdlib>
+#include <new>
 #include <optional>
 
+namespace {
+// counts the allocations of the current thread, see the noAllocations test
+thread_local size_t t_allocations = 0;
+}
+
+void *operator new(size_t size)
+{
+    ++t_allocations;
+    if (auto ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+enum class Color { Red, Green };
+template <>
+struct Dracon::Capture::EnumNames<Color>
+{
+    static constexpr std::pair<std::string_view, Color> values[] = {{"red", Color::Red}, {"green", Color::Green}};
+};
+
 namespace {
     using namespace std;
     using namespace Dracon;
@@ -279,4 +311,125 @@ namespace {
         EXPECT_EQ(1111, router.createHandler("//parents//Anna//George////children///Jonny/14/165////?&&&key1=value1&&&&key2=value2&key3=value3&&&", "GET", 111));
         // -------------------------------------------------------- //
     }
+    TEST(RESTfulRoute, routeTree)
+    {
+        TestRouter router{"/api"};
+        auto returns = [](int value) {
+            return [value](const ParsedRoute &, int) -> std::optional<int> { return value; };
+        };
+        router.createRoute("/items/{id}")->addMethodHandler("GET", returns(1));
+        router.createRoute("/items/latest")->addMethodHandler("GET", returns(2));
+        router.createRoute("/items/{id}/parts")->addMethodHandler("GET", returns(3));
+        router.createRoute("/items/latest/tags")->addMethodHandler("GET", returns(4));
+        // the same segments with other capture names, the first one wins
+        router.createRoute("/items/{other}")->addMethodHandler("GET", returns(5));
+        router.createRoute("/{kind}/{id}/parts/{part}")->addMethodHandler("GET", [](const ParsedRoute &parsedRoute, int) -> std::optional<int> {
+            EXPECT_EQ(parsedRoute.capturedResources.size(), 3);
+            EXPECT_EQ(parsedRoute.capturedResources.at("kind"), "items");
+            EXPECT_EQ(parsedRoute.capturedResources.at("id"), "latest");
+            EXPECT_EQ(parsedRoute.capturedResources.at("part"), "7");
+            return 6;
+        });
+        for (int i = 0; i < 500; ++i)
+            router.createRoute("/resource" + std::to_string(i) + "/{id}")->addMethodHandler("GET", returns(1000 + i));
+
+        EXPECT_EQ(1, router.createHandler("/api/items/42", "GET", 0));
+        // the static segments are preferred over the captures
+        EXPECT_EQ(2, router.createHandler("/api/items/latest", "GET", 0));
+        // ... but the captures are tried when the static ones don't match
+        EXPECT_EQ(3, router.createHandler("/api/items/latest/parts", "GET", 0));
+        EXPECT_EQ(4, router.createHandler("/api/items/latest/tags", "GET", 0));
+        EXPECT_EQ(6, router.createHandler("/api/items/latest/parts/7", "GET", 0));
+        EXPECT_EQ(1499, router.createHandler("/api/resource499/1", "GET", 0));
+        EXPECT_EQ(std::nullopt, router.createHandler("/api/resource500/1", "GET", 0));
+        EXPECT_EQ(std::nullopt, router.createHandler("/api/items", "GET", 0));
+        EXPECT_EQ(std::nullopt, router.createHandler("/items/42", "GET", 0));
+        EXPECT_THROW(router.createHandler("/api/items/42", "POST", 0), Response);
+    }
+    TEST(RESTfulRoute, capturedResources)
+    {
+        TestRouter router{};
+        router.createRoute("/{a}/{b}/{c}/{d}/{e}/{f}")->addMethodHandler("GET", [](const ParsedRoute &parsedRoute, int) -> std::optional<int> {
+            // more captures than the inline ones
+            EXPECT_EQ(parsedRoute.capturedResources.size(), 6);
+            EXPECT_EQ(parsedRoute.capturedResources.at("a"), "1");
+            EXPECT_EQ(parsedRoute.capturedResources.at("e"), "a-rather-long-value-which-does-not-fit-inline");
+            EXPECT_EQ(parsedRoute.capturedResources.at("f"), "6");
+            EXPECT_EQ(parsedRoute.capturedResources.find("g"), parsedRoute.capturedResources.end());
+            EXPECT_THROW(parsedRoute.capturedResources.at("g"), std::out_of_range);
+            std::string names;
+            for (const auto &resource : parsedRoute.capturedResources)
+                names += resource.first;
+            EXPECT_EQ(names, "abcdef");
+            return 1;
+        });
+        EXPECT_EQ(1, router.createHandler("/1/2/3/4/a-rather-long-value-which-does-not-fit-inline/6", "GET", 0));
+    }
+    TEST(RESTfulRoute, typedRoute)
+    {
+        TestRouter router{};
+        using Id = Capture::Integer<uint32_t, 1, 1000>;
+        router.createTypedRoute<Id>("/items/{id}")
+                .addMethodHandler("GET", [](TypedParsedRoute<Id> parsedRoute, int a) -> std::optional<int> {
+            EXPECT_EQ(parsedRoute.allButOPTIONSNodeMethods, "GET");
+            return std::get<0>(parsedRoute.captures) + a;
+        });
+        // the untyped captures get what the typed ones rejected
+        router.createRoute("/items/{name}")->addMethodHandler("GET", [](const ParsedRoute &parsedRoute, int) -> std::optional<int> {
+            EXPECT_EQ(parsedRoute.capturedResources.size(), 1);
+            return -1;
+        });
+        router.createTypedRoute<Capture::Uuid, Capture::Enumeration<Color>, Capture::String<2, 4>>("/things/{uuid}/{color}/{tag}")
+                .addMethodHandler("PUT", [](TypedParsedRoute<Capture::Uuid, Capture::Enumeration<Color>, Capture::String<2, 4>> parsedRoute, int) -> std::optional<int> {
+            const auto &uuid = std::get<0>(parsedRoute.captures);
+            EXPECT_EQ(uuid[0], 0x12);
+            EXPECT_EQ(uuid[15], 0xff);
+            EXPECT_EQ(std::get<1>(parsedRoute.captures), Color::Green);
+            EXPECT_EQ(std::get<2>(parsedRoute.captures), "tag");
+            EXPECT_EQ(parsedRoute.queryStrings.size(), 1);
+            return 7;
+        });
+
+        EXPECT_EQ(43, router.createHandler("/items/42", "GET", 1));
+        EXPECT_EQ(1001, router.createHandler("/items/1000", "GET", 1));
+        // out of range or not a number, it's not an id
+        EXPECT_EQ(-1, router.createHandler("/items/abc", "GET", 1));
+        EXPECT_EQ(-1, router.createHandler("/items/1001", "GET", 1));
+        EXPECT_EQ(-1, router.createHandler("/items/0", "GET", 1));
+        EXPECT_EQ(-1, router.createHandler("/items/-5", "GET", 1));
+
+        EXPECT_EQ(7, router.createHandler("/things/12345678-9abc-DEF0-1234-56789abcdeff/green/tag?a=b", "PUT", 0));
+        EXPECT_EQ(std::nullopt, router.createHandler("/things/12345678-9abc-DEF0-1234-56789abcdefg/green/tag", "PUT", 0));
+        EXPECT_EQ(std::nullopt, router.createHandler("/things/12345678-9abc-DEF0-1234-56789abcdeff/blue/tag", "PUT", 0));
+        EXPECT_EQ(std::nullopt, router.createHandler("/things/12345678-9abc-DEF0-1234-56789abcdeff/red/tags!", "PUT", 0));
+
+        // every capture must have a type
+        EXPECT_THROW(router.createTypedRoute<Id>("/items/{id}/{other}"), Response);
+    }
+    TEST(RESTfulRoute, noAllocations)
+    {
+        RESTfulRouterType router{"/api"};
+        for (int i = 0; i < 100; ++i)
+            router.createRoute("/resource" + std::to_string(i) + "/{id}");
+        router.createRoute("/parents/{parent}/children/{child}")->addMethodHandler("GET", sessionHandler([](ParsedRoute, AbstractStream &, Request &) {}));
+        using Id = Capture::Integer<uint32_t>;
+        router.createTypedRoute<Id, Id>("/items/{id}/parts/{part}")
+                .addMethodHandler("GET", sessionHandler([](TypedParsedRoute<Id, Id>, AbstractStream &, Request &) {}));
+        const std::string method{"GET"};
+
+        auto allocations = t_allocations;
+        auto session = router.createHandler("//api/parents/Anna/children/George", method);
+        EXPECT_EQ(t_allocations, allocations);
+        EXPECT_TRUE(session);
+
+        allocations = t_allocations;
+        session = router.createHandler("/api/items/42/parts/7", method);
+        EXPECT_EQ(t_allocations, allocations);
+        EXPECT_TRUE(session);
+
+        allocations = t_allocations;
+        session = router.createHandler("/api/items/latest/parts/7", method);
+        EXPECT_EQ(t_allocations, allocations);
+        EXPECT_FALSE(session);
+    }
 }
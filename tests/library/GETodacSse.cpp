@@ -0,0 +1,106 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <dracon/sse.h>
+
+#include "TestStream.h"
+
+namespace {
+using namespace Dracon;
+using namespace std;
+using TestStream = Dracon::Test::TestStream;
+
+    TEST(Sse, encodeSseEvent)
+    {
+        EXPECT_EQ(*encodeSseEvent("hello"), "data: hello\n\n");
+        EXPECT_EQ(*encodeSseEvent("a\nb\r\nc", "update", "42"), "id: 42\nevent: update\ndata: a\ndata: b\ndata: c\n\n");
+        EXPECT_EQ(*encodeSseEvent(""), "data: \n\n");
+    }
+
+    TEST(Sse, broadcast)
+    {
+        SseBroadcaster broadcaster;
+        TestStream stream1, stream2;
+        auto sub1 = broadcaster.subscribe(stream1);
+        auto sub2 = broadcaster.subscribe(stream2);
+        EXPECT_EQ(broadcaster.subscribers(), 2);
+
+        // The first yield parks the subscriber, the event must wake it up
+        stream1.onYield = [&]{
+            EXPECT_EQ(broadcaster.broadcast("one"), 2);
+            EXPECT_EQ(stream1.wakeups(), 1);
+            stream1.onYield = [&] { broadcaster.close(); };
+        };
+        sub1->serve(stream1);
+        EXPECT_EQ(stream1.written, "data: one\n\n");
+
+        // sub2 never went to sleep, so it was never woken up
+        EXPECT_EQ(stream2.wakeups(), 0);
+        sub2->serve(stream2);
+        EXPECT_EQ(stream2.written, "data: one\n\n");
+
+        sub1.reset();
+        EXPECT_EQ(broadcaster.subscribers(), 1);
+
+        // Subscribing to a closed broadcaster ends the stream right away
+        TestStream stream3;
+        auto sub3 = broadcaster.subscribe(stream3);
+        sub3->serve(stream3);
+        EXPECT_TRUE(stream3.written.empty());
+    }
+
+    TEST(Sse, overflow)
+    {
+        {
+            SseBroadcaster broadcaster{2, SseBroadcaster::OverflowPolicy::DropOldest};
+            TestStream stream;
+            auto sub = broadcaster.subscribe(stream);
+            broadcaster.broadcast("1");
+            broadcaster.broadcast("2");
+            broadcaster.broadcast("3");
+            broadcaster.close();
+            sub->serve(stream);
+            EXPECT_EQ(sub->dropped(), 1);
+            EXPECT_EQ(stream.written, "data: 2\n\ndata: 3\n\n");
+            EXPECT_NE(stream.keepAlive().count(), 0);
+        }
+        {
+            SseBroadcaster broadcaster{2, SseBroadcaster::OverflowPolicy::DropNewest};
+            TestStream stream;
+            auto sub = broadcaster.subscribe(stream);
+            broadcaster.broadcast("1");
+            broadcaster.broadcast("2");
+            broadcaster.broadcast("3");
+            broadcaster.close();
+            sub->serve(stream);
+            EXPECT_EQ(sub->dropped(), 1);
+            EXPECT_EQ(stream.written, "data: 1\n\ndata: 2\n\n");
+        }
+        {
+            SseBroadcaster broadcaster{2, SseBroadcaster::OverflowPolicy::Disconnect};
+            TestStream stream;
+            auto sub = broadcaster.subscribe(stream);
+            broadcaster.broadcast("1");
+            broadcaster.broadcast("2");
+            broadcaster.broadcast("3");
+            sub->serve(stream);
+            EXPECT_TRUE(stream.written.empty());
+            EXPECT_EQ(stream.keepAlive().count(), 0);
+        }
+    }
+} // namespace
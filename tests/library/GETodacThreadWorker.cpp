@@ -0,0 +1,190 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <dracon/thread_worker.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "TestStream.h"
+
+namespace {
+using namespace Dracon;
+using namespace std;
+
+    TEST(ThreadWorker, fifo)
+    {
+        vector<int> order;
+        promise<void> blocked, done;
+        ThreadWorker worker;
+        worker.insertTask([&]{ blocked.get_future().wait(); });
+        for (int i = 0; i < 100; ++i)
+            worker.insertTask([&order, i]{ order.push_back(i); });
+        worker.insertTask([&]{ done.set_value(); });
+        blocked.set_value();
+        done.get_future().wait();
+        ASSERT_EQ(order.size(), 100);
+        for (int i = 0; i < 100; ++i)
+            EXPECT_EQ(order[i], i);
+    }
+
+    TEST(ThreadWorker, priorities)
+    {
+        vector<char> order;
+        promise<void> blocked, done;
+        ThreadWorker worker;
+        worker.insertTask([&]{ blocked.get_future().wait(); });
+        worker.insertTask([&]{ order.push_back('l'); done.set_value(); }, ThreadWorker::Priority::Low);
+        worker.insertTask([&]{ order.push_back('n'); });
+        worker.insertTask([&]{ order.push_back('h'); }, ThreadWorker::Priority::High);
+        blocked.set_value();
+        done.get_future().wait();
+        EXPECT_EQ(order, (vector<char>{'h', 'n', 'l'}));
+    }
+
+    TEST(ThreadWorker, capacity)
+    {
+        promise<void> blocked;
+        auto blockedFuture = blocked.get_future().share();
+        promise<void> started;
+        ThreadWorker worker{1, 2};
+        EXPECT_TRUE(worker.tryInsertTask([&]{ started.set_value(); blockedFuture.wait(); }));
+        started.get_future().wait();
+        EXPECT_TRUE(worker.tryInsertTask([]{}));
+        EXPECT_TRUE(worker.tryInsertTask([]{}));
+        EXPECT_FALSE(worker.tryInsertTask([]{}));
+        EXPECT_EQ(worker.pendingTasks(), 2);
+
+        // insertTask waits until there is room
+        auto inserted = async(launch::async, [&]{ return worker.insertTask([]{}); });
+        EXPECT_EQ(inserted.wait_for(50ms), future_status::timeout);
+        blocked.set_value();
+        EXPECT_TRUE(inserted.get());
+    }
+
+    TEST(ThreadWorker, stealing)
+    {
+        mutex lock;
+        condition_variable allStarted;
+        int started = 0;
+        atomic<int> done{0};
+        {
+            ThreadWorker worker{4};
+            // all the tasks are inserted from a single worker, the others must steal them
+            worker.insertTask([&]{
+                for (int i = 0; i < 4; ++i)
+                    worker.insertTask([&]{
+                        unique_lock<mutex> l{lock};
+                        ++started;
+                        allStarted.notify_all();
+                        EXPECT_TRUE(allStarted.wait_for(l, 5s, [&]{ return started == 4; }));
+                        ++done;
+                    });
+            });
+            unique_lock<mutex> l{lock};
+            EXPECT_TRUE(allStarted.wait_for(l, 5s, [&]{ return started == 4; }));
+        }
+        EXPECT_EQ(done, 4);
+    }
+
+    TEST(ThreadWorker, exceptions)
+    {
+        promise<string> error;
+        ThreadWorker worker{2, 0, [&](exception_ptr ptr){
+            try {
+                rethrow_exception(ptr);
+            } catch (const exception &e) {
+                error.set_value(e.what());
+            }
+        }};
+        worker.insertTask([]{ throw runtime_error{"task error"}; });
+        EXPECT_EQ(error.get_future().get(), "task error");
+    }
+
+    TEST(ThreadWorker, offload)
+    {
+        ThreadWorker worker{2};
+        Dracon::Test::TestStream stream;
+        size_t yields = 0;
+        stream.onYield = [&]{ ++yields; this_thread::sleep_for(1ms); };
+        auto result = offload(stream, worker, []{
+            this_thread::sleep_for(20ms);
+            return string{"offloaded"};
+        });
+        EXPECT_EQ(result, "offloaded");
+        EXPECT_GT(yields, 0);
+        EXPECT_EQ(stream.wakeups(), 1);
+
+        // the function may outlive the session, it must not capture its locals by reference
+        auto called = make_shared<atomic_bool>(false);
+        offload(stream, worker, [called]{ *called = true; }, ThreadWorker::Priority::High);
+        EXPECT_TRUE(*called);
+        EXPECT_EQ(stream.wakeups(), 2);
+
+        EXPECT_THROW(offload(stream, worker, []() -> int { throw runtime_error{"task error"}; }), runtime_error);
+        EXPECT_EQ(stream.wakeups(), 3);
+    }
+
+    TEST(ThreadWorker, offloadErrors)
+    {
+        promise<void> blocked;
+        auto blockedFuture = blocked.get_future().share();
+        ThreadWorker worker{1, 1};
+        Dracon::Test::TestStream stream;
+        // the session is canceled while it waits
+        EXPECT_THROW(offload(stream, worker, [=]{ blockedFuture.wait(); }), std::error_code);
+
+        // the queue is full
+        worker.insertTask([]{});
+        try {
+            offload(stream, worker, []{});
+            FAIL();
+        } catch (const Response &response) {
+            EXPECT_EQ(response.statusCode(), 503);
+        }
+        blocked.set_value();
+    }
+
+    TEST(ThreadWorker, offloadShutdown)
+    {
+        promise<void> blocked;
+        auto blockedFuture = blocked.get_future().share();
+        auto worker = make_unique<ThreadWorker>(1);
+        worker->insertTask([=]{ blockedFuture.wait(); });
+        Dracon::Test::TestStream stream;
+        // the worker shuts down while the session waits, its pending tasks are dropped
+        thread shutdown;
+        size_t yields = 0;
+        stream.onYield = [&]{
+            if (!yields++)
+                shutdown = thread{[&]{ worker.reset(); }};
+            else if (yields == 20)
+                blocked.set_value();
+            this_thread::sleep_for(1ms);
+        };
+        EXPECT_THROW(offload(stream, *worker, []{}), runtime_error);
+        EXPECT_EQ(stream.wakeups(), 1);
+        shutdown.join();
+    }
+} // namespace
@@ -16,6 +16,7 @@
 */
 
 #include <gtest/gtest.h>
+#include <dracon/unique_function.h>
 #include <dracon/utils.h>
 #include <memory>
 
@@ -114,6 +115,89 @@ using namespace std;
         EXPECT_EQ(cache.size(), 0);
     }
 
+    TEST(Utils, ShardedCache)
+    {
+        using ptr = std::shared_ptr<int>;
+        Dracon::ShardedCache<std::string, ptr> cache{1000, 1};
+        EXPECT_FALSE(cache.value("a"));
+        EXPECT_TRUE(cache.put("a", std::make_shared<int>(1), 400));
+        EXPECT_TRUE(cache.put("b", std::make_shared<int>(2), 400));
+        EXPECT_EQ(cache.cost(), 800);
+        EXPECT_EQ(*cache.value("a"), 1);
+
+        // replacing a value doesn't need admission
+        EXPECT_TRUE(cache.put("a", std::make_shared<int>(3), 500));
+        EXPECT_EQ(*cache.value("a"), 3);
+        EXPECT_EQ(cache.cost(), 900);
+
+        // bigger than the budget
+        EXPECT_EQ(cache.maxCost(), 1000);
+        EXPECT_FALSE(cache.put("huge", std::make_shared<int>(4), 1001));
+        EXPECT_EQ(cache.size(), 2);
+
+        // every shard gets an equal part of the budget
+        Dracon::ShardedCache<std::string, ptr> shardedCache{1000, 3};
+        EXPECT_EQ(shardedCache.maxCost(), 250);
+        EXPECT_FALSE(shardedCache.put("big", std::make_shared<int>(5), 251));
+        EXPECT_TRUE(shardedCache.put("big", std::make_shared<int>(5), 250));
+
+        EXPECT_TRUE(cache.erase("b"));
+        EXPECT_FALSE(cache.erase("b"));
+        EXPECT_EQ(cache.cost(), 500);
+        cache.clear();
+        EXPECT_EQ(cache.cost(), 0);
+        EXPECT_EQ(cache.size(), 0);
+    }
+
+    TEST(Utils, ShardedCache_admission)
+    {
+        using ptr = std::shared_ptr<int>;
+        Dracon::ShardedCache<std::string, ptr> cache{100 * 10, 1};
+        // 100 hot small values
+        for (int round = 0; round < 3; ++round) {
+            for (int i = 0; i < 100; ++i) {
+                auto key = std::to_string(i);
+                if (!cache.value(key))
+                    cache.put(key, std::make_shared<int>(i), 10);
+            }
+        }
+        EXPECT_EQ(cache.size(), 100);
+
+        // a big one accessed once can't evict them
+        EXPECT_FALSE(cache.value("big"));
+        EXPECT_FALSE(cache.put("big", std::make_shared<int>(0), 500));
+        EXPECT_EQ(cache.size(), 100);
+
+        // but it's admitted once it gets hotter than the values it evicts
+        for (int i = 0; i < 10; ++i)
+            cache.value("big");
+        EXPECT_TRUE(cache.put("big", std::make_shared<int>(0), 500));
+        EXPECT_EQ(cache.size(), 51);
+        EXPECT_LE(cache.cost(), 1000);
+    }
+
+    TEST(Utils, ShardedCache_concurrent)
+    {
+        using ptr = std::shared_ptr<int>;
+        Dracon::ShardedCache<int, ptr> cache{64 * 1024};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&cache, t]{
+                for (int i = 0; i < 10000; ++i) {
+                    auto key = (i * 7 + t) % 500;
+                    if (auto value = cache.value(key))
+                        EXPECT_EQ(*value, key);
+                    else
+                        cache.put(key, std::make_shared<int>(key), 64);
+                }
+            });
+        }
+        for (auto &thread : threads)
+            thread.join();
+        EXPECT_LE(cache.cost(), 64 * 1024);
+        EXPECT_EQ(cache.cost(), cache.size() * 64);
+    }
+
     TEST(Utils, SimpleTimer)
     {
         using namespace std::chrono_literals;
@@ -139,4 +223,39 @@ using namespace std;
         EXPECT_GE(std::chrono::system_clock::now(), (start + 50ms));
         EXPECT_EQ(timeOutWait.wait_for(lock, 100ms), std::cv_status::timeout);
     }
+    TEST(Utils, UniqueFunction)
+    {
+        UniqueFunction<int(int)> empty;
+        EXPECT_FALSE(empty);
+        EXPECT_THROW(empty(1), std::bad_function_call);
+        EXPECT_FALSE((UniqueFunction<int(int)>{std::function<int(int)>{}}));
+        EXPECT_FALSE((UniqueFunction<int(int)>{static_cast<int(*)(int)>(nullptr)}));
+
+        // move-only callables are fine
+        auto value = std::make_unique<int>(10);
+        UniqueFunction<int(int)> add{[value = std::move(value)](int a) { return *value + a; }};
+        EXPECT_TRUE(add);
+        EXPECT_EQ(add(5), 15);
+        auto moved = std::move(add);
+        EXPECT_FALSE(add);
+        EXPECT_EQ(moved(1), 11);
+
+        // the big ones go to the heap
+        std::array<int, 64> big{};
+        big[63] = 7;
+        UniqueFunction<int(int)> heap{[big](int a) { return big[63] + a; }};
+        EXPECT_EQ(heap(1), 8);
+        moved = std::move(heap);
+        EXPECT_EQ(moved(2), 9);
+
+        auto counter = std::make_shared<int>(0);
+        {
+            UniqueFunction<void()> inc{[counter]{ ++*counter; }};
+            inc();
+            EXPECT_EQ(counter.use_count(), 2);
+            inc = nullptr;
+            EXPECT_EQ(counter.use_count(), 1);
+        }
+        EXPECT_EQ(*counter, 1);
+    }
 }
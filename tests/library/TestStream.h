@@ -0,0 +1,90 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+#include <dracon/stream.h>
+
+namespace Dracon {
+namespace Test {
+
+/*!
+ * \brief The TestStream class
+ *
+ * In memory stream, everything written ends up in \a written.
+ * yield() calls \a onYield, if it's not set yield() fails.
+ */
+class TestStream : public AbstractStream
+{
+public:
+    struct Wakeupper : AbstractWakeupper
+    {
+        void wakeup() noexcept override { ++count; }
+        std::atomic<size_t> count{0};
+    };
+
+public:
+    void read(Request &) override {}
+    void write(ConstBuffer buffer) override
+    {
+        written.append(buffer.c_ptr, buffer.length);
+    }
+    void write(std::vector<ConstBuffer> buffers) override
+    {
+        for (const auto &buffer : buffers)
+            write(buffer);
+    }
+    std::error_code yield() noexcept override
+    {
+        if (!onYield)
+            return std::make_error_code(std::errc::operation_canceled);
+        auto callback = onYield;
+        callback();
+        return {};
+    }
+    std::shared_ptr<AbstractWakeupper> wakeupper() const noexcept override { return m_wakeupper; }
+    void watchDescriptor(int, uint32_t) override {}
+    void unwatchDescriptor(int) noexcept override {}
+    std::chrono::seconds keepAlive() const noexcept override { return m_keepAlive; }
+    void setKeepAlive(std::chrono::seconds seconds) noexcept override { m_keepAlive = seconds; }
+    const std::string &peerAddress() const noexcept override { return m_peerAddress; }
+    int socketWriteSize() const override { return 16 * 1024; }
+    void setSocketWriteSize(int) override {}
+    int socketReadSize() const override { return 16 * 1024; }
+    void setSocketReadSize(int) override {}
+    std::chrono::seconds sessionTimeout() const noexcept override { return m_sessionTimeout; }
+    void setSessionTimeout(std::chrono::seconds seconds) noexcept override { m_sessionTimeout = seconds; }
+
+    size_t wakeups() const { return m_wakeupper->count; }
+
+public:
+    std::string written;
+    std::function<void()> onYield;
+
+private:
+    std::shared_ptr<Wakeupper> m_wakeupper = std::make_shared<Wakeupper>();
+    std::chrono::seconds m_keepAlive{10};
+    std::chrono::seconds m_sessionTimeout{0};
+    std::string m_peerAddress{"127.0.0.1"};
+};
+
+} // namespace Test
+} // namespace Dracon
@@ -0,0 +1,102 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <EasyCurl.h>
+
+#include <dracon/http.h>
+#include <dracon/stream.h>
+
+#include <server.h>
+
+namespace {
+using namespace std;
+
+TEST(Embedded, handlers)
+{
+    try {
+        // the GETodac process uses the default ports
+        Getodac::ServerConfig config;
+        config.httpPort = 8090;
+        config.workers = 2;
+        Getodac::Server server{std::move(config)};
+        server.addHandler("embedded", [](const Dracon::Request &req) -> Dracon::HttpSession {
+            if (req.url() != "/embedded")
+                return {};
+            return [](Dracon::AbstractStream &stream, Dracon::Request &req) {
+                stream >> req;
+                stream << Dracon::Response{200, "Hello from the embedded server"};
+            };
+        }, 0, Dracon::PluginRoutes{{"/embedded", {"GET"}}});
+        server.start();
+        EXPECT_THROW(server.addHandler("late", [](const Dracon::Request &) { return Dracon::HttpSession{}; }), std::runtime_error);
+
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl("http://localhost:8090/embedded"));
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "Hello from the embedded server");
+
+        EXPECT_NO_THROW(curl.setUrl("http://localhost:8090/test100"));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "503");
+        server.stop();
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST(Embedded, restart)
+{
+    try {
+        auto handler = [](const Dracon::Request &req) -> Dracon::HttpSession {
+            if (req.url() != "/embedded")
+                return {};
+            return [](Dracon::AbstractStream &stream, Dracon::Request &req) {
+                stream >> req;
+                stream << Dracon::Response{200, "Hello from the embedded server"};
+            };
+        };
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl("http://localhost:8090/embedded"));
+        // a listener left open accepts the connection but never answers
+        curl.setOptions(CURLOPT_TIMEOUT, 3L);
+        for (int i = 0; i < 2; ++i) {
+            Getodac::ServerConfig config;
+            config.httpPort = 8090;
+            config.workers = 1;
+            Getodac::Server server{std::move(config)};
+            server.addHandler("embedded", handler);
+            // the previous server closed its listeners, the port is free
+            server.start();
+            auto reply = curl.get();
+            EXPECT_EQ(reply.status, "200");
+            EXPECT_EQ(reply.body, "Hello from the embedded server");
+
+            // the stopped server refuses the new connections
+            server.stop();
+            Getodac::Test::EasyCurl refused;
+            EXPECT_NO_THROW(refused.setUrl("http://localhost:8090/embedded"));
+            refused.setOptions(CURLOPT_TIMEOUT, 3L);
+            EXPECT_THROW(refused.get(), std::runtime_error);
+        }
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+} // namespace {
@@ -0,0 +1,113 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <dracon/http.h>
+
+#include <pluginsindex.h>
+
+namespace {
+using namespace std;
+
+Dracon::HttpSession noSession(const Dracon::Request &)
+{
+    return {};
+}
+
+Getodac::ServerPlugin plugin(std::string name, std::optional<Dracon::PluginRoutes> routes = {})
+{
+    return Getodac::ServerPlugin{std::move(name), &noSession, 0, std::move(routes)};
+}
+
+Dracon::Request request(std::string method, std::string url, std::string host = "localhost")
+{
+    Dracon::Request req;
+    req.setMethod(std::move(method));
+    req.setUrl(std::move(url));
+    if (!host.empty())
+        req.emplace("Host", std::move(host));
+    return req;
+}
+
+std::vector<uint8_t> candidates(const Getodac::PluginsIndex &index, const Dracon::Request &req)
+{
+    std::vector<uint8_t> res;
+    index.candidates(req, res);
+    return res;
+}
+
+TEST(PluginsIndex, requestHost)
+{
+    EXPECT_EQ(Getodac::requestHost(request("GET", "/", "example.com:8080")), "example.com");
+    EXPECT_EQ(Getodac::requestHost(request("GET", "/", "[::1]:8080")), "[::1]");
+    EXPECT_EQ(Getodac::requestHost(request("GET", "/", "")), "");
+}
+
+TEST(PluginsIndex, candidates)
+{
+    std::vector<Getodac::ServerPlugin> plugins;
+    plugins.push_back(plugin("api", Dracon::PluginRoutes{{"/api/"}}));
+    plugins.push_back(plugin("everything"));
+    plugins.push_back(plugin("posts", Dracon::PluginRoutes{{"/api/posts", {"POST", "PUT"}}}));
+    plugins.push_back(plugin("hosts", Dracon::PluginRoutes{{"/", {}, {"example.com", "*.vhost.test"}}}));
+    plugins.push_back(plugin("nothing", Dracon::PluginRoutes{}));
+    Getodac::PluginsIndex index;
+    index.build(plugins);
+
+    // the candidates are in the plugins order, the undeclared plugin gets everything
+    EXPECT_EQ(candidates(index, request("POST", "/api/posts/1")), (std::vector<uint8_t>{1, 1, 1, 0, 0}));
+    // the method doesn't match
+    EXPECT_EQ(candidates(index, request("GET", "/api/posts/1")), (std::vector<uint8_t>{1, 1, 0, 0, 0}));
+    // the prefix doesn't match
+    EXPECT_EQ(candidates(index, request("POST", "/api")), (std::vector<uint8_t>{0, 1, 0, 0, 0}));
+    EXPECT_EQ(candidates(index, request("POST", "/apis/posts")), (std::vector<uint8_t>{0, 1, 0, 0, 0}));
+    EXPECT_EQ(candidates(index, request("GET", "")), (std::vector<uint8_t>{0, 1, 0, 0, 0}));
+
+    // the host must match, without the port and ignoring the case
+    EXPECT_EQ(candidates(index, request("GET", "/index.html", "Example.COM:8080")), (std::vector<uint8_t>{0, 1, 0, 1, 0}));
+    EXPECT_EQ(candidates(index, request("GET", "/index.html", "example.org")), (std::vector<uint8_t>{0, 1, 0, 0, 0}));
+    EXPECT_EQ(candidates(index, request("GET", "/index.html", "")), (std::vector<uint8_t>{0, 1, 0, 0, 0}));
+    // ... or the virtual host which matched the request
+    auto req = request("GET", "/index.html", "www.vhost.test");
+    EXPECT_EQ(candidates(index, req), (std::vector<uint8_t>{0, 1, 0, 0, 0}));
+    req.setVirtualHost("*.vhost.test");
+    EXPECT_EQ(candidates(index, req), (std::vector<uint8_t>{0, 1, 0, 1, 0}));
+}
+
+TEST(PluginsIndex, enabled)
+{
+    std::vector<Getodac::ServerPlugin> plugins;
+    plugins.push_back(plugin("first", Dracon::PluginRoutes{{"/"}}));
+    plugins.push_back(plugin("everything"));
+    plugins.push_back(plugin("second", Dracon::PluginRoutes{{"/"}, {"/second"}}));
+    Getodac::PluginsIndex index;
+    EXPECT_EQ(candidates(index, request("GET", "/")), (std::vector<uint8_t>{}));
+
+    index.build(plugins);
+    EXPECT_EQ(candidates(index, request("GET", "/second")), (std::vector<uint8_t>{1, 1, 1}));
+
+    // the disabled plugins are not indexed, not even the undeclared ones
+    std::vector<uint8_t> enabled{0, 0, 1};
+    index.build(plugins, &enabled);
+    EXPECT_EQ(candidates(index, request("GET", "/second")), (std::vector<uint8_t>{0, 0, 1}));
+    enabled = {1, 1, 0};
+    index.build(plugins, &enabled);
+    EXPECT_EQ(candidates(index, request("GET", "/second")), (std::vector<uint8_t>{1, 1, 0}));
+}
+
+} // namespace
@@ -0,0 +1,427 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <EasyCurl.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Utils.h"
+
+namespace {
+using namespace std;
+
+/*!
+ * \brief The StandInUpstream class
+ *
+ * A tiny blocking HTTP/1.1 server on 127.0.0.1:\a port used as the proxy's upstream.
+ * /proxyTest/echo replies with the request line, the X-Forwarded-For header and the body,
+ * /proxyTest/chunked replies with a chunked body and
+ * /proxyTest/close replies with a body delimited by the connection close and
+ * /proxyTest/dropNext replies like echo, but closes the connection when the next request arrives.
+ * /proxyTest/hold replies like echo, but only after the next \ref release call.
+ * The echo replies carry the \a name in the X-Upstream header.
+ */
+class StandInUpstream
+{
+public:
+    StandInUpstream(uint16_t port = 8079, std::string name = "stand-in")
+        : m_name(std::move(name))
+    {
+        m_socket = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int opt = 1;
+        setsockopt(m_socket, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) || ::listen(m_socket, 64))
+            throw std::runtime_error{"Can't listen on 127.0.0.1:" + std::to_string(port)};
+        m_acceptThread = std::thread{[this]{
+            for (;;) {
+                int sock = ::accept(m_socket, nullptr, nullptr);
+                if (sock == -1)
+                    break;
+                std::unique_lock<std::mutex> lock{m_mutex};
+                ++m_connections;
+                m_sockets.push_back(sock);
+                m_threads.emplace_back([this, sock]{ serve(sock); });
+            }
+        }};
+    }
+
+    ~StandInUpstream()
+    {
+        {
+            std::unique_lock<std::mutex> lock{m_holdMutex};
+            m_stopped = true;
+        }
+        release();
+        ::shutdown(m_socket, SHUT_RDWR);
+        m_acceptThread.join();
+        ::close(m_socket);
+        std::unique_lock<std::mutex> lock{m_mutex};
+        for (auto sock : m_sockets)
+            ::shutdown(sock, SHUT_RDWR);
+        for (auto &thread : m_threads)
+            thread.join();
+        for (auto sock : m_sockets)
+            ::close(sock);
+    }
+
+    size_t connections() const { return m_connections; }
+
+    // the number of /proxyTest/hold requests waiting for release
+    size_t held()
+    {
+        std::unique_lock<std::mutex> lock{m_holdMutex};
+        return m_held;
+    }
+
+    void release()
+    {
+        std::unique_lock<std::mutex> lock{m_holdMutex};
+        m_released = true;
+        m_holdWait.notify_all();
+    }
+
+private:
+    void serve(int sock)
+    {
+        std::string buffer;
+        bool dropNext = false;
+        for (;;) {
+            auto pos = readUntil(sock, buffer, "\r\n\r\n");
+            if (pos == std::string::npos)
+                return;
+            if (dropNext) {
+                // the request reached an idle connection which is closed meanwhile
+                ::shutdown(sock, SHUT_RDWR);
+                return;
+            }
+            std::string head = buffer.substr(0, pos + 2);
+            buffer.erase(0, pos + 4);
+            std::string body;
+            auto length = header(head, "Content-Length");
+            if (!length.empty()) {
+                size_t size = std::stoul(length);
+                while (buffer.size() < size && readMore(sock, buffer));
+                body = buffer.substr(0, size);
+                buffer.erase(0, size);
+            } else if (header(head, "Transfer-Encoding") == "chunked") {
+                for (;;) {
+                    auto lineEnd = readUntil(sock, buffer, "\r\n");
+                    if (lineEnd == std::string::npos)
+                        return;
+                    size_t size = std::stoul(buffer.substr(0, lineEnd), nullptr, 16);
+                    buffer.erase(0, lineEnd + 2);
+                    while (buffer.size() < size + 2 && readMore(sock, buffer));
+                    body += buffer.substr(0, size);
+                    buffer.erase(0, size + 2);
+                    if (!size)
+                        break;
+                }
+            }
+
+            auto requestLine = head.substr(0, head.find("\r\n"));
+            dropNext = requestLine.find(" /proxyTest/dropNext ") != std::string::npos;
+            std::string response;
+            if (requestLine.find(" /proxyTest/chunked ") != std::string::npos) {
+                response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                           "5\r\nHello\r\n7\r\n chunks\r\n0\r\n\r\n";
+            } else if (requestLine.find(" /proxyTest/close ") != std::string::npos) {
+                response = "HTTP/1.1 200 OK\r\nConnection: close\r\n\r\nUntil close";
+                ::send(sock, response.data(), response.size(), MSG_NOSIGNAL);
+                ::shutdown(sock, SHUT_WR);
+                return;
+            } else {
+                if (requestLine.find(" /proxyTest/hold ") != std::string::npos) {
+                    std::unique_lock<std::mutex> lock{m_holdMutex};
+                    ++m_held;
+                    m_holdWait.wait(lock, [this]{ return m_released; });
+                    // the next hold requests wait for the next release
+                    if (!--m_held && !m_stopped)
+                        m_released = false;
+                }
+                auto content = requestLine + "\n" + header(head, "X-Forwarded-For") + "\n" + body;
+                response = "HTTP/1.1 200 OK\r\nX-Upstream: " + m_name + "\r\nKeep-Alive: timeout=100\r\nContent-Length: "
+                        + std::to_string(content.size()) + "\r\n\r\n" + content;
+            }
+            if (::send(sock, response.data(), response.size(), MSG_NOSIGNAL) != ssize_t(response.size()))
+                return;
+        }
+    }
+
+    static bool readMore(int sock, std::string &buffer)
+    {
+        char tmp[4096];
+        auto sz = ::recv(sock, tmp, sizeof(tmp), 0);
+        if (sz <= 0)
+            return false;
+        buffer.append(tmp, sz);
+        return true;
+    }
+
+    static size_t readUntil(int sock, std::string &buffer, std::string_view delimiter)
+    {
+        size_t pos;
+        while ((pos = buffer.find(delimiter)) == std::string::npos)
+            if (!readMore(sock, buffer))
+                return std::string::npos;
+        return pos;
+    }
+
+    static std::string header(const std::string &head, const std::string &name)
+    {
+        auto pos = head.find("\r\n" + name + ": ");
+        if (pos == std::string::npos)
+            return {};
+        pos += name.size() + 4;
+        return head.substr(pos, head.find("\r\n", pos) - pos);
+    }
+
+private:
+    std::string m_name;
+    int m_socket;
+    std::thread m_acceptThread;
+    std::mutex m_mutex;
+    std::vector<int> m_sockets;
+    std::vector<std::thread> m_threads;
+    std::atomic<size_t> m_connections{0};
+    std::mutex m_holdMutex;
+    std::condition_variable m_holdWait;
+    size_t m_held = 0;
+    bool m_released = false;
+    bool m_stopped = false;
+};
+
+// Removes the X-Forwarded-For line, its value depends on how "localhost" was resolved
+std::string withoutForwardedFor(std::string body)
+{
+    auto begin = body.find('\n');
+    auto end = body.find('\n', begin + 1);
+    if (end == std::string::npos)
+        return body;
+    auto forwardedFor = body.substr(begin + 1, end - begin - 1);
+    EXPECT_TRUE(forwardedFor == "127.0.0.1" || forwardedFor == "::1") << forwardedFor;
+    return body.erase(begin + 1, end - begin);
+}
+
+class Proxy : public testing::TestWithParam<std::string>
+{
+protected:
+    static void SetUpTestSuite()
+    {
+        s_upstream = std::make_unique<StandInUpstream>();
+        s_secondUpstream = std::make_unique<StandInUpstream>(8077, "second");
+    }
+    static void TearDownTestSuite()
+    {
+        s_upstream.reset();
+        s_secondUpstream.reset();
+    }
+    static std::unique_ptr<StandInUpstream> s_upstream;
+    static std::unique_ptr<StandInUpstream> s_secondUpstream;
+};
+std::unique_ptr<StandInUpstream> Proxy::s_upstream;
+std::unique_ptr<StandInUpstream> Proxy::s_secondUpstream;
+
+TEST_P(Proxy, get)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/echo?a=b")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers["X-Upstream"], "stand-in");
+        // hop-by-hop headers are not forwarded
+        EXPECT_EQ(reply.headers["Keep-Alive"], "timeout=10");
+        EXPECT_EQ(withoutForwardedFor(reply.body), "GET /proxyTest/echo?a=b HTTP/1.1\n");
+
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyRewrite/echo")));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(withoutForwardedFor(reply.body), "GET /proxyTest/echo HTTP/1.1\n");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Proxy, keepAlive)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/echo")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        auto connections = s_upstream->connections();
+        // the same client connection is served by the same event loop,
+        // which reuses its pooled upstream connection
+        for (int i = 0; i < 10; ++i) {
+            reply = curl.get();
+            EXPECT_EQ(reply.status, "200");
+        }
+        EXPECT_EQ(s_upstream->connections(), connections);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Proxy, staleConnection)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        curl.ingnoreInvalidSslCertificate();
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/dropNext")));
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        auto connections = s_upstream->connections();
+
+        // the idempotent requests are resent on a new connection
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/echo")));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(withoutForwardedFor(reply.body), "GET /proxyTest/echo HTTP/1.1\n");
+        EXPECT_EQ(s_upstream->connections(), connections + 1);
+
+        // the others are not
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/dropNext")));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/echo")));
+        reply = curl.post("data");
+        EXPECT_EQ(reply.status, "502");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Proxy, body)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/echo")));
+        curl.ingnoreInvalidSslCertificate();
+        std::string data(100 * 1024, 'x');
+        auto reply = curl.post(data);
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(withoutForwardedFor(reply.body), "POST /proxyTest/echo HTTP/1.1\n" + data);
+
+        curl.setHeaders({{"Transfer-Encoding", "chunked"}});
+        reply = curl.put(data);
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(withoutForwardedFor(reply.body), "PUT /proxyTest/echo HTTP/1.1\n" + data);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Proxy, streamedResponses)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/chunked")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers["Transfer-Encoding"], "chunked");
+        EXPECT_EQ(reply.body, "Hello chunks");
+
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyTest/close")));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "Until close");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Proxy, balancing)
+{
+    try {
+        Getodac::Test::EasyCurl::Response heldReply;
+        std::thread held{[&heldReply]{
+            Getodac::Test::EasyCurl curl;
+            curl.setUrl(url(GetParam(), "/proxyBalance/hold"));
+            curl.ingnoreInvalidSslCertificate();
+            heldReply = curl.get();
+        }};
+        auto holder = [] () -> StandInUpstream * {
+            for (int i = 0; i < 500; ++i) {
+                if (s_upstream->held())
+                    return s_upstream.get();
+                if (s_secondUpstream->held())
+                    return s_secondUpstream.get();
+                std::this_thread::sleep_for(std::chrono::milliseconds{10});
+            }
+            return nullptr;
+        }();
+        if (!holder) {
+            s_upstream->release();
+            s_secondUpstream->release();
+            held.join();
+            FAIL() << "The held request didn't reach any upstream";
+        }
+
+        // the upstream which holds the request has more outstanding requests,
+        // the next requests go to the other one, not round robin
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyBalance/echo")));
+        curl.ingnoreInvalidSslCertificate();
+        for (int i = 0; i < 4; ++i) {
+            auto reply = curl.get();
+            EXPECT_EQ(reply.status, "200");
+            EXPECT_EQ(reply.headers["X-Upstream"], holder == s_upstream.get() ? "second" : "stand-in");
+        }
+
+        holder->release();
+        held.join();
+        EXPECT_EQ(heldReply.status, "200");
+        EXPECT_EQ(heldReply.headers["X-Upstream"], holder == s_upstream.get() ? "stand-in" : "second");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Proxy, badGateway)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/proxyDown/")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "502");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Proxy, Proxy, testing::Values("http", "https"));
+
+} // namespace {
@@ -0,0 +1,121 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+namespace {
+using namespace std;
+
+const std::string PeerAddressRequest{"GET /testPeerAddress HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n"};
+
+// Sends data to the PROXY protocol port (8081) and returns everything the server sent back
+std::string exchange(const std::string &data)
+{
+    int sock = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(8081);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr))) {
+        ::close(sock);
+        throw std::runtime_error{"Can't connect"};
+    }
+    if (!data.empty())
+        ::send(sock, data.data(), data.size(), MSG_NOSIGNAL);
+    std::string res;
+    char buffer[4096];
+    ssize_t size;
+    while ((size = ::recv(sock, buffer, sizeof(buffer), 0)) > 0)
+        res.append(buffer, size);
+    ::close(sock);
+    return res;
+}
+
+inline std::string body(const std::string &response)
+{
+    auto pos = response.find("\r\n\r\n");
+    return pos == std::string::npos ? std::string{} : response.substr(pos + 4);
+}
+
+TEST(ProxyProtocol, v1)
+{
+    try {
+        auto reply = exchange("PROXY TCP4 192.0.2.1 198.51.100.1 56324 443\r\n" + PeerAddressRequest);
+        EXPECT_EQ(reply.substr(0, 12), "HTTP/1.1 200");
+        EXPECT_EQ(body(reply), "192.0.2.1");
+
+        reply = exchange("PROXY TCP6 2001:db8::1 2001:db8::2 56324 443\r\n" + PeerAddressRequest);
+        EXPECT_EQ(body(reply), "2001:db8::1");
+
+        // UNKNOWN keeps the connection address
+        reply = exchange("PROXY UNKNOWN\r\n" + PeerAddressRequest);
+        EXPECT_EQ(body(reply), "127.0.0.1");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST(ProxyProtocol, v2)
+{
+    try {
+        std::string header{"\r\n\r\n\0\r\nQUIT\n", 12};
+        header += char(0x21); // version 2, PROXY command
+        header += char(0x11); // TCP over IPv4
+        header += std::string{"\0\x0c", 2};
+        header += std::string{"\xc0\x00\x02\x07", 4}; // 192.0.2.7
+        header += std::string{"\xc6\x33\x64\x01", 4}; // 198.51.100.1
+        header += std::string{"\xdc\x04\x01\xbb", 4}; // ports
+        auto reply = exchange(header + PeerAddressRequest);
+        EXPECT_EQ(reply.substr(0, 12), "HTTP/1.1 200");
+        EXPECT_EQ(body(reply), "192.0.2.7");
+
+        // LOCAL command, e.g. a health check of the balancer
+        std::string local{"\r\n\r\n\0\r\nQUIT\n", 12};
+        local += std::string{"\x20\x00\x00\x00", 4};
+        reply = exchange(local + PeerAddressRequest);
+        EXPECT_EQ(body(reply), "127.0.0.1");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST(ProxyProtocol, invalid)
+{
+    try {
+        // the PROXY header is mandatory
+        EXPECT_TRUE(exchange(PeerAddressRequest).empty());
+        EXPECT_TRUE(exchange("PROXY TCP4 not.an.ip 198.51.100.1 56324 443\r\n" + PeerAddressRequest).empty());
+
+        // the connections without a header are closed after the timeout
+        using clock = std::chrono::high_resolution_clock;
+        auto start = clock::now();
+        EXPECT_TRUE(exchange({}).empty());
+        EXPECT_LE(std::chrono::duration_cast<std::chrono::seconds>(clock::now() - start).count(), 3);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+} // namespace {
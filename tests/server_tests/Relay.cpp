@@ -0,0 +1,94 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <EasyCurl.h>
+
+#include "Utils.h"
+
+namespace {
+using namespace std;
+
+using Relay = testing::TestWithParam<std::string>;
+
+// /testRelay relays the request body to a socket pair and the peer's reply back to the client
+TEST_P(Relay, bothDirections)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/testRelay")));
+        curl.ingnoreInvalidSslCertificate();
+        std::string data;
+        for (int i = 0; i < 1024 * 1024; ++i)
+            data += char(33 + (i % 93));
+        auto reply = curl.post(data);
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body.size(), data.size());
+        EXPECT_EQ(reply.body, data);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Relay, exactLength)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        curl.ingnoreInvalidSslCertificate();
+        // the peer sends more than it received, the extra bytes must not reach the client
+        for (int i = 0; i < 3; ++i) {
+            EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/testRelay")));
+            auto reply = curl.post("relay me");
+            EXPECT_EQ(reply.status, "200");
+            EXPECT_EQ(reply.body, "relay me");
+
+            // the keep-alive connection is still in a good shape
+            EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/test0")));
+            reply = curl.get();
+            EXPECT_EQ(reply.status, "200");
+            EXPECT_TRUE(reply.body.empty());
+        }
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Relay, earlyEof)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/testRelay")));
+        curl.ingnoreInvalidSslCertificate();
+        // the peer closes after 1000 bytes, the plugin fills the rest with dots
+        curl.setHeaders({{"X-Reply-Size", "1000"}});
+        std::string data(100 * 1024, 'x');
+        auto reply = curl.post(data);
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, data.substr(0, 1000) + std::string(data.size() - 1000, '.'));
+
+        curl.setHeaders({{"X-Reply-Size", "0"}});
+        reply = curl.post(data);
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, std::string(data.size(), '.'));
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(Relay, Relay, testing::Values("http", "https"));
+
+} // namespace {
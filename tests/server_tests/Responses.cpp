@@ -44,6 +44,46 @@ TEST_P(Responses, zero)
     }
 }
 
+TEST_P(Responses, eventLoopsInit)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/testEventLoops")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        // every event loop called the test plugin initLoop
+        EXPECT_GE(std::stoul(reply.body), 2u);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(Responses, cApi)
+{
+    try {
+        // the test plugin reads this request through the DraconServer functions
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/testCApi")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "GET /testCApi none");
+
+        curl.setHeaders({{"X-Test", "value"}});
+        reply = curl.del();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "DELETE /testCApi value");
+
+        // its C routes declare /secureOnly only for GET, nobody else handles it
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/secureOnly")));
+        reply = curl.del();
+        EXPECT_EQ(reply.status, "503");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
 TEST_P(Responses, test100)
 {
     try {
@@ -112,6 +152,35 @@ TEST_P(Responses, test50mChunked)
     }
 }
 
+TEST_P(Responses, testCompression)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/testCompression")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers["Vary"], "Accept-Encoding");
+        EXPECT_EQ(reply.headers.count("Content-Encoding"), 0);
+        auto size = reply.body.size();
+
+        curl.setHeaders({{"Accept-Encoding", "gzip, deflate"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers["Content-Encoding"], "gzip");
+        EXPECT_EQ(reply.headers["Transfer-Encoding"], "chunked");
+        EXPECT_LT(reply.body.size(), size / 2);
+        // gzip magic
+        EXPECT_EQ(reply.body.substr(0, 2), "\x1f\x8b");
+
+        curl.setHeaders({{"Accept-Encoding", "deflate"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.headers["Content-Encoding"], "deflate");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
 TEST_P(Responses, testWorker)
 {
     try {
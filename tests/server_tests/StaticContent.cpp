@@ -0,0 +1,477 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <EasyCurl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Utils.h"
+
+namespace {
+using namespace std;
+using namespace std::chrono_literals;
+
+// tests/server_tests/static/range.txt
+const std::string RangeTxt{"0123456789abcdefghijklmnopqrstuvwxyz"};
+
+using StaticContent = testing::TestWithParam<std::string>;
+
+void writeFile(const std::filesystem::path &path, const std::string &data)
+{
+    // the files are validated by their modification time, make sure it changes
+    std::this_thread::sleep_for(20ms);
+    std::ofstream{path, std::ios::binary | std::ios::trunc} << data;
+}
+
+// the server notices the changes of the files asynchronously
+Getodac::Test::EasyCurl::Response waitFor(const Getodac::Test::EasyCurl &curl, const std::string &status, const std::string &body = {})
+{
+    auto reply = curl.get();
+    for (int i = 0; i < 300 && (reply.status != status || (status == "200" && reply.body != body)); ++i) {
+        std::this_thread::sleep_for(10ms);
+        reply = curl.get();
+    }
+    return reply;
+}
+
+TEST_P(StaticContent, conditional)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/staticTest/range.txt")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, RangeTxt);
+        EXPECT_EQ(reply.headers["Accept-Ranges"], "bytes");
+        auto etag = reply.headers["ETag"];
+        auto lastModified = reply.headers["Last-Modified"];
+        EXPECT_FALSE(etag.empty());
+        EXPECT_FALSE(lastModified.empty());
+
+        curl.setHeaders({{"If-None-Match", "\"other\", " + etag}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "304");
+        EXPECT_TRUE(reply.body.empty());
+        EXPECT_EQ(reply.headers["ETag"], etag);
+
+        curl.setHeaders({{"If-None-Match", "\"other\""}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, RangeTxt);
+
+        curl.setHeaders({{"If-Modified-Since", lastModified}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "304");
+
+        curl.setHeaders({{"If-Modified-Since", "Thu, 01 Jan 1970 00:00:00 GMT"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, ranges)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/staticTest/range.txt")));
+        curl.ingnoreInvalidSslCertificate();
+
+        curl.setHeaders({{"Range", "bytes=10-15"}});
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        EXPECT_EQ(reply.headers["Content-Range"], "bytes 10-15/36");
+        EXPECT_EQ(reply.body, "abcdef");
+
+        curl.setHeaders({{"Range", "bytes=-4"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        EXPECT_EQ(reply.body, "wxyz");
+
+        curl.setHeaders({{"Range", "bytes=30-"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        EXPECT_EQ(reply.body, "uvwxyz");
+
+        curl.setHeaders({{"Range", "bytes=0-1,34-100"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        auto contentType = reply.headers["Content-Type"];
+        auto pos = contentType.find("boundary=");
+        ASSERT_NE(pos, std::string::npos);
+        auto boundary = contentType.substr(pos + 9);
+        EXPECT_EQ(reply.body,
+                  "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-1/36\r\n\r\n01"
+                  "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes 34-35/36\r\n\r\nyz"
+                  "\r\n--" + boundary + "--\r\n");
+
+        // the overlapping and adjacent ranges are merged
+        curl.setHeaders({{"Range", "bytes=20-25,0-9,5-12,13-14,0-0,0-0"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        contentType = reply.headers["Content-Type"];
+        pos = contentType.find("boundary=");
+        ASSERT_NE(pos, std::string::npos);
+        boundary = contentType.substr(pos + 9);
+        EXPECT_EQ(reply.body,
+                  "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes 0-14/36\r\n\r\n0123456789abcde"
+                  "\r\n--" + boundary + "\r\nContent-Type: text/plain\r\nContent-Range: bytes 20-25/36\r\n\r\nklmnop"
+                  "\r\n--" + boundary + "--\r\n");
+
+        curl.setHeaders({{"Range", "bytes=0-35,0-35,0-35,0-35"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        EXPECT_EQ(reply.headers["Content-Range"], "bytes 0-35/36");
+        EXPECT_EQ(reply.body, RangeTxt);
+
+        curl.setHeaders({{"Range", "bytes=100-200"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "416");
+        EXPECT_EQ(reply.headers["Content-Range"], "bytes */36");
+
+        // invalid ranges are ignored
+        curl.setHeaders({{"Range", "bytes=5-1"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, RangeTxt);
+
+        // the file changed since the client got its validator
+        curl.setHeaders({{"Range", "bytes=0-1"}, {"If-Range", "\"old\""}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, RangeTxt);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, missing)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        curl.ingnoreInvalidSslCertificate();
+        for (auto path : {"/staticTest/wp-admin/", "/staticTest/.env", "/staticTest/.env", "/staticTest/range.txt/x"}) {
+            EXPECT_NO_THROW(curl.setUrl(url(GetParam(), path)));
+            auto reply = curl.get();
+            EXPECT_EQ(reply.status, "404") << path;
+            EXPECT_EQ(reply.headers["Connection"], "keep-alive");
+        }
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, watchedChanges)
+{
+    try {
+        const auto dir = std::filesystem::path{TESTS_WATCH_DIR} / GetParam();
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        Getodac::Test::EasyCurl curl;
+        curl.ingnoreInvalidSslCertificate();
+        auto fileUrl = [&](const std::string &name) {
+            return url(GetParam(), "/watchTest/" + GetParam() + "/" + name);
+        };
+
+        // create
+        EXPECT_NO_THROW(curl.setUrl(fileUrl("file.txt")));
+        EXPECT_EQ(curl.get().status, "404");
+        writeFile(dir / "file.txt", "created");
+        auto reply = waitFor(curl, "200", "created");
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "created");
+
+        // rename over it
+        writeFile(dir / "file.tmp", "renamed");
+        std::filesystem::rename(dir / "file.tmp", dir / "file.txt");
+        reply = waitFor(curl, "200", "renamed");
+        EXPECT_EQ(reply.body, "renamed");
+
+        // delete
+        std::filesystem::remove(dir / "file.txt");
+        EXPECT_EQ(waitFor(curl, "404").status, "404");
+
+        // move a symlink over another one
+        writeFile(dir / "a.txt", "A");
+        writeFile(dir / "b.txt", "B");
+        std::filesystem::create_symlink("a.txt", dir / "link.txt");
+        EXPECT_NO_THROW(curl.setUrl(fileUrl("link.txt")));
+        reply = waitFor(curl, "200", "A");
+        EXPECT_EQ(reply.body, "A");
+        std::filesystem::create_symlink("b.txt", dir / "link.tmp");
+        std::filesystem::rename(dir / "link.tmp", dir / "link.txt");
+        reply = waitFor(curl, "200", "B");
+        EXPECT_EQ(reply.body, "B");
+
+        // rename a parent folder
+        std::filesystem::create_directory(dir / "sub");
+        writeFile(dir / "sub" / "file.txt", "sub");
+        EXPECT_NO_THROW(curl.setUrl(fileUrl("sub/file.txt")));
+        reply = waitFor(curl, "200", "sub");
+        EXPECT_EQ(reply.body, "sub");
+        std::filesystem::rename(dir / "sub", dir / "sub2");
+        EXPECT_EQ(waitFor(curl, "404").status, "404");
+        std::filesystem::rename(dir / "sub2", dir / "sub");
+        reply = waitFor(curl, "200", "sub");
+        EXPECT_EQ(reply.body, "sub");
+
+        // more paths than the cache can keep, the evicted ones are resolved again
+        for (int i = 0; i < 20; ++i)
+            writeFile(dir / (std::to_string(i) + ".txt"), std::to_string(i));
+        for (int round = 0; round < 2; ++round) {
+            for (int i = 0; i < 20; ++i) {
+                EXPECT_NO_THROW(curl.setUrl(fileUrl(std::to_string(i) + ".txt")));
+                reply = curl.get();
+                EXPECT_EQ(reply.status, "200");
+                EXPECT_EQ(reply.body, std::to_string(i));
+            }
+        }
+        writeFile(dir / "19.txt", "changed");
+        reply = waitFor(curl, "200", "changed");
+        EXPECT_EQ(reply.body, "changed");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+// writes \a data to \a path and drops its pages from the page cache
+bool writeColdFile(const std::filesystem::path &path, const std::string &data)
+{
+    int fd = ::open(path.c_str(), O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+    if (fd == -1)
+        return false;
+    bool cold = ::write(fd, data.data(), data.size()) == ssize_t(data.size()) && !::fsync(fd) &&
+            !posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (cold) {
+        // some file systems keep everything in memory
+        auto map = ::mmap(nullptr, data.size(), PROT_READ, MAP_SHARED, fd, 0);
+        std::vector<unsigned char> pages((data.size() + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE));
+        cold = map != MAP_FAILED && !mincore(map, data.size(), pages.data()) &&
+                std::none_of(pages.begin(), pages.end(), [](unsigned char page) { return page & 1; });
+        if (map != MAP_FAILED)
+            ::munmap(map, data.size());
+    }
+    ::close(fd);
+    return cold;
+}
+
+TEST_P(StaticContent, coldFiles)
+{
+    try {
+        const auto dir = std::filesystem::path{TESTS_WATCH_DIR} / ("cold-" + GetParam());
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        std::string data;
+        for (int i = 0; i < 8 * 1024 * 1024; ++i)
+            data += char(33 + (i % 93));
+        if (!writeColdFile(dir / "cold.bin", data) || !writeColdFile(dir / "ranges.bin", data))
+            GTEST_SKIP() << "Can't drop the files from the page cache";
+
+        // the pages are read by the prefetch workers while the session waits
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/watchTest/cold-" + GetParam() + "/cold.bin")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body.size(), data.size());
+        EXPECT_TRUE(reply.body == data);
+
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/watchTest/cold-" + GetParam() + "/ranges.bin")));
+        curl.setHeaders({{"Range", "bytes=10-19,5000000-5000009"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        EXPECT_NE(reply.body.find("\r\n\r\n" + data.substr(10, 10) + "\r\n"), std::string::npos);
+        EXPECT_NE(reply.body.find("\r\n\r\n" + data.substr(5000000, 10) + "\r\n"), std::string::npos);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, smallFilesEncodings)
+{
+    try {
+        // tests/server_tests/static/compress.txt
+        std::string compressTxt;
+        for (int i = 0; i < 300; ++i)
+            compressTxt += "Compress me " + std::to_string(i) + "\n";
+
+        Getodac::Test::EasyCurl identity;
+        EXPECT_NO_THROW(identity.setUrl(url(GetParam(), "/staticTest/compress.txt")));
+        identity.ingnoreInvalidSslCertificate();
+        Getodac::Test::EasyCurl gzip;
+        EXPECT_NO_THROW(gzip.setUrl(url(GetParam(), "/staticTest/compress.txt")));
+        gzip.ingnoreInvalidSslCertificate();
+        // curl decodes the body
+        gzip.setOptions(CURLOPT_ACCEPT_ENCODING, "gzip");
+
+        auto reply = identity.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers.count("Content-Encoding"), 0);
+        EXPECT_EQ(reply.body, compressTxt);
+
+        // the file is compressed in background
+        reply = gzip.get();
+        for (int i = 0; i < 100 && reply.headers["Content-Encoding"] != "gzip"; ++i) {
+            std::this_thread::sleep_for(10ms);
+            reply = gzip.get();
+        }
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers["Content-Encoding"], "gzip");
+        EXPECT_EQ(reply.body, compressTxt);
+
+        // both representations are cached, each one is sent only to its clients
+        for (int i = 0; i < 3; ++i) {
+            reply = gzip.get();
+            EXPECT_EQ(reply.headers["Content-Encoding"], "gzip");
+            EXPECT_EQ(reply.body, compressTxt);
+            reply = identity.get();
+            EXPECT_EQ(reply.headers.count("Content-Encoding"), 0);
+            EXPECT_EQ(reply.body, compressTxt);
+        }
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, bundle)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/bundleTest/range.txt")));
+        curl.ingnoreInvalidSslCertificate();
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, RangeTxt);
+        EXPECT_EQ(reply.headers["Content-Type"], "text/plain");
+        auto etag = reply.headers["ETag"];
+        EXPECT_FALSE(etag.empty());
+
+        curl.setHeaders({{"If-None-Match", etag}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "304");
+
+        curl.setHeaders({{"Range", "bytes=10-15"}});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "206");
+        EXPECT_EQ(reply.body, "abcdef");
+
+        // the paths which are not in the bundle go to the files
+        curl.setHeaders({});
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/bundleTest/missing.txt")));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "404");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, bundleSwap)
+{
+    try {
+        const auto dir = std::filesystem::path{TESTS_WATCH_DIR} / ("bundle-" + GetParam());
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+        auto pack = [&](const std::string &content) {
+            writeFile(dir / "swap.txt", content);
+            auto command = std::string{TESTS_BUNDLE_TOOL} + " " + dir.string() + " " TESTS_SWAP_BUNDLE " > /dev/null";
+            ASSERT_EQ(std::system(command.c_str()), 0);
+        };
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/swapBundleTest/swap.txt")));
+        curl.ingnoreInvalidSslCertificate();
+        pack("version 1");
+        auto reply = waitFor(curl, "200", "version 1");
+        EXPECT_EQ(reply.body, "version 1");
+
+        // the requests served while the bundle is replaced get either the old or the new one
+        std::atomic<bool> quit{false};
+        std::atomic<int> requests{0}, unexpected{0};
+        std::thread reader{[&]{
+            Getodac::Test::EasyCurl curl;
+            curl.setUrl(url(GetParam(), "/swapBundleTest/swap.txt"));
+            curl.ingnoreInvalidSslCertificate();
+            while (!quit) {
+                auto reply = curl.get();
+                if (reply.status != "200" || (reply.body != "version 1" && reply.body != "version 2"))
+                    ++unexpected;
+                ++requests;
+            }
+        }};
+        pack("version 2");
+        reply = waitFor(curl, "200", "version 2");
+        EXPECT_EQ(reply.body, "version 2");
+        pack("version 1");
+        reply = waitFor(curl, "200", "version 1");
+        EXPECT_EQ(reply.body, "version 1");
+        quit = true;
+        reader.join();
+        EXPECT_GT(requests, 0);
+        EXPECT_EQ(unexpected, 0);
+
+        // a broken bundle is not loaded, the old one is still served
+        writeFile(TESTS_SWAP_BUNDLE ".tmp", "not a bundle");
+        std::filesystem::rename(TESTS_SWAP_BUNDLE ".tmp", TESTS_SWAP_BUNDLE);
+        std::this_thread::sleep_for(1500ms);
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "version 1");
+        pack("version 1");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST_P(StaticContent, virtualHost)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/range.txt")));
+        curl.ingnoreInvalidSslCertificate();
+        curl.setHeaders({{"Host", "www.VHost.test"}});
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, RangeTxt);
+
+        // the test plugin doesn't serve the *.vhost.test site, its root has no test100 file
+        EXPECT_NO_THROW(curl.setUrl(url(GetParam(), "/test100")));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "404");
+
+        curl.setHeaders({});
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+INSTANTIATE_TEST_CASE_P(StaticContent, StaticContent, testing::Values("http", "https"));
+
+} // namespace {
@@ -0,0 +1,69 @@
+/*
+    Copyright (C) 2022, BogDan Vatra <bogdan@kde.org>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License as
+    published by the Free Software Foundation, either version 3 of the
+    License, or (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <gtest/gtest.h>
+#include <EasyCurl.h>
+
+#include <unistd.h>
+
+#include "Utils.h"
+
+namespace {
+using namespace std;
+
+TEST(UnixSockets, responses)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        curl.setOptions(CURLOPT_UNIX_SOCKET_PATH, TESTS_UNIX_SOCKET);
+        EXPECT_NO_THROW(curl.setUrl("http://localhost/test100"));
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.headers["Connection"], "keep-alive");
+        EXPECT_EQ(reply.body.size(), 100);
+
+        EXPECT_NO_THROW(curl.setUrl("http://localhost/test50m"));
+        reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body.size(), 50 * 1024 * 1024);
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+TEST(UnixSockets, peerCredentials)
+{
+    try {
+        Getodac::Test::EasyCurl curl;
+        curl.setOptions(CURLOPT_UNIX_SOCKET_PATH, TESTS_UNIX_SOCKET);
+        EXPECT_NO_THROW(curl.setUrl("http://localhost/testPeerCredentials"));
+        auto reply = curl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "uid:" + std::to_string(getuid()));
+
+        // TCP connections have no peer credentials
+        Getodac::Test::EasyCurl tcpCurl;
+        EXPECT_NO_THROW(tcpCurl.setUrl(url("http", "/testPeerCredentials")));
+        reply = tcpCurl.get();
+        EXPECT_EQ(reply.status, "200");
+        EXPECT_EQ(reply.body, "none");
+    } catch(...) {
+        EXPECT_NO_THROW(throw);
+    }
+}
+
+} // namespace {
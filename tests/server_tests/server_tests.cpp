@@ -25,7 +25,8 @@
 extern std::string hugeData;
 
 int main(int argc, char **argv) {
-    Getodac::Test::startServer(std::filesystem::canonical(std::filesystem::path(argv[0])).parent_path().append("GETodac").string());
+    Getodac::Test::startServer(std::filesystem::canonical(std::filesystem::path(argv[0])).parent_path().append("GETodac").string(),
+                                  "-c " TESTS_CONF_DIR);
     for (int i = 0; i < 50 * 1024 * 1024; ++i)
         hugeData += char(33 + (i % 93));
     ::testing::InitGoogleTest(&argc, argv);